@@ -0,0 +1,274 @@
+//-----------------------------------------------------------------------
+// <copyright company="CoApp Project">
+//     Copyright (c) 2011 Garrett Serack . All rights reserved.
+// </copyright>
+// <license>
+//     The software is licensed under the Apache 2.0 License (the "License")
+//     You may not use the software except in compliance with the License.
+// </license>
+//-----------------------------------------------------------------------
+
+#pragma once
+
+// Bump allocator used for all the short-lived strings in the bootstrapper.
+//
+// Each thread gets its own arena, so there's no locking on the allocation path.
+// Memory is never zeroed and never freed piecemeal; callers take a mark with
+// ArenaGetMark() and hand everything allocated after it back with ArenaReset().
+// The blocks themselves are kept around and reused until the thread calls
+// DestroyThreadArena().
+//
+// Nothing here is Windows-specific beyond what coapp_platform.h covers.
+
+#define ARENA_BLOCK_SIZE	(64*1024)
+#define ARENA_ALIGNMENT		sizeof(void*)
+
+typedef struct ArenaBlock {
+	struct ArenaBlock* next;
+	size_t size;	// usable bytes following the header
+	size_t used;
+} ArenaBlock;
+
+typedef struct StringArena {
+	ArenaBlock* first;
+	ArenaBlock* current;
+	void* lastAllocation;
+	size_t lastAllocationSize;
+	size_t bytesInUse;
+} StringArena;
+
+typedef struct ArenaMark {
+	ArenaBlock* block;
+	size_t used;
+	size_t bytesInUse;
+} ArenaMark;
+
+THREAD_LOCAL StringArena* ThreadArena = NULL;
+
+// process-wide statistics (all threads)
+volatile LONG ArenaAllocations = 0;
+volatile LONG ArenaBytesAllocated = 0;
+volatile LONG ArenaBytesInUse = 0;
+volatile LONG ArenaPeakBytesInUse = 0;
+volatile LONG ArenaBytesReserved = 0;
+volatile LONG ArenaPeakBytesReserved = 0;
+
+#define ArenaBlockData(block) ((char*)((block)+1))
+
+void ArenaUpdatePeak(volatile LONG* peak, LONG value) {
+	LONG current;
+
+	do {
+		current = *peak;
+		if( value <= current ) {
+			return;
+		}
+	} while( AtomicCompareExchange(peak, value, current) != current );
+}
+
+StringArena* CurrentArena() {
+	if( ThreadArena == NULL ) {
+		ThreadArena = (StringArena*)malloc(sizeof(StringArena));
+		if( ThreadArena ) {
+			ZeroMemory(ThreadArena, sizeof(StringArena));
+		}
+	}
+	return ThreadArena;
+}
+
+ArenaBlock* NewArenaBlock(size_t minimumSize) {
+	ArenaBlock* block;
+	size_t size = minimumSize > ARENA_BLOCK_SIZE ? minimumSize : ARENA_BLOCK_SIZE;
+
+	block = (ArenaBlock*)malloc(sizeof(ArenaBlock) + size);
+	if( block ) {
+		block->next = NULL;
+		block->size = size;
+		block->used = 0;
+		ArenaUpdatePeak(&ArenaPeakBytesReserved, AtomicExchangeAdd(&ArenaBytesReserved, (LONG)(sizeof(ArenaBlock) + size)) + (LONG)(sizeof(ArenaBlock) + size));
+	}
+	return block;
+}
+
+///
+/// <summary>
+///		allocates uninitialized memory from the calling thread's arena.
+///		returns NULL on allocation failure.
+/// </summary>
+void* ArenaAllocate(size_t bytes) {
+	StringArena* arena = CurrentArena();
+	ArenaBlock* block;
+	void* result;
+
+	if( arena == NULL ) {
+		return NULL;
+	}
+
+	bytes = (bytes + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+
+	if( arena->current == NULL ) {
+		if( !(arena->first = arena->current = NewArenaBlock(bytes)) ) {
+			return NULL;
+		}
+	}
+
+	block = arena->current;
+	if( block->size - block->used < bytes ) {
+		// move on to the next block; reuse one left over from a reset if it's big enough.
+		if( block->next && block->next->size >= bytes ) {
+			block = block->next;
+			block->used = 0;
+		} else {
+			ArenaBlock* newBlock = NewArenaBlock(bytes);
+			if( newBlock == NULL ) {
+				return NULL;
+			}
+			newBlock->next = block->next;
+			block->next = newBlock;
+			block = newBlock;
+		}
+		arena->current = block;
+	}
+
+	result = ArenaBlockData(block) + block->used;
+	block->used += bytes;
+
+	arena->lastAllocation = result;
+	arena->lastAllocationSize = bytes;
+	arena->bytesInUse += bytes;
+
+	AtomicIncrement(&ArenaAllocations);
+	AtomicExchangeAdd(&ArenaBytesAllocated, (LONG)bytes);
+	ArenaUpdatePeak(&ArenaPeakBytesInUse, AtomicExchangeAdd(&ArenaBytesInUse, (LONG)bytes) + (LONG)bytes);
+
+	return result;
+}
+
+///
+/// <summary>
+///		shrinks the most recent allocation to the given size.
+///		does nothing if the pointer isn't the most recent allocation.
+/// </summary>
+void ArenaShrink(void* pointer, size_t bytes) {
+	StringArena* arena = ThreadArena;
+	size_t released;
+
+	if( arena == NULL || pointer == NULL || pointer != arena->lastAllocation ) {
+		return;
+	}
+
+	bytes = (bytes + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+	if( bytes >= arena->lastAllocationSize ) {
+		return;
+	}
+
+	released = arena->lastAllocationSize - bytes;
+	arena->current->used -= released;
+	arena->lastAllocationSize = bytes;
+	arena->bytesInUse -= released;
+	AtomicExchangeAdd(&ArenaBytesInUse, -(LONG)released);
+}
+
+///
+/// <summary>
+///		gives back the most recent allocation.
+///		anything else is left alone, and is reclaimed at the next reset.
+/// </summary>
+void ArenaRelease(void* pointer) {
+	StringArena* arena = ThreadArena;
+
+	if( arena == NULL || pointer == NULL || pointer != arena->lastAllocation ) {
+		return;
+	}
+	ArenaShrink(pointer, 0);
+	arena->lastAllocation = NULL;
+	arena->lastAllocationSize = 0;
+}
+
+ArenaMark ArenaGetMark() {
+	StringArena* arena = CurrentArena();
+	ArenaMark mark;
+
+	ZeroMemory(&mark, sizeof(mark));
+	if( arena && arena->current ) {
+		mark.block = arena->current;
+		mark.used = arena->current->used;
+		mark.bytesInUse = arena->bytesInUse;
+	}
+	return mark;
+}
+
+///
+/// <summary>
+///		releases everything allocated on this thread since the mark was taken.
+/// </summary>
+void ArenaReset(ArenaMark mark) {
+	StringArena* arena = ThreadArena;
+
+	if( arena == NULL || arena->current == NULL ) {
+		return;
+	}
+
+	if( mark.block == NULL ) {
+		arena->current = arena->first;
+		arena->current->used = 0;
+	} else {
+		arena->current = mark.block;
+		arena->current->used = mark.used;
+	}
+
+	if( arena->bytesInUse > mark.bytesInUse ) {
+		AtomicExchangeAdd(&ArenaBytesInUse, -(LONG)(arena->bytesInUse - mark.bytesInUse));
+	}
+	arena->bytesInUse = mark.bytesInUse;
+	arena->lastAllocation = NULL;
+	arena->lastAllocationSize = 0;
+}
+
+///
+/// <summary>
+///		releases everything allocated since the mark, except for one string
+///		which is moved down to the mark and returned.
+/// </summary>
+wchar_t* ArenaResetKeeping(ArenaMark mark, const wchar_t* keep) {
+	size_t size;
+	wchar_t* result;
+
+	if( keep == NULL ) {
+		ArenaReset(mark);
+		return NULL;
+	}
+
+	// the blocks aren't released by a reset, and the copy always lands at or
+	// below the string being kept, so memmove is safe here.
+	size = (wcslen(keep)+1)*sizeof(wchar_t);
+	ArenaReset(mark);
+	if( (result = (wchar_t*)ArenaAllocate(size)) ) {
+		memmove(result, keep, size);
+	}
+	return result;
+}
+
+///
+/// <summary>
+///		frees all the memory held by the calling thread's arena.
+///		threads that allocate strings must call this before they exit.
+/// </summary>
+void DestroyThreadArena() {
+	StringArena* arena = ThreadArena;
+	ArenaBlock* block;
+	ArenaBlock* next;
+
+	if( arena == NULL ) {
+		return;
+	}
+
+	AtomicExchangeAdd(&ArenaBytesInUse, -(LONG)arena->bytesInUse);
+	for( block = arena->first; block; block = next ) {
+		next = block->next;
+		AtomicExchangeAdd(&ArenaBytesReserved, -(LONG)(sizeof(ArenaBlock) + block->size));
+		free(block);
+	}
+	free(arena);
+	ThreadArena = NULL;
+}
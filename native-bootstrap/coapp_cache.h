@@ -0,0 +1,439 @@
+//-----------------------------------------------------------------------
+// <copyright company="CoApp Project">
+//     Copyright (c) 2011 Garrett Serack . All rights reserved.
+// </copyright>
+// <license>
+//     The software is licensed under the Apache 2.0 License (the "License")
+//     You may not use the software except in compliance with the License.
+// </license>
+//-----------------------------------------------------------------------
+
+#pragma once
+
+// Persistent cache of the files AcquireFile has downloaded.
+//
+// Files are stored by content hash, under %ALLUSERSPROFILE%\Application Data\CoApp\Bootstrap\Cache
+// (or %ProgramData% on Vista and up), as <sha256>\<filename>. The index file lists one entry per URL:
+//
+//		<sha256> <size> <fetched> <last-used> <signature> <filename> <etag> <last-modified> <url>
+//
+// tab-separated, one per line (see coapp_table.h). The folder is restricted to Administrators and
+// SYSTEM, like the rest of the bootstrap data folder (see coapp_data.h).
+//
+// Files come in from the downloads folder next to it, which is just as locked down, so they're
+// moved in rather than copied, and the hash they were checked with on the way in is the one that
+// goes in the index. <signature> says how they were checked: SIGNATURE_VALID for WinVerifyTrust,
+// SIGNATURE_UNVERIFIED for a file the manifest lists (its hash is what matters). Nothing is read
+// again on a hit: a file the manifest lists has to have the hash and size the manifest says (it
+// may be newer than the cache), and anything else has to have had a valid signature.
+
+void* GetRegistryValue(const wchar_t* keyname, const wchar_t* valueName,DWORD expectedDataType  );
+
+#define CACHE_INDEX_HEADER			L"CoAppBootstrapCache 1"
+#define CACHE_INDEX_FILENAME		L"index.txt"
+#define CACHE_MAX_ENTRIES			64
+#define CACHE_DEFAULT_SIZE_LIMIT	(256*1024*1024)
+#define CACHE_FRESH_SECONDS			(7*24*60*60)
+
+#define SIGNATURE_UNVERIFIED		0		// not checked; the manifest vouched for the hash
+#define SIGNATURE_VALID				1
+
+typedef struct CacheEntry {
+	wchar_t hash[SHA256_STRING_LENGTH+1];
+	__int64 size;
+	__int64 fetched;
+	__int64 lastUsed;
+	int signature;
+	wchar_t* filename;
+	wchar_t* etag;
+	wchar_t* lastModified;
+	wchar_t* url;
+} CacheEntry;
+
+// AcquireFile runs on the GUI thread and the worker thread at the same time.
+CRITICAL_SECTION CacheLock;
+BOOL CacheLoaded = FALSE;
+wchar_t* CacheFolder = NULL;
+CacheEntry CacheEntries[CACHE_MAX_ENTRIES];
+int CacheEntryCount = 0;
+__int64 CacheSizeLimit = CACHE_DEFAULT_SIZE_LIMIT;
+
+
+// returns the last segment of a url.
+const wchar_t* GetFilenameFromUrl( const wchar_t* url ) {
+	const wchar_t* result = url;
+
+	for( ; *url ; url++ ) {
+		if( *url == L'/' ) {
+			result = url+1;
+		}
+	}
+	return result;
+}
+
+
+void FreeCacheEntry( CacheEntry* entry ) {
+	free(entry->filename);
+	free(entry->etag);
+	free(entry->lastModified);
+	free(entry->url);
+	ZeroMemory(entry, sizeof(CacheEntry));
+}
+
+wchar_t* CacheContentPath( CacheEntry* entry ) {
+	return Sprintf(L"%s\\%s\\%s", CacheFolder, entry->hash, entry->filename);
+}
+
+int FindCacheEntry( const wchar_t* url ) {
+	int i;
+
+	for( i=0; i< CacheEntryCount; i++ ) {
+		if( lstrcmpi(CacheEntries[i].url, url) == 0 ) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+void RemoveCacheEntry( int index ) {
+	wchar_t* path;
+	int i;
+	BOOL shared = FALSE;
+
+	// the same content can be cached under more than one url.
+	for( i=0; i< CacheEntryCount; i++ ) {
+		if( i != index && lstrcmpi(CacheEntries[i].hash, CacheEntries[index].hash) == 0 && lstrcmpi(CacheEntries[i].filename, CacheEntries[index].filename) == 0 ) {
+			shared = TRUE;
+		}
+	}
+
+	if( !shared ) {
+		path = CacheContentPath(&CacheEntries[index]);
+		DeleteFile(path);
+		DeleteString(&path);
+
+		path = Sprintf(L"%s\\%s", CacheFolder, CacheEntries[index].hash);
+		RemoveDirectory(path);
+		DeleteString(&path);
+	}
+
+	FreeCacheEntry(&CacheEntries[index]);
+	CacheEntries[index] = CacheEntries[--CacheEntryCount];
+	ZeroMemory(&CacheEntries[CacheEntryCount], sizeof(CacheEntry));
+}
+
+void LoadCacheIndex() {
+	TableReader reader;
+	wchar_t* folder;
+	wchar_t* line;
+	wchar_t* cursor;
+	DWORD* limit;
+	CacheEntry* entry;
+	ArenaMark mark;
+
+	if( CacheLoaded ) {
+		return;
+	}
+	CacheLoaded = TRUE;
+	mark = ArenaGetMark();
+
+	__try {
+		if( (limit = (DWORD*)GetRegistryValue(L"Software\\CoApp", L"BootstrapCacheSize", REG_DWORD)) ) {
+			CacheSizeLimit = ((__int64)*limit)*1024*1024;	// in MB
+		}
+
+		if( !(folder = GetBootstrapDataFolder()) ) {
+			__leave;
+		}
+		folder = UrlOrPathCombine(folder, L"Cache", L'\\');
+		if( !CreateProtectedFolder(folder) || !(CacheFolder = _wcsdup(folder)) ) {
+			__leave;
+		}
+
+		if( !OpenTableReader(&reader, UrlOrPathCombine(CacheFolder, CACHE_INDEX_FILENAME, L'\\'), CACHE_INDEX_HEADER, 1024*1024) ) {
+			__leave;
+		}
+		while( CacheEntryCount < CACHE_MAX_ENTRIES && (line = NextTableLine(&reader)) ) {
+			cursor = line;
+			entry = &CacheEntries[CacheEntryCount];
+			wcsncpy_s(entry->hash, SHA256_STRING_LENGTH+1, SplitIndexField(&cursor), _TRUNCATE);
+			entry->size = _wtoi64(SplitIndexField(&cursor));
+			entry->fetched = _wtoi64(SplitIndexField(&cursor));
+			entry->lastUsed = _wtoi64(SplitIndexField(&cursor));
+			entry->signature = _wtoi(SplitIndexField(&cursor));
+			entry->filename = _wcsdup(SplitIndexField(&cursor));
+			entry->etag = _wcsdup(SplitIndexField(&cursor));
+			entry->lastModified = _wcsdup(SplitIndexField(&cursor));
+			entry->url = _wcsdup(SplitIndexField(&cursor));
+
+			if( !entry->filename || !entry->etag || !entry->lastModified || IsNullOrEmpty(entry->url) || wcslen(entry->hash) != SHA256_STRING_LENGTH ) {
+				FreeCacheEntry(entry);
+				continue;
+			}
+			CacheEntryCount++;
+		}
+		CloseTableReader(&reader);
+	} __finally {
+		ArenaReset(mark);
+	}
+}
+
+void SaveCacheIndex() {
+	TableWriter writer;
+	CacheEntry* entry;
+	int i;
+	ArenaMark mark;
+
+	if( CacheFolder == NULL ) {
+		return;
+	}
+	mark = ArenaGetMark();
+
+	if( CreateTableWriter(&writer, UrlOrPathCombine(CacheFolder, CACHE_INDEX_FILENAME, L'\\'), CACHE_INDEX_HEADER) ) {
+		for( i=0; i< CacheEntryCount; i++ ) {
+			entry = &CacheEntries[i];
+			WriteTableLine(&writer, L"%s\t%I64d\t%I64d\t%I64d\t%d\t%s\t%s\t%s\t%s", entry->hash, entry->size, entry->fetched, entry->lastUsed, entry->signature, entry->filename, entry->etag, entry->lastModified, entry->url);
+		}
+		CloseTableWriter(&writer);
+	}
+	ArenaReset(mark);
+}
+
+// drops the least recently used entries (other than keep) until there's room for what's coming in.
+void EvictCacheEntries( __int64 incomingSize, int incomingEntries, int keep ) {
+	__int64 total;
+	int i;
+	int oldest;
+
+	do {
+		total = incomingSize;
+		oldest = -1;
+		for( i=0; i< CacheEntryCount; i++ ) {
+			total += CacheEntries[i].size;
+			if( i != keep && (oldest < 0 || CacheEntries[i].lastUsed < CacheEntries[oldest].lastUsed) ) {
+				oldest = i;
+			}
+		}
+
+		if( oldest < 0 || (total <= CacheSizeLimit && CacheEntryCount + incomingEntries <= CACHE_MAX_ENTRIES) ) {
+			return;
+		}
+		TraceInfo(L"Evicting %s from the cache", CacheEntries[oldest].url);
+		RemoveCacheEntry(oldest);
+		if( keep == CacheEntryCount ) {
+			keep = oldest;	// it was moved into the hole.
+		}
+	} while( CacheEntryCount );
+}
+
+void InitializeCache() {
+	InitializeCriticalSection(&CacheLock);
+}
+
+// is what the index says about an entry still good enough to hand it out on? (see the top of this file)
+BOOL IsCacheEntryTrusted( CacheEntry* entry ) {
+	const ManifestArtifact* artifact = GetManifestArtifact(entry->filename);
+
+	if( artifact ) {
+		return artifact->size == entry->size && lstrcmpi(artifact->sha256, entry->hash) == 0;
+	}
+	return entry->signature == SIGNATURE_VALID;
+}
+
+///
+/// <summary>
+///		returns the path of an entry's file, as long as it's still trusted, still there and the 
+///		right size. one that isn't is dropped from the cache. (the lock must be held)
+/// </summary>
+wchar_t* CachedContent( int index ) {
+	WIN32_FILE_ATTRIBUTE_DATA fileData;
+	CacheEntry* entry = &CacheEntries[index];
+	wchar_t* result = NULL;
+
+	if( IsCacheEntryTrusted(entry) ) {
+		result = CacheContentPath(entry);
+		if( !GetFileAttributesEx(result, GetFileExInfoStandard, &fileData) || (((__int64)fileData.nFileSizeHigh << 32) | fileData.nFileSizeLow) != entry->size ) {
+			// it's gone, or it's not what we put there.
+			DeleteString(&result);
+		}
+	}
+	if( !result ) {
+		TraceError(L"The cached copy of %s doesn't check out, dropping it", entry->url);
+		RemoveCacheEntry(index);
+		SaveCacheIndex();
+	}
+	return result;
+}
+
+///
+/// <summary>
+///		looks for a fresh, verified copy of the file at the given url.
+///		returns the path of the cached file, or NULL if it's not in the cache.
+/// </summary>
+wchar_t* CacheLookup( const wchar_t* url ) {
+	wchar_t* result = NULL;
+	__int64 now = CurrentTimeInSeconds();
+	int index;
+
+	EnterCriticalSection(&CacheLock);
+	__try {
+		LoadCacheIndex();
+		if( (index = FindCacheEntry(url)) < 0 || now - CacheEntries[index].fetched > CACHE_FRESH_SECONDS ) {
+			__leave;
+		}
+
+		if( (result = CachedContent(index)) ) {
+			CacheEntries[index].lastUsed = now;
+			SaveCacheIndex();
+		}
+	} __finally {
+		LeaveCriticalSection(&CacheLock);
+	}
+	return result;
+}
+
+///
+/// <summary>
+///		gets the validators of a cached (but not fresh) copy of the file at the given url, so that 
+///		the download can be made conditional. etag and lastModified must hold MAX_VALIDATOR_LENGTH characters.
+///		returns FALSE if there's nothing usable in the cache.
+/// </summary>
+BOOL CacheGetValidators( const wchar_t* url, wchar_t* etag, wchar_t* lastModified ) {
+	wchar_t* path = NULL;
+	int index;
+
+	*etag = *lastModified = 0;
+	EnterCriticalSection(&CacheLock);
+	__try {
+		LoadCacheIndex();
+		if( (index = FindCacheEntry(url)) < 0 || !(path = CachedContent(index)) ) {
+			__leave;
+		}
+		wcsncpy_s(etag, MAX_VALIDATOR_LENGTH, CacheEntries[index].etag, _TRUNCATE);
+		wcsncpy_s(lastModified, MAX_VALIDATOR_LENGTH, CacheEntries[index].lastModified, _TRUNCATE);
+	} __finally {
+		LeaveCriticalSection(&CacheLock);
+	}
+	DeleteString(&path);
+	return *etag || *lastModified;
+}
+
+///
+/// <summary>
+///		the server says the cached copy of the file at the given url is still current; 
+///		marks it fresh again and returns its path (or NULL if it has gone away since).
+/// </summary>
+wchar_t* CacheRevalidate( const wchar_t* url ) {
+	wchar_t* result = NULL;
+	int index;
+
+	EnterCriticalSection(&CacheLock);
+	__try {
+		LoadCacheIndex();
+		if( (index = FindCacheEntry(url)) < 0 ) {
+			__leave;
+		}
+
+		if( (result = CachedContent(index)) ) {
+			CacheEntries[index].fetched = CacheEntries[index].lastUsed = CurrentTimeInSeconds();
+			SaveCacheIndex();
+		}
+	} __finally {
+		LeaveCriticalSection(&CacheLock);
+	}
+	return result;
+}
+
+///
+/// <summary>
+///		moves a downloaded file into the cache. it has to have been checked already (with 
+///		IsTrustedFileEx), and be in the downloads folder (see ClaimRaceFile), so that it can't have
+///		changed since. hash is what it was checked with.
+///		returns the path of the cached file, or NULL if it couldn't be cached (the file is left where it was).
+/// </summary>
+wchar_t* CacheStore( const wchar_t* url, const wchar_t* etag, const wchar_t* lastModified, const wchar_t* filename, const wchar_t* hash ) {
+	WIN32_FILE_ATTRIBUTE_DATA fileData;
+	CacheEntry* entry;
+	wchar_t* folder;
+	wchar_t* result = NULL;
+	wchar_t* entryFilename = NULL;
+	wchar_t* entryEtag = NULL;
+	wchar_t* entryLastModified = NULL;
+	wchar_t* entryUrl = NULL;
+	__int64 size;
+	int index;
+
+	if( IsNullOrEmpty(url) || IsNullOrEmpty(hash) || wcslen(hash) != SHA256_STRING_LENGTH || !GetFileAttributesEx(filename, GetFileExInfoStandard, &fileData) ) {
+		return NULL;
+	}
+	size = ((__int64)fileData.nFileSizeHigh << 32) | fileData.nFileSizeLow;
+
+	EnterCriticalSection(&CacheLock);
+	__try {
+		LoadCacheIndex();
+		if( CacheFolder == NULL || size > CacheSizeLimit ) {
+			__leave;
+		}
+
+		// everything the entry needs, before anything in the cache is touched: if there isn't the 
+		// memory for it, whatever's cached for the url now stays just as it is (index and content both).
+		entryFilename = _wcsdup(GetFilenameFromUrl(url));
+		entryEtag = _wcsdup(etag ? etag : L"");
+		entryLastModified = _wcsdup(lastModified ? lastModified : L"");
+		entryUrl = _wcsdup(url);
+		if( !entryFilename || !entryEtag || !entryLastModified || !entryUrl ) {
+			__leave;
+		}
+
+		if( (index = FindCacheEntry(url)) < 0 ) {
+			EvictCacheEntries(size, 1, -1);
+			index = CacheEntryCount++;
+		} else {
+			entry = &CacheEntries[index];
+			if( lstrcmpi(entry->hash, hash) ) {
+				// different content at the same url, the old one has to go.
+				RemoveCacheEntry(index);
+				index = CacheEntryCount++;
+			} else {
+				FreeCacheEntry(entry);
+			}
+		}
+
+		entry = &CacheEntries[index];
+		wcscpy_s(entry->hash, SHA256_STRING_LENGTH+1, hash);
+		entry->size = size;
+		entry->fetched = entry->lastUsed = CurrentTimeInSeconds();
+		// it was checked against the manifest if it's listed there, and by its signature if it isn't.
+		entry->signature = GetManifestArtifact(GetFilenameFromUrl(url)) ? SIGNATURE_UNVERIFIED : SIGNATURE_VALID;
+		entry->filename = entryFilename;
+		entry->etag = entryEtag;
+		entry->lastModified = entryLastModified;
+		entry->url = entryUrl;
+		entryFilename = entryEtag = entryLastModified = entryUrl = NULL;
+
+		folder = Sprintf(L"%s\\%s", CacheFolder, entry->hash);
+		CreateDirectory(folder, NULL);
+		DeleteString(&folder);
+		result = CacheContentPath(entry);
+
+		if( FileExists(result) ) {
+			// already have this content under another url.
+			DeleteFile(filename);
+		} else if( !MoveFileEx(filename, result, 0) ) {
+			DeleteString(&result);
+			RemoveCacheEntry(index);
+			__leave;
+		}
+
+		EvictCacheEntries(0, 0, index);
+		SaveCacheIndex();
+	} __finally {
+		LeaveCriticalSection(&CacheLock);
+		// only still here if they never made it into an entry.
+		free(entryFilename);
+		free(entryEtag);
+		free(entryLastModified);
+		free(entryUrl);
+	}
+	return result;
+}
@@ -0,0 +1,99 @@
+//-----------------------------------------------------------------------
+// <copyright company="CoApp Project">
+//     Copyright (c) 2011 Garrett Serack . All rights reserved.
+// </copyright>
+// <license>
+//     The software is licensed under the Apache 2.0 License (the "License")
+//     You may not use the software except in compliance with the License.
+// </license>
+//-----------------------------------------------------------------------
+
+#pragma once
+
+// The list of places a file can be fetched from, and the order they're tried in (see
+// AcquireFile and RaceRemoteCandidates in coapp_file.h). Like the manifest it's built from,
+// none of this touches the OS.
+
+#define MAX_REMOTE_CANDIDATES	12
+
+// the servers a file is asked for from, besides the mirrors the manifest lists. any can be NULL.
+typedef struct CandidateServers {
+	const wchar_t* additional;		// the caller's own, for this file
+	const wchar_t* bootstrap;		// BootstrapServer, from the registry
+	const wchar_t* coapp;
+} CandidateServers;
+
+// a file that can be fetched from a server; candidates are listed in priority order.
+typedef struct RemoteCandidate {
+	const wchar_t* server;
+	const wchar_t* filename;
+	const wchar_t* validator;	// the server's validator, if it turns out not to have the file (see coapp_misses.h)
+} RemoteCandidate;
+
+void AddRemoteCandidate( RemoteCandidate* candidates, int* count, const wchar_t* server, const wchar_t* filename ) {
+	if( *count < MAX_REMOTE_CANDIDATES && !IsNullOrEmpty(server) ) {
+		candidates[*count].server = server;
+		candidates[*count].filename = filename;
+		candidates[*count].validator = NULL;
+		(*count)++;
+	}
+}
+
+void AddManifestMirrors( RemoteCandidate* candidates, int* count, const ManifestArtifact* artifact ) {
+	int i;
+
+	for( i=0; artifact && i< artifact->mirrorCount; i++ ) {
+		AddRemoteCandidate(candidates, count, artifact->mirrors[i], artifact->publishedName);
+	}
+}
+
+///
+/// <summary>
+///		lists everywhere a file can be downloaded from, in priority order: the regular file off the
+///		additional server, then the localized file off the bootstrap and CoApp servers and its mirrors 
+///		(if tryLocalized), then the regular file off those and its mirrors (if tryNeutral). 
+///		returns how many there are.
+/// </summary>
+int ListRemoteCandidates( RemoteCandidate* candidates, const ArtifactManifest* manifest, const CandidateServers* servers, 
+						const wchar_t* filename, const wchar_t* localizedFilename, unsigned long lcid, int tryLocalized, int tryNeutral ) {
+	int count = 0;
+
+	AddRemoteCandidate(candidates, &count, servers->additional, filename);
+	if( tryLocalized ) {
+		AddRemoteCandidate(candidates, &count, servers->bootstrap, localizedFilename);
+		AddRemoteCandidate(candidates, &count, servers->coapp, localizedFilename);
+		AddManifestMirrors(candidates, &count, FindManifestVariant(manifest, filename, lcid));
+	}
+	if( tryNeutral ) {
+		AddRemoteCandidate(candidates, &count, servers->bootstrap, filename);
+		AddRemoteCandidate(candidates, &count, servers->coapp, filename);
+		AddManifestMirrors(candidates, &count, FindManifestVariant(manifest, filename, 0));
+	}
+	return count;
+}
+
+///
+/// <summary>
+///		puts each run of candidates for the same file in order of expected[] (which is kept in step),
+///		smallest first. ties keep the order they were added in.
+/// </summary>
+void SortRemoteCandidates( RemoteCandidate* candidates, __int64* expected, int count ) {
+	RemoteCandidate candidate;
+	__int64 key;
+	int start;
+	int i;
+	int j;
+
+	for( start = 0; start < count; start = i ) {
+		for( i = start+1; i< count && ManifestNameEquals(candidates[i].filename, candidates[start].filename); i++ ) {
+			candidate = candidates[i];
+			key = expected[i];
+			for( j = i; j > start && expected[j-1] > key; j-- ) {
+				candidates[j] = candidates[j-1];
+				expected[j] = expected[j-1];
+			}
+			candidates[j] = candidate;
+			expected[j] = key;
+		}
+	}
+}
@@ -0,0 +1,179 @@
+//-----------------------------------------------------------------------
+// <copyright company="CoApp Project">
+//     Copyright (c) 2011 Garrett Serack . All rights reserved.
+// </copyright>
+// <license>
+//     The software is licensed under the Apache 2.0 License (the "License")
+//     You may not use the software except in compliance with the License.
+// </license>
+//-----------------------------------------------------------------------
+
+#pragma once
+
+// The bootstrap data folder: %ALLUSERSPROFILE%\Application Data\CoApp\Bootstrap (or %ProgramData%
+// on Vista and up), where the cache, mirror health, misses, downloads in progress and run reports
+// are kept between runs. It's restricted to Administrators and SYSTEM, and only used when we're
+// elevated: nobody else gets to write what an elevated run will trust.
+
+#define DATA_FOLDER_SDDL			L"O:BAD:P(A;OICI;GA;;;BA)(A;OICI;GA;;;SY)"
+
+volatile LONG Elevated = -1;
+
+__int64 CurrentTimeInSeconds() {
+	FILETIME now;
+	ULARGE_INTEGER value;
+
+	GetSystemTimeAsFileTime(&now);
+	value.LowPart = now.dwLowDateTime;
+	value.HighPart = now.dwHighDateTime;
+	return (__int64)(value.QuadPart / 10000000);
+}
+
+///
+/// <summary>
+///		TRUE if we're running as an administrator (elevated, on Vista and up). the data folder is 
+///		only touched when we are: nobody else gets to write what an elevated run will trust.
+/// </summary>
+BOOL IsElevated() {
+	SID_IDENTIFIER_AUTHORITY ntAuth = SECURITY_NT_AUTHORITY;
+	PSID administrators = NULL;
+	BOOL isAdmin = FALSE;
+
+	if( Elevated < 0 ) {
+		if( AllocateAndInitializeSid(&ntAuth, 2, SECURITY_BUILTIN_DOMAIN_RID, DOMAIN_ALIAS_RID_ADMINS, 0, 0, 0, 0, 0, 0, &administrators) ) {
+			if( !CheckTokenMembership(NULL, administrators, &isAdmin) ) {
+				isAdmin = FALSE;
+			}
+			FreeSid(administrators);
+		}
+		InterlockedExchange(&Elevated, isAdmin ? 1 : 0);
+	}
+	return Elevated > 0;
+}
+
+// TRUE if path is a folder (and not a link to one somewhere else) owned by Administrators or SYSTEM.
+BOOL IsFolderOwnedByAdministrators( const wchar_t* path ) {
+	PSECURITY_DESCRIPTOR descriptor = NULL;
+	PSID owner = NULL;
+	DWORD attributes = GetFileAttributes(path);
+	BOOL result;
+
+	if( attributes == INVALID_FILE_ATTRIBUTES || !(attributes & FILE_ATTRIBUTE_DIRECTORY) || (attributes & FILE_ATTRIBUTE_REPARSE_POINT) ) {
+		return FALSE;
+	}
+	if( ERROR_SUCCESS != GetNamedSecurityInfo((LPWSTR)path, SE_FILE_OBJECT, OWNER_SECURITY_INFORMATION, &owner, NULL, NULL, NULL, &descriptor) ) {
+		return FALSE;
+	}
+	result = owner && (IsWellKnownSid(owner, WinBuiltinAdministratorsSid) || IsWellKnownSid(owner, WinLocalSystemSid));
+	LocalFree(descriptor);
+	return result;
+}
+
+// deletes a folder and everything in it. links are removed, never followed.
+BOOL DeleteFolderTree( const wchar_t* path ) {
+	WIN32_FIND_DATA findData;
+	HANDLE find;
+	wchar_t* child;
+	DWORD attributes = GetFileAttributes(path);
+	ArenaMark mark;
+
+	if( attributes == INVALID_FILE_ATTRIBUTES ) {
+		return FALSE;
+	}
+	if( !(attributes & FILE_ATTRIBUTE_DIRECTORY) ) {
+		SetFileAttributes(path, FILE_ATTRIBUTE_NORMAL);
+		return DeleteFile(path);
+	}
+
+	if( !(attributes & FILE_ATTRIBUTE_REPARSE_POINT) ) {
+		mark = ArenaGetMark();
+		if( INVALID_HANDLE_VALUE != (find = FindFirstFile(UrlOrPathCombine(path, L"*", L'\\'), &findData)) ) {
+			do {
+				if( lstrcmp(findData.cFileName, L".") && lstrcmp(findData.cFileName, L"..") ) {
+					child = UrlOrPathCombine(path, findData.cFileName, L'\\');
+					DeleteFolderTree(child);
+					DeleteString(&child);
+				}
+			} while( FindNextFile(find, &findData) );
+			FindClose(find);
+		}
+		ArenaReset(mark);
+	}
+	return RemoveDirectory(path);
+}
+
+///
+/// <summary>
+///		creates a folder only Administrators and SYSTEM can get into, or makes sure the one that's 
+///		there already is. one that somebody else owns (they could have planted anything in it) is 
+///		moved out of the way and deleted, and a new one made in its place.
+/// </summary>
+BOOL CreateProtectedFolder( const wchar_t* path ) {
+	SECURITY_ATTRIBUTES securityAttributes;
+	wchar_t* untrusted;
+	BOOL result = FALSE;
+
+	ZeroMemory(&securityAttributes, sizeof(securityAttributes));
+	securityAttributes.nLength = sizeof(securityAttributes);
+
+	if( !ConvertStringSecurityDescriptorToSecurityDescriptor(DATA_FOLDER_SDDL, SDDL_REVISION_1, &securityAttributes.lpSecurityDescriptor, NULL) ) {
+		return FALSE;
+	}
+
+	if( CreateDirectory(path, &securityAttributes) ) {
+		result = TRUE;
+	} else if( GetLastError() == ERROR_ALREADY_EXISTS ) {
+		if( IsFolderOwnedByAdministrators(path) ) {
+			// one of ours; make sure it's still locked down.
+			result = SetFileSecurity(path, DACL_SECURITY_INFORMATION, securityAttributes.lpSecurityDescriptor);
+		} else {
+			// renamed first, so nothing can be slipped into it while it's being emptied.
+			TraceError(L"%s isn't owned by Administrators, replacing it", path);
+			untrusted = Sprintf(L"%s.%u.untrusted", path, GetTickCount());
+			if( untrusted && MoveFile(path, untrusted) ) {
+				DeleteFolderTree(untrusted);
+				result = CreateDirectory(path, &securityAttributes);
+			}
+			DeleteString(&untrusted);
+		}
+	}
+
+	LocalFree(securityAttributes.lpSecurityDescriptor);
+	return result;
+}
+
+///
+/// <summary>
+///		returns the folder the bootstrapper keeps its data in between runs, creating it if needed.
+///		returns NULL on error, or if we're not elevated (the check for .NET comes first, so that 
+///		can be the case: the cache, mirror health and misses all do without, then).
+/// </summary>
+wchar_t* GetBootstrapDataFolder() {
+	wchar_t* result;
+	wchar_t* coappFolder;
+
+	if( !IsElevated() ) {
+		return NULL;
+	}
+
+	result = NewString();
+	if( FAILED(SHGetFolderPath(NULL, CSIDL_COMMON_APPDATA | CSIDL_FLAG_CREATE, NULL, SHGFP_TYPE_CURRENT, result)) ) {
+		DeleteString(&result);
+		return NULL;
+	}
+	TrimString(result);
+
+	coappFolder = UrlOrPathCombine(result, L"CoApp", L'\\');
+	CreateDirectory(coappFolder, NULL);
+	if( !IsFolderOwnedByAdministrators(coappFolder) ) {
+		// whoever owns it could swap our folder out from under us.
+		TraceError(L"%s isn't owned by Administrators, not keeping anything in it", coappFolder);
+		return NULL;
+	}
+
+	result = UrlOrPathCombine(coappFolder, L"Bootstrap", L'\\');
+	if( !CreateProtectedFolder(result) ) {
+		return NULL;
+	}
+	return result;
+}
@@ -0,0 +1,140 @@
+//-----------------------------------------------------------------------
+// <copyright company="CoApp Project">
+//     Copyright (c) 2011 Garrett Serack . All rights reserved.
+// </copyright>
+// <license>
+//     The software is licensed under the Apache 2.0 License (the "License")
+//     You may not use the software except in compliance with the License.
+// </license>
+//-----------------------------------------------------------------------
+
+#pragma once
+
+// Prerequisite detection: what .NET 4.x (if any) is on the box.
+//
+// Everything is looked up by name, and each key is opened once, with all the values
+// that matter read from it while it's open. The answer comes back as a snapshot,
+// rather than a yes/no for one particular registry value.
+//
+// The registry itself is reached through a DetectionBackend, so this part is plain C
+// with no Windows dependencies; anything that can answer the three calls (say, a table
+// of made-up keys and values) can stand in for the real thing.
+
+#include <string.h>
+#include <wchar.h>
+
+#define NDP_V4_FULL_KEY		L"Software\\Microsoft\\NET Framework Setup\\NDP\\v4\\Full"
+#define NDP_V4_CLIENT_KEY	L"Software\\Microsoft\\NET Framework Setup\\NDP\\v4\\Client"
+
+typedef enum FrameworkVersion {
+	FRAMEWORK_NONE = 0,
+	FRAMEWORK_40,
+	FRAMEWORK_45,
+	FRAMEWORK_451,
+	FRAMEWORK_452,
+	FRAMEWORK_46,
+	FRAMEWORK_461,
+	FRAMEWORK_462,
+	FRAMEWORK_47,
+	FRAMEWORK_471,
+	FRAMEWORK_472,
+	FRAMEWORK_48
+} FrameworkVersion;
+
+typedef struct DetectionBackend {
+	void* context;
+	// opens a key under HKLM; NULL if it isn't there.
+	void* (*openKey)( void* context, const wchar_t* path );
+	// reads a DWORD value; returns 0 if it isn't there (or isn't a DWORD).
+	int (*queryDword)( void* context, void* key, const wchar_t* name, unsigned long* value );
+	void (*closeKey)( void* context, void* key );
+} DetectionBackend;
+
+typedef struct FrameworkSnapshot {
+	int fullInstalled;			// v4\Full, Install = 1
+	int clientInstalled;		// v4\Client, Install = 1
+	unsigned long release;		// v4\Full, Release (0 if there isn't one -- that's plain 4.0)
+	FrameworkVersion version;	// the newest one that's there
+	int queries;				// how many times the registry was asked for something
+} FrameworkSnapshot;
+
+// the lowest Release value for each version (from the .NET deployment guide)
+typedef struct FrameworkRelease {
+	unsigned long release;
+	FrameworkVersion version;
+	const wchar_t* name;
+} FrameworkRelease;
+
+const FrameworkRelease FrameworkReleases[] = {
+	{ 528040, FRAMEWORK_48,  L"4.8" },
+	{ 461808, FRAMEWORK_472, L"4.7.2" },
+	{ 461308, FRAMEWORK_471, L"4.7.1" },
+	{ 460798, FRAMEWORK_47,  L"4.7" },
+	{ 394802, FRAMEWORK_462, L"4.6.2" },
+	{ 394254, FRAMEWORK_461, L"4.6.1" },
+	{ 393295, FRAMEWORK_46,  L"4.6" },
+	{ 379893, FRAMEWORK_452, L"4.5.2" },
+	{ 378675, FRAMEWORK_451, L"4.5.1" },
+	{ 378389, FRAMEWORK_45,  L"4.5" },
+};
+
+#define FRAMEWORK_RELEASE_COUNT		(sizeof(FrameworkReleases) / sizeof(FrameworkReleases[0]))
+
+const wchar_t* FrameworkVersionName( FrameworkVersion version ) {
+	size_t i;
+
+	if( version == FRAMEWORK_NONE ) {
+		return L"none";
+	}
+	if( version == FRAMEWORK_40 ) {
+		return L"4.0";
+	}
+	for( i=0; i< FRAMEWORK_RELEASE_COUNT; i++ ) {
+		if( FrameworkReleases[i].version == version ) {
+			return FrameworkReleases[i].name;
+		}
+	}
+	return L"unknown";
+}
+
+FrameworkVersion FrameworkVersionFromRelease( unsigned long release ) {
+	size_t i;
+
+	for( i=0; i< FRAMEWORK_RELEASE_COUNT; i++ ) {
+		if( release >= FrameworkReleases[i].release ) {
+			return FrameworkReleases[i].version;
+		}
+	}
+	// older than any we know of (a 4.5 preview); counts as 4.0.
+	return FRAMEWORK_40;
+}
+
+///
+/// <summary>
+///		works out what's installed, in one pass over the registry (each key is opened once).
+/// </summary>
+void DetectFrameworks( const DetectionBackend* backend, FrameworkSnapshot* snapshot ) {
+	void* key;
+	unsigned long value;
+
+	memset(snapshot, 0, sizeof(FrameworkSnapshot));
+
+	if( (key = backend->openKey(backend->context, NDP_V4_FULL_KEY)) ) {
+		snapshot->queries += 2;
+		snapshot->fullInstalled = backend->queryDword(backend->context, key, L"Install", &value) && value == 1;
+		if( !backend->queryDword(backend->context, key, L"Release", &snapshot->release) ) {
+			snapshot->release = 0;
+		}
+		backend->closeKey(backend->context, key);
+	}
+
+	if( (key = backend->openKey(backend->context, NDP_V4_CLIENT_KEY)) ) {
+		snapshot->queries++;
+		snapshot->clientInstalled = backend->queryDword(backend->context, key, L"Install", &value) && value == 1;
+		backend->closeKey(backend->context, key);
+	}
+
+	if( snapshot->fullInstalled || snapshot->clientInstalled ) {
+		snapshot->version = snapshot->release ? FrameworkVersionFromRelease(snapshot->release) : FRAMEWORK_40;
+	}
+}
@@ -1,701 +1,1373 @@
-//-----------------------------------------------------------------------
-// <copyright company="CoApp Project">
-//     Copyright (c) 2011 Garrett Serack . All rights reserved.
-// </copyright>
-// <license>
-//     The software is licensed under the Apache 2.0 License (the "License")
-//     You may not use the software except in compliance with the License. 
-// </license>
-//-----------------------------------------------------------------------
-
-#pragma once
-void SetProgressValue( int overallprogress );
-
-///
-/// <summary> 
-///		combines a path and a filename
-/// </summary>
- wchar_t* UrlOrPathCombine(const wchar_t* path, const wchar_t* name, wchar_t seperator) {
-	if( IsNullOrEmpty(path) && IsNullOrEmpty(name) ) {
-		 return NewString();
-	}
-
-	if( IsNullOrEmpty(path) ){
-		 return DuplicateString(name);
-	}
-
-	if( IsNullOrEmpty(name) ){
-		 return DuplicateString(path);
-	}
-
-	if( path[SafeStringLengthInCharacters( path )-1] == seperator  ) {
-		return Sprintf( L"%s%s" , path, name );
-	}
-	return Sprintf(L"%s%c%s" , path, seperator, name );
-}
-
- 
-///
-/// <summary> 
-///		creates a temporary name for a file 
-///		caller must free the memory for the string returned.
-///		returns NULL on error.
-/// </summary>
-wchar_t* UniqueTempFileName(const wchar_t* name,const wchar_t* extension) {
-	DWORD returnValue = 0;
-	wchar_t tempFolderPath[BUFSIZE];
-	wchar_t* filename = NULL;
-	wchar_t* result = NULL;
-
-	returnValue = GetTempPath(BUFSIZE,  tempFolderPath); 
-	
-	if (returnValue > BUFSIZE || (returnValue == 0)) {
-		free( filename );
-		return NULL;
-	}
-
-	filename = Sprintf(L"%s[%d].%s", name , GetTickCount(), extension );
-
-	result = UrlOrPathCombine(tempFolderPath, filename, L'\\' );
-	DeleteString( &filename );
-	return result;
-}
-
-wchar_t* TempFileName(const wchar_t* name) {
-	DWORD returnValue = 0;
-	wchar_t tempFolderPath[BUFSIZE];
-
-	returnValue = GetTempPath(BUFSIZE,  tempFolderPath); 
-	
-	if (returnValue > BUFSIZE || (returnValue == 0)) {
-		return NULL;
-	}
-
-	return UrlOrPathCombine(tempFolderPath, name, L'\\' );
-}
-
-
-// given a path, returns the folder that contains it.
-wchar_t* GetFolderFromPath( const wchar_t* path ) {
-	wchar_t* result = DuplicateString(path);
-	wchar_t* position = NULL;
-	int length= wcslen(result);
-
-	position = result+length;
-	while( position >= result && position[0] != L'\\')
-		position--;
-	position[1] = 0;
-
-	return result;
-}
-
-const wchar_t* GetFilenameFromPath( const wchar_t* path ) {
-	const wchar_t* position = NULL;
-	int length= wcslen(path);
-
-	position = path+length;
-	while( position >= path && position[0] != L'\\')
-		position--;
-
-	return position+1;
-}
-
-BOOL FileExists(const wchar_t* filePath) {
-    WIN32_FILE_ATTRIBUTE_DATA fileData;
-
-    if( IsNullOrEmpty(filePath) ) {
-        return 0;
-	}
-
-    return GetFileAttributesEx( filePath, GetFileExInfoStandard, &fileData);
-}
-
-BOOL IsEmbeddedSignatureValid(LPCWSTR pwszSourceFile)
-{
-    LONG lStatus;
-    DWORD dwLastError;
-
-    // Initialize the WINTRUST_FILE_INFO structure.
-
-    WINTRUST_FILE_INFO FileData;
-    GUID WVTPolicyGUID = WINTRUST_ACTION_GENERIC_VERIFY_V2;
-    WINTRUST_DATA WinTrustData;
-
-	if( !FileExists(pwszSourceFile) )
-		return FALSE;
-
-#ifdef _DEBUG
-	return TRUE;
-#endif
-
-    memset(&FileData, 0, sizeof(FileData));
-    FileData.cbStruct = sizeof(WINTRUST_FILE_INFO);
-    FileData.pcwszFilePath = pwszSourceFile;
-    FileData.hFile = NULL;
-    FileData.pgKnownSubject = NULL;
-
-    /*
-    WVTPolicyGUID specifies the policy to apply on the file
-    WINTRUST_ACTION_GENERIC_VERIFY_V2 policy checks:
-    
-    1) The certificate used to sign the file chains up to a root 
-    certificate located in the trusted root certificate store. This 
-    implies that the identity of the publisher has been verified by 
-    a certification authority.
-    
-    2) In cases where user interface is displayed (which this example
-    does not do), WinVerifyTrust will check for whether the  
-    end entity certificate is stored in the trusted publisher store,  
-    implying that the user trusts content from this publisher.
-    
-    3) The end entity certificate has sufficient permission to sign 
-    code, as indicated by the presence of a code signing EKU or no 
-    EKU.
-    */
-
-
-    // Initialize the WinVerifyTrust input data structure.
-
-    // Default all fields to 0.
-	ZeroMemory(&WinTrustData, sizeof(WinTrustData));
-    WinTrustData.cbStruct = sizeof(WinTrustData);
-    
-    // Use default code signing EKU.
-    WinTrustData.pPolicyCallbackData = NULL;
-
-    // No data to pass to SIP.
-    WinTrustData.pSIPClientData = NULL;
-
-    // Disable WVT UI.
-    WinTrustData.dwUIChoice = WTD_UI_NONE;
-
-    // No revocation checking.
-    WinTrustData.fdwRevocationChecks = WTD_REVOKE_NONE; 
-
-    // Verify an embedded signature on a file.
-    WinTrustData.dwUnionChoice = WTD_CHOICE_FILE;
-
-    // Default verification.
-    WinTrustData.dwStateAction = 0;
-
-    // Not applicable for default verification of embedded signature.
-    WinTrustData.hWVTStateData = NULL;
-
-    // Not used.
-    WinTrustData.pwszURLReference = NULL;
-
-    // Default.
-    WinTrustData.dwProvFlags = WTD_SAFER_FLAG;
-
-    // This is not applicable if there is no UI because it changes 
-    // the UI to accommodate running applications instead of 
-    // installing applications.
-    WinTrustData.dwUIContext = 0;
-
-    // Set pFile.
-    WinTrustData.pFile = &FileData;
-
-    // WinVerifyTrust verifies signatures as specified by the GUID 
-    // and Wintrust_Data.
-    lStatus = WinVerifyTrust( NULL, &WVTPolicyGUID, &WinTrustData);
-
-    switch (lStatus) {
-        case ERROR_SUCCESS:
-            /*
-            Signed file:
-                - Hash that represents the subject is trusted.
-
-                - Trusted publisher without any verification errors.
-
-                - UI was disabled in dwUIChoice. No publisher or 
-                    time stamp chain errors.
-
-                - UI was enabled in dwUIChoice and the user clicked 
-                    "Yes" when asked to install and run the signed 
-                    subject.
-            */
-            // wprintf_s(L"The file \"%s\" is signed and the signature was verified.\n", pwszSourceFile);
-			return TRUE;
-            break;
-        
-        case TRUST_E_NOSIGNATURE:
-            // The file was not signed or had a signature 
-            // that was not valid.
-
-            // Get the reason for no signature.
-            dwLastError = GetLastError();
-            if (TRUST_E_NOSIGNATURE == dwLastError || TRUST_E_SUBJECT_FORM_UNKNOWN == dwLastError || TRUST_E_PROVIDER_UNKNOWN == dwLastError) {
-                // The file was not signed.
-                // wprintf_s(L"The file \"%s\" is not signed.\n pwszSourceFile);
-            }  else {
-                // The signature was not valid or there was an error 
-                // opening the file.
-               //  wprintf_s(L"An unknown error occurred trying to  verify the signature of the \"%s\" file.\n", pwszSourceFile);
-            }
-
-            break;
-
-        case TRUST_E_EXPLICIT_DISTRUST:
-            // The hash that represents the subject or the publisher 
-            // is not allowed by the admin or user.
-            // wprintf_s(L"The signature is present, but specifically disallowed.\n");
-            break;
-
-        case TRUST_E_SUBJECT_NOT_TRUSTED:
-            // The user clicked "No" when asked to install and run.
-            // wprintf_s(L"The signature is present, but not trusted.\n");
-            break;
-
-        case CRYPT_E_SECURITY_SETTINGS:
-            /*
-            The hash that represents the subject or the publisher 
-            was not explicitly trusted by the admin and the 
-            admin policy has disabled user trust. No signature, 
-            publisher or time stamp errors.
-            */
-            // wprintf_s(L"CRYPT_E_SECURITY_SETTINGS - The hash representing the subject or the publisher wasn't explicitly trusted by the admin and admin policy has disabled user trust. No signature, publisher or timestamp errors.\n");
-            break;
-
-        default:
-            // The UI was disabled in dwUIChoice or the admin policy 
-            // has disabled user trust. lStatus contains the 
-            // publisher or time stamp chain error.
-            // wprintf_s(L"Error is: 0x%x.\n", lStatus);
-            break;
-    }
-    return FALSE;
-}
-
-#define DOWNLOAD_FAIL_CANCELLED			 -12
-#define DOWNLOAD_FAIL_ALLOCATION_FAILURE -11
-#define DOWNLOAD_FAIL_NO_DATA_AVAILABLE -10
-#define DOWNLOAD_FAIL_CREATING_FILE		-9
-#define DOWNLOAD_FAIL_NOT_200_OK		-8
-#define DOWNLOAD_FAIL_NO_RESPONSE		-7
-#define DOWNLOAD_FAIL_SEND_REQUEST		-6
-#define DOWNLOAD_FAIL_OPENING_REQUEST   -5
-#define DOWNLOAD_FAIL_CANT_CONNECT		-4
-#define DOWNLOAD_FAIL_NO_CONNECTION		-3
-#define DOWNLOAD_FAIL_BAD_URL			-2
-#define DOWNLOAD_FAIL_404				-1
-#define DOWNLOAD_SUCCESS				0
-#define DOWNLOAD_PROGRESS				1
-
-///
-/// <summary> 
-///		Downloads a file from a URL 
-///		returns file size on success, -1 on error.
-/// </summary>
-int DownloadFile(const wchar_t* URL, const wchar_t* destinationFilename) {
-	URL_COMPONENTS urlComponents;
-
-	wchar_t urlPath[BUFSIZE];
-	wchar_t urlHost[BUFSIZE];
-	void* pszOutBuffer;
-
-	HINTERNET  session = NULL;
-	HINTERNET  connection = NULL;
-	HINTERNET  request = NULL;
-	DWORD bytesDownloaded = 0;
-	DWORD bytesAvailable = 0;
-	DWORD bytesWritten = 0;
-	DWORD dwStatusCode = 0;
-	DWORD contentLength;
-	__int64 totalBytesDownloaded = 0;
-	DWORD tmpValue= 0;
-	HANDLE localFile = NULL;
-	int percentComplete =0;
-	
-	DebugPrintf(L"HTTP GET: [%s]",URL);
-
-	__try {
-		ZeroMemory(&urlComponents, sizeof(urlComponents));
-		urlComponents.dwStructSize = sizeof(urlComponents);
-
-		urlComponents.dwSchemeLength    = -1;
-		urlComponents.dwHostNameLength  = -1;
-		urlComponents.dwUrlPathLength   = -1;
-		urlComponents.dwExtraInfoLength = -1;
-
-		if(!WinHttpCrackUrl(URL, (DWORD)wcslen(URL), 0, &urlComponents)) {
-			totalBytesDownloaded = DOWNLOAD_FAIL_BAD_URL;
-			__leave;
-		}
-
-		wcsncpy_s( urlHost , BUFSIZE, URL+urlComponents.dwSchemeLength+3 ,urlComponents.dwHostNameLength );
-		wcsncpy_s( urlPath , BUFSIZE, URL+urlComponents.dwSchemeLength+urlComponents.dwHostNameLength+3, urlComponents.dwUrlPathLength );
-
-		// Use WinHttpOpen to obtain a session handle.
-		if(!(session = WinHttpOpen( L"CoAppBootstrapper/1.0",  WINHTTP_ACCESS_TYPE_DEFAULT_PROXY,WINHTTP_NO_PROXY_NAME, WINHTTP_NO_PROXY_BYPASS, 0))) {
-			totalBytesDownloaded = DOWNLOAD_FAIL_NO_CONNECTION;
-			__leave;
-		}
-
-		WinHttpSetTimeouts( session, 6000, 12000, 12000, 12000);
-
-		// Specify an HTTP server.
-		if (!(connection = WinHttpConnect( session, urlHost, urlComponents.nPort, 0))) {
-			totalBytesDownloaded = DOWNLOAD_FAIL_CANT_CONNECT;
-			__leave;
-		}
-
-		// Create an HTTP request handle.
-		if (!(request = WinHttpOpenRequest( connection, L"GET",urlPath , NULL, WINHTTP_NO_REFERER,  WINHTTP_DEFAULT_ACCEPT_TYPES, 0))) {
-			totalBytesDownloaded = DOWNLOAD_FAIL_OPENING_REQUEST;
-			__leave;
-		}
-
-		// Send a request.
-		if(!(WinHttpSendRequest( request, WINHTTP_NO_ADDITIONAL_HEADERS, 0, WINHTTP_NO_REQUEST_DATA, 0, 0, 0))) {
-			totalBytesDownloaded = DOWNLOAD_FAIL_SEND_REQUEST;
-			__leave;
-		}
- 
-		// End the request.
-		if(!(WinHttpReceiveResponse( request, NULL))) {
-			totalBytesDownloaded = DOWNLOAD_FAIL_NO_RESPONSE;
-			__leave;		
-		}
-
-		tmpValue = sizeof(DWORD);
-		WinHttpQueryHeaders( request, WINHTTP_QUERY_STATUS_CODE| WINHTTP_QUERY_FLAG_NUMBER, NULL, &dwStatusCode, &tmpValue, NULL );
-		if( dwStatusCode != HTTP_STATUS_OK ) {
-			totalBytesDownloaded = DOWNLOAD_FAIL_NOT_200_OK;
-			__leave;		
-		}
-
-		tmpValue = sizeof(DWORD);
-		WinHttpQueryHeaders( request, WINHTTP_QUERY_CONTENT_LENGTH | WINHTTP_QUERY_FLAG_NUMBER, NULL, &contentLength, &tmpValue , NULL);
-
-		if( INVALID_HANDLE_VALUE == (localFile = CreateFile(destinationFilename, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,  FILE_ATTRIBUTE_NORMAL,NULL))) {
-			totalBytesDownloaded = DOWNLOAD_FAIL_CREATING_FILE;
-			__leave;		
-		}
-
-		// Allocate space for the buffer.
-		pszOutBuffer = malloc(128*1024); // 128k buffer should be fine.
-		if (!pszOutBuffer)  {
-			totalBytesDownloaded = DOWNLOAD_FAIL_ALLOCATION_FAILURE;
-			__leave;
-		}
-	
-		// Keep checking for data until there is nothing left.
-		do  {
-			if( IsShuttingDown ) {
-				totalBytesDownloaded = DOWNLOAD_FAIL_CANCELLED;
-				__leave;
-			}
-
-			// Check for available data.
-			bytesAvailable = 0;
-
-			if (!WinHttpQueryDataAvailable( request, &bytesAvailable)) {
-				totalBytesDownloaded = DOWNLOAD_FAIL_NO_DATA_AVAILABLE;
-				__leave;
-			}
-			// No more available data.
-			if (!bytesAvailable)
-				break;
-
-			if (!WinHttpReadData( request, (LPVOID)pszOutBuffer, 128*1024, &bytesDownloaded))  {
-				totalBytesDownloaded = DOWNLOAD_FAIL_ALLOCATION_FAILURE;
-				__leave;
-			}
-		
-			WriteFile( localFile, pszOutBuffer, bytesDownloaded, &bytesWritten, NULL ); 
-			totalBytesDownloaded+=bytesDownloaded;
-
-			// we really don't support progress for this anymore.
-			// percentComplete = (int)(totalBytesDownloaded*100/contentLength );
-			// OnDownloadProgress( DOWNLOAD_PROGRESS , percentComplete);
-
-			// This condition should never be reached since WinHttpQueryDataAvailable
-			// reported that there are bits to read.
-			if (!bytesDownloaded)
-				break;
-				
-		} while (bytesAvailable > 0);
-	} __finally { 
-		if( pszOutBuffer ) 
-			free(pszOutBuffer); // Free the memory allocated to the buffer.
-			
-		// Close open handles.
-		if (localFile)
-			CloseHandle( localFile );
-		if (request) 
-			WinHttpCloseHandle(request);
-		if (connection) 
-			WinHttpCloseHandle(connection);
-		if (session) 
-			WinHttpCloseHandle(session);
-	}
-
-	return (int)totalBytesDownloaded; // bytes downloaded.
-}
-
-wchar_t* DownloadRelativeFile( const wchar_t* baseUrl, const wchar_t* filename) {
-	wchar_t* result = NULL;
-	wchar_t* url = NULL;
-
-	__try {
-		if( !IsNullOrEmpty(baseUrl)) {
-			result = TempFileName(filename);
-			url = UrlOrPathCombine( baseUrl , filename, '/' );
-			
-			if( DownloadFile( url, result) > 0 && FileExists(result) ) {
-				if(IsEmbeddedSignatureValid( result ) ) {
-					__leave;
-				}
-				DeleteFile( result );
-			}
-			DeleteString(&result);
-		}
-	} __finally {
-		DeleteString(&url);
-	}
-
-	return result;
-}
-
-wchar_t* GetExtension(const wchar_t* filename) {
-	int i;
-	
-	for(i=SafeStringLengthInCharacters(filename);i>=0;i--) {
-		if( filename[i] == '.' ) {
-			return DuplicateString(filename+i+1);
-		}
-	}
-
-	return NULL;
-}
-
-wchar_t* GetFilenameWithoutExtension(const wchar_t* filename) {
-	wchar_t* result;
-	int i;
-	
-	result = DuplicateString(filename);
-	for(i=SafeStringLengthInCharacters(result);i>=0;i--) {
-		if( result[i] == '.' ) {
-			result[i] =0;
-			break;
-		}
-	}
-	return result;
-}
-
-wchar_t* ExtractFileFromMSI( const wchar_t* msiFilename, const wchar_t* binaryFile ) {
-	MSIHANDLE packageDatabase= 0;
-	MSIHANDLE view = 0;
-	MSIHANDLE record = 0;
-	DWORD bufferSize = 0;
-	char* byteBuffer = NULL;
-	HANDLE localFile = NULL;
-	wchar_t* query = NULL;
-	DWORD bytesWritten = 0;
-
-	wchar_t* result = NULL;
-	
-	if( IsNullOrEmpty(msiFilename) ) {
-		return NULL;
-	}
-
-	__try { 
-		if( ERROR_SUCCESS != MsiOpenDatabase(msiFilename, MSIDBOPEN_READONLY, &packageDatabase) ) {
-			__leave;
-		}
-
-		query = Sprintf( L"SELECT `Data` FROM `Binary` where `Name`='%s'", binaryFile );
-
-		if (ERROR_SUCCESS != MsiDatabaseOpenView(packageDatabase, query, &view)) {
-			__leave;
-		}
-		if( ERROR_SUCCESS != MsiViewExecute(view, 0) ) {
-			__leave;
-		}
-		if( ERROR_SUCCESS != MsiViewFetch(view, &record) ) {
-			__leave;
-		}
-
-		bufferSize = MsiRecordDataSize(record, 1);
-		if( bufferSize > 1024*1024*1024 || bufferSize == 0 ) {  //bigger than 1Meg?
-			__leave;
-		}
-
-		byteBuffer = (char*)malloc(bufferSize);
-		
-		if( ERROR_SUCCESS != MsiRecordReadStream(record, 1, byteBuffer, &bufferSize) ) {
-			__leave;
-		}
-
-		// got the whole file
-		result = TempFileName(binaryFile);
-		if( INVALID_HANDLE_VALUE == (localFile = CreateFile(result, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,  FILE_ATTRIBUTE_NORMAL,NULL))) {
-			DeleteString(&result);
-			__leave;
-		}
-
-		// write out the file to the temp file.
-		WriteFile( localFile, byteBuffer, bufferSize, &bytesWritten, NULL ); 
-		CloseHandle( localFile );
-	} __finally { 
-		if ( record ) 
-			MsiCloseHandle(record);
-		if ( view ) 
-			MsiCloseHandle(view);
-		if ( packageDatabase ) 
-			MsiCloseHandle(packageDatabase);
-
-		DeleteString(&query);
-
-		if( byteBuffer ) {
-			free( (void*) byteBuffer );
-		}
-	}
-    return result;
-}
-
-// This gets a dependent resource, by finding it in one of the following locations
-//		same folder as the bootstrap.exe
-//		embedded (and unpacked from) the MSI
-//		http://coapp.org/resources/<filename>.<LCID>.<ext>
-//		http://coapp.org/resources/<filename>.<ext>
-wchar_t* AcquireFile( const wchar_t* filename, BOOL searchOnline, const wchar_t* additionalDownloadServer ) {
-	LCID lcid;
-	// wchar_t* folder = NULL;
-	wchar_t* extension= NULL;
-	wchar_t* result= NULL;
-	wchar_t* name= NULL;
-	wchar_t* localizedFilename  = NULL;
-	wchar_t* url = NULL;
-
-	if( IsNullOrEmpty(filename) ) {
-		return NULL;
-	}
-	__try {
-		// split the filename parts
-		lcid = GetUserDefaultLCID();
-		name = GetFilenameWithoutExtension(filename);
-		extension = GetExtension(filename);
-		localizedFilename = Sprintf(L"%s.%d.%s", name, lcid, extension);
-
-		//------------------------
-		// LOCALIZED FILE, ON BOX
-		//------------------------
-		
-		// is the localized file in the bootstrap folder?
-		result = UrlOrPathCombine( BootstrapFolder, localizedFilename, L'\\');
-		DebugPrintf(L"Trying %s", result );
-		if( FileExists( result ) && IsEmbeddedSignatureValid(result) ) {
-			__leave; // found it 
-		}
-		DeleteString(&result);
-
-		// is the localized file in the msi folder?
-		result = UrlOrPathCombine( MsiFolder, localizedFilename, L'\\');
-		DebugPrintf(L"Trying %s", result );
-		if( FileExists( result ) && IsEmbeddedSignatureValid(result) ) {
-			__leave; // found it 
-		}
-		DeleteString(&result);
-
-		// try the MSI for the localized file 
-		result = ExtractFileFromMSI( MsiFile, localizedFilename );
-		DebugPrintf(L"Trying %s::%s", MsiFile, localizedFilename );
-		if( FileExists( result ) && IsEmbeddedSignatureValid(result) ) {
-			__leave; // found it 
-		}
-		DeleteString(&result);
-
-		//------------------------
-		// NORMAL FILE, ON BOX
-		//------------------------
-
-		// is the standard file in the bootstrap folder?
-		result = UrlOrPathCombine( MsiFolder, filename, L'\\');
-		DebugPrintf(L"Trying %s", result );
-		if( FileExists( result ) && IsEmbeddedSignatureValid(result) ) {
-			__leave; // found it 
-		}
-		DeleteString(&result);
-
-		// is the standard file in the msi folder?
-		result = UrlOrPathCombine( BootstrapFolder, filename, L'\\');
-		DebugPrintf(L"Trying %s", result );
-		if( FileExists( result ) && IsEmbeddedSignatureValid(result) ) {
-			__leave; // found it 
-		}
-		DeleteString(&result);
-
-		// try the MSI for the regular file 
-		result = ExtractFileFromMSI( MsiFile, filename );
-		DebugPrintf(L"Trying %s::%s", MsiFile, filename );
-		if( FileExists( result ) && IsEmbeddedSignatureValid(result) ) {
-			__leave; // found it 
-		}
-		DeleteString(&result);
-
-		if( !searchOnline ) {
-			__leave; // aint gonna find it.
-		}
-
-		if( !IsNullOrEmpty(additionalDownloadServer) ) {
-			// try regular file off the bootstrap server
-			DebugPrintf(L"Trying %s::%s", additionalDownloadServer, filename );
-			result = DownloadRelativeFile( additionalDownloadServer, filename  );
-			
-			if( FileExists( result ) && IsEmbeddedSignatureValid(result) ) {
-				__leave; // found it 
-			}
-			DeleteString(&result);
-		}
-
-		//------------------------
-		// LOCALIZED FILE, REMOTE
-		//------------------------
-
-		// try localized file off the bootstrap server
-		DebugPrintf(L"Trying %s::%s", BootstrapServerUrl, localizedFilename );
-		result = DownloadRelativeFile( BootstrapServerUrl, localizedFilename);
-		if( FileExists( result ) && IsEmbeddedSignatureValid(result) ) {
-			__leave; // found it 
-		}
-		DeleteString(&result);
-
-		// try localized file off the coapp server
-		DebugPrintf(L"Trying %s::%s", CoAppServerUrl, localizedFilename );
-		result = DownloadRelativeFile( CoAppServerUrl, localizedFilename );
-		if( FileExists( result ) && IsEmbeddedSignatureValid(result) ) {
-			__leave; // found it 
-		}
-		DeleteString(&result);
-
-		//------------------------
-		// NORMAL FILE, REMOTE
-		//------------------------
-
-		// try regular file off the bootstrap server
-		DebugPrintf(L"Trying %s::%s", BootstrapServerUrl, filename );
-		result = DownloadRelativeFile( BootstrapServerUrl, filename  );
-		if( FileExists( result ) && IsEmbeddedSignatureValid(result) ) {
-			__leave; // found it 
-		}
-		DeleteString(&result);
-
-		// try regular file off the coapp server
-		DebugPrintf(L"Trying %s::%s", CoAppServerUrl, filename );
-		result = DownloadRelativeFile( CoAppServerUrl, filename);
-		if( FileExists( result ) && IsEmbeddedSignatureValid(result) ) {
-			__leave; // found it 
-		}
-		DeleteString(&result);
- 
-		// this file aint nowhere .. gonna return null
-	} __finally { 
-		DeleteString(&extension);
-		DeleteString(&name);
-		DeleteString(&url);
-		DeleteString(&localizedFilename);
-	}
-
-	return result;
-}
+//-----------------------------------------------------------------------
+// <copyright company="CoApp Project">
+//     Copyright (c) 2011 Garrett Serack . All rights reserved.
+// </copyright>
+// <license>
+//     The software is licensed under the Apache 2.0 License (the "License")
+//     You may not use the software except in compliance with the License. 
+// </license>
+//-----------------------------------------------------------------------
+
+#pragma once
+void SetProgressValue( int overallprogress );
+wchar_t* CacheLookup( const wchar_t* url );
+BOOL CacheGetValidators( const wchar_t* url, wchar_t* etag, wchar_t* lastModified );
+wchar_t* CacheRevalidate( const wchar_t* url );
+int SegmentedDownload( HINTERNET connection, const wchar_t* urlPath, const wchar_t* validator, HANDLE localFile, LONG size, volatile LONG* cancelled );
+wchar_t* CacheStore( const wchar_t* url, const wchar_t* etag, const wchar_t* lastModified, const wchar_t* filename, const wchar_t* hash );
+BOOL IsTrustedFile( const wchar_t* path, const wchar_t* artifactName, const wchar_t* knownHash );
+BOOL IsTrustedFileEx( const wchar_t* path, const wchar_t* artifactName, const wchar_t* knownHash, wchar_t* trustedHash );
+const ManifestArtifact* GetManifestArtifact( const wchar_t* publishedName );
+BOOL IsVariantAvailable( const wchar_t* filename, LCID lcid );
+const ArtifactManifest* GetArtifactManifest();
+wchar_t* ExtractFileFromMSI( const wchar_t* msiFilename, const wchar_t* binaryFile, wchar_t* sha256 );
+typedef struct NetworkRecording NetworkRecording;
+BOOL IsRecordingNetwork();
+BOOL IsReplayingNetwork();
+int ReplayDownloadAttempt( const wchar_t* url, const wchar_t* partFilename, const wchar_t* validatorFilename, struct DownloadInfo* info );
+wchar_t* RedirectNetworkUrl( const wchar_t* url );
+NetworkRecording* BeginNetworkRecording( const wchar_t* url );
+void RecordNetworkStatus( NetworkRecording* recording, DWORD status );
+void RecordNetworkValidators( NetworkRecording* recording, const wchar_t* etag, const wchar_t* lastModified, __int64 contentLength );
+void RecordNetworkArrival( NetworkRecording* recording, const void* data, DWORD length );
+void EndNetworkRecording( NetworkRecording* recording, int result );
+__int64 ExpectedCompletionMicroseconds( const wchar_t* server, __int64 size );
+void RecordMirrorOutcome( const wchar_t* server, int result, __int64 responseMicroseconds, __int64 microseconds );
+void SaveMirrorHealth();
+void SaveMisses();
+BOOL IsKnownMissing( const wchar_t* location, const wchar_t* name, const wchar_t* validator );
+void RecordMissing( const wchar_t* location, const wchar_t* name, const wchar_t* validator );
+wchar_t* LocalMissValidator( const wchar_t* path );
+wchar_t* RemoteMissValidator( const wchar_t* server, const wchar_t* neutralFilename );
+BOOL IsFileMissingFromMSI( const wchar_t* msiFilename, const wchar_t* binaryFile );
+
+
+ 
+///
+/// <summary> 
+///		creates a temporary name for a file 
+///		caller must free the memory for the string returned.
+///		returns NULL on error.
+/// </summary>
+wchar_t* UniqueTempFileName(const wchar_t* name,const wchar_t* extension) {
+	DWORD returnValue = 0;
+	wchar_t tempFolderPath[BUFSIZE];
+	wchar_t* filename = NULL;
+	wchar_t* result = NULL;
+
+	returnValue = GetTempPath(BUFSIZE,  tempFolderPath); 
+	
+	if (returnValue > BUFSIZE || (returnValue == 0)) {
+		free( filename );
+		return NULL;
+	}
+
+	filename = Sprintf(L"%s[%d].%s", name , GetTickCount(), extension );
+
+	result = UrlOrPathCombine(tempFolderPath, filename, L'\\' );
+	DeleteString( &filename );
+	return result;
+}
+
+wchar_t* TempFileName(const wchar_t* name) {
+	DWORD returnValue = 0;
+	wchar_t tempFolderPath[BUFSIZE];
+
+	returnValue = GetTempPath(BUFSIZE,  tempFolderPath); 
+	
+	if (returnValue > BUFSIZE || (returnValue == 0)) {
+		return NULL;
+	}
+
+	return UrlOrPathCombine(tempFolderPath, name, L'\\' );
+}
+
+
+
+BOOL FileExists(const wchar_t* filePath) {
+    WIN32_FILE_ATTRIBUTE_DATA fileData;
+
+    if( IsNullOrEmpty(filePath) ) {
+        return 0;
+	}
+
+    return GetFileAttributesEx( filePath, GetFileExInfoStandard, &fileData);
+}
+
+// hFile, if it isn't NULL, is the file already open (for reading); that's what gets checked.
+BOOL IsEmbeddedSignatureValid(LPCWSTR pwszSourceFile, HANDLE hFile)
+{
+    LONG lStatus;
+    DWORD dwLastError;
+
+    // Initialize the WINTRUST_FILE_INFO structure.
+
+    WINTRUST_FILE_INFO FileData;
+    GUID WVTPolicyGUID = WINTRUST_ACTION_GENERIC_VERIFY_V2;
+    WINTRUST_DATA WinTrustData;
+
+	if( !FileExists(pwszSourceFile) )
+		return FALSE;
+
+#ifdef _DEBUG
+	return TRUE;
+#endif
+
+    memset(&FileData, 0, sizeof(FileData));
+    FileData.cbStruct = sizeof(WINTRUST_FILE_INFO);
+    FileData.pcwszFilePath = pwszSourceFile;
+    FileData.hFile = hFile;
+    FileData.pgKnownSubject = NULL;
+
+    /*
+    WVTPolicyGUID specifies the policy to apply on the file
+    WINTRUST_ACTION_GENERIC_VERIFY_V2 policy checks:
+    
+    1) The certificate used to sign the file chains up to a root 
+    certificate located in the trusted root certificate store. This 
+    implies that the identity of the publisher has been verified by 
+    a certification authority.
+    
+    2) In cases where user interface is displayed (which this example
+    does not do), WinVerifyTrust will check for whether the  
+    end entity certificate is stored in the trusted publisher store,  
+    implying that the user trusts content from this publisher.
+    
+    3) The end entity certificate has sufficient permission to sign 
+    code, as indicated by the presence of a code signing EKU or no 
+    EKU.
+    */
+
+
+    // Initialize the WinVerifyTrust input data structure.
+
+    // Default all fields to 0.
+	ZeroMemory(&WinTrustData, sizeof(WinTrustData));
+    WinTrustData.cbStruct = sizeof(WinTrustData);
+    
+    // Use default code signing EKU.
+    WinTrustData.pPolicyCallbackData = NULL;
+
+    // No data to pass to SIP.
+    WinTrustData.pSIPClientData = NULL;
+
+    // Disable WVT UI.
+    WinTrustData.dwUIChoice = WTD_UI_NONE;
+
+    // No revocation checking.
+    WinTrustData.fdwRevocationChecks = WTD_REVOKE_NONE; 
+
+    // Verify an embedded signature on a file.
+    WinTrustData.dwUnionChoice = WTD_CHOICE_FILE;
+
+    // Default verification.
+    WinTrustData.dwStateAction = 0;
+
+    // Not applicable for default verification of embedded signature.
+    WinTrustData.hWVTStateData = NULL;
+
+    // Not used.
+    WinTrustData.pwszURLReference = NULL;
+
+    // Default.
+    WinTrustData.dwProvFlags = WTD_SAFER_FLAG;
+
+    // This is not applicable if there is no UI because it changes 
+    // the UI to accommodate running applications instead of 
+    // installing applications.
+    WinTrustData.dwUIContext = 0;
+
+    // Set pFile.
+    WinTrustData.pFile = &FileData;
+
+    // WinVerifyTrust verifies signatures as specified by the GUID 
+    // and Wintrust_Data.
+    lStatus = WinVerifyTrust( NULL, &WVTPolicyGUID, &WinTrustData);
+
+    switch (lStatus) {
+        case ERROR_SUCCESS:
+            /*
+            Signed file:
+                - Hash that represents the subject is trusted.
+
+                - Trusted publisher without any verification errors.
+
+                - UI was disabled in dwUIChoice. No publisher or 
+                    time stamp chain errors.
+
+                - UI was enabled in dwUIChoice and the user clicked 
+                    "Yes" when asked to install and run the signed 
+                    subject.
+            */
+            // wprintf_s(L"The file \"%s\" is signed and the signature was verified.\n", pwszSourceFile);
+			return TRUE;
+            break;
+        
+        case TRUST_E_NOSIGNATURE:
+            // The file was not signed or had a signature 
+            // that was not valid.
+
+            // Get the reason for no signature.
+            dwLastError = GetLastError();
+            if (TRUST_E_NOSIGNATURE == dwLastError || TRUST_E_SUBJECT_FORM_UNKNOWN == dwLastError || TRUST_E_PROVIDER_UNKNOWN == dwLastError) {
+                // The file was not signed.
+                // wprintf_s(L"The file \"%s\" is not signed.\n pwszSourceFile);
+            }  else {
+                // The signature was not valid or there was an error 
+                // opening the file.
+               //  wprintf_s(L"An unknown error occurred trying to  verify the signature of the \"%s\" file.\n", pwszSourceFile);
+            }
+
+            break;
+
+        case TRUST_E_EXPLICIT_DISTRUST:
+            // The hash that represents the subject or the publisher 
+            // is not allowed by the admin or user.
+            // wprintf_s(L"The signature is present, but specifically disallowed.\n");
+            break;
+
+        case TRUST_E_SUBJECT_NOT_TRUSTED:
+            // The user clicked "No" when asked to install and run.
+            // wprintf_s(L"The signature is present, but not trusted.\n");
+            break;
+
+        case CRYPT_E_SECURITY_SETTINGS:
+            /*
+            The hash that represents the subject or the publisher 
+            was not explicitly trusted by the admin and the 
+            admin policy has disabled user trust. No signature, 
+            publisher or time stamp errors.
+            */
+            // wprintf_s(L"CRYPT_E_SECURITY_SETTINGS - The hash representing the subject or the publisher wasn't explicitly trusted by the admin and admin policy has disabled user trust. No signature, publisher or timestamp errors.\n");
+            break;
+
+        default:
+            // The UI was disabled in dwUIChoice or the admin policy 
+            // has disabled user trust. lStatus contains the 
+            // publisher or time stamp chain error.
+            // wprintf_s(L"Error is: 0x%x.\n", lStatus);
+            break;
+    }
+    return FALSE;
+}
+
+#define DOWNLOAD_FAIL_RANGE_REJECTED	 -15	// the server wouldn't pick up where the partial file left off
+#define DOWNLOAD_FAIL_WRONG_SIZE		 -14
+#define DOWNLOAD_FAIL_INCOMPLETE		 -13
+#define DOWNLOAD_FAIL_CANCELLED			 -12
+#define DOWNLOAD_FAIL_ALLOCATION_FAILURE -11
+#define DOWNLOAD_FAIL_NO_DATA_AVAILABLE -10
+#define DOWNLOAD_FAIL_CREATING_FILE		-9
+#define DOWNLOAD_FAIL_NOT_200_OK		-8
+#define DOWNLOAD_FAIL_NO_RESPONSE		-7
+#define DOWNLOAD_FAIL_SEND_REQUEST		-6
+#define DOWNLOAD_FAIL_OPENING_REQUEST   -5
+#define DOWNLOAD_FAIL_CANT_CONNECT		-4
+#define DOWNLOAD_FAIL_NO_CONNECTION		-3
+#define DOWNLOAD_FAIL_BAD_URL			-2
+#define DOWNLOAD_FAIL_404				-1
+#define DOWNLOAD_SUCCESS				0
+#define DOWNLOAD_PROGRESS				1
+
+#define DOWNLOAD_ATTEMPTS				4
+#define SEGMENTED_MINIMUM_SIZE			(4*1024*1024)	// files this big are fetched over several connections, if the server allows it.
+#define SEGMENTED_MAXIMUM_SIZE			MAXLONG			// ...but no bigger: segment offsets (and what SegmentedDownload returns) are 32-bit.
+#define MAX_VALIDATOR_LENGTH			256
+
+// extra inputs and outputs for DownloadFileEx
+typedef struct DownloadInfo {
+	volatile LONG* cancelled;						// in: the download is abandoned if this becomes non-zero (may be NULL)
+	__int64 expectedSize;							// in: how big the file should be, if we know (0 if we don't)
+	wchar_t ifNoneMatch[MAX_VALIDATOR_LENGTH];		// in: ETag of a copy we already have, if any
+	wchar_t ifModifiedSince[MAX_VALIDATOR_LENGTH];	// in: Last-Modified of a copy we already have, if any
+	wchar_t etag[MAX_VALIDATOR_LENGTH];				// out: the ETag the server sent, if any
+	wchar_t lastModified[MAX_VALIDATOR_LENGTH];		// out: the Last-Modified the server sent, if any
+	BOOL notModified;								// out: the server says the copy we have is current (nothing was downloaded)
+	__int64 responseMicroseconds;					// out: how long the server took to answer (0 if it didn't)
+	wchar_t sha256[SHA256_STRING_LENGTH+1];			// out: hash of the whole file, worked out as it came in (empty if that wasn't possible)
+} DownloadInfo;
+
+// reads the validator saved alongside a partial download; returns FALSE if there isn't one.
+BOOL ReadPartialValidator( const wchar_t* validatorFilename, wchar_t* validator ) {
+	HANDLE file;
+	DWORD bytesRead = 0;
+
+	*validator = 0;
+	if( INVALID_HANDLE_VALUE == (file = CreateFile(validatorFilename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL)) ) {
+		return FALSE;
+	}
+	ReadFile(file, validator, (MAX_VALIDATOR_LENGTH-1)*sizeof(wchar_t), &bytesRead, NULL);
+	validator[bytesRead/sizeof(wchar_t)] = 0;
+	CloseHandle(file);
+	return !IsNullOrEmpty(validator);
+}
+
+void WritePartialValidator( const wchar_t* validatorFilename, const wchar_t* validator ) {
+	HANDLE file;
+	DWORD bytesWritten;
+
+	if( IsNullOrEmpty(validator) ) {
+		DeleteFile(validatorFilename);
+		return;
+	}
+	if( INVALID_HANDLE_VALUE != (file = CreateFile(validatorFilename, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL)) ) {
+		WriteFile(file, validator, (DWORD)(wcslen(validator)*sizeof(wchar_t)), &bytesWritten, NULL);
+		CloseHandle(file);
+	}
+}
+
+__int64 GetFileSizeByName( const wchar_t* filename ) {
+	WIN32_FILE_ATTRIBUTE_DATA fileData;
+
+	if( !GetFileAttributesEx(filename, GetFileExInfoStandard, &fileData) ) {
+		return -1;
+	}
+	return ((__int64)fileData.nFileSizeHigh << 32) | fileData.nFileSizeLow;
+}
+
+///
+/// <summary> 
+///		makes one request for a URL, appending to (or starting over) the partial file.
+///		returns the size of the partial file when the transfer is complete, or a DOWNLOAD_FAIL_ code. 
+/// </summary>
+int DownloadAttempt(const wchar_t* URL, const wchar_t* partFilename, const wchar_t* validatorFilename, DownloadInfo* info) {
+	URL_COMPONENTS urlComponents;
+
+	wchar_t urlPath[BUFSIZE];
+	wchar_t urlHost[BUFSIZE];
+	wchar_t partValidator[MAX_VALIDATOR_LENGTH];
+	wchar_t contentRange[MAX_VALIDATOR_LENGTH];
+	wchar_t acceptRanges[MAX_VALIDATOR_LENGTH];
+	wchar_t etag[MAX_VALIDATOR_LENGTH];
+	wchar_t lastModified[MAX_VALIDATOR_LENGTH];
+	const wchar_t* validator;
+	const wchar_t* target;
+	wchar_t* redirected = NULL;
+	wchar_t* headers = NULL;
+	WritePipeline pipeline;
+	PipelineBuffer* buffer;
+	DWORD fillStarted;
+	HashContext hash;
+	BOOL hashing = FALSE;
+
+	HINTERNET  connection = NULL;
+	BOOL pooled = FALSE;
+	HINTERNET  request = NULL;
+	DWORD bytesDownloaded = 0;
+	DWORD dwStatusCode = 0;
+	DWORD contentLength = 0;
+	__int64 resumeFrom = 0;
+	__int64 expectedSize = -1;
+	__int64 rangeStart, rangeEnd;
+	__int64 totalBytesDownloaded = 0;
+	DWORD tmpValue= 0;
+	HANDLE localFile = INVALID_HANDLE_VALUE;
+	LARGE_INTEGER position;
+	LARGE_INTEGER attemptStarted;
+	LARGE_INTEGER responded;
+	int percentComplete =0;
+	NetworkRecording* recording = NULL;
+	
+	if( IsReplayingNetwork() ) {
+		return ReplayDownloadAttempt(URL, partFilename, validatorFilename, info);
+	}
+
+	ZeroMemory(&pipeline, sizeof(pipeline));
+	ZeroMemory(&hash, sizeof(hash));
+
+	__try {
+		recording = BeginNetworkRecording(URL);
+
+		// everything goes to the replay server instead, if there is one (see coapp_replay.h).
+		target = (redirected = RedirectNetworkUrl(URL)) ? redirected : URL;
+
+		ZeroMemory(&urlComponents, sizeof(urlComponents));
+		urlComponents.dwStructSize = sizeof(urlComponents);
+
+		urlComponents.dwSchemeLength    = -1;
+		urlComponents.dwHostNameLength  = -1;
+		urlComponents.dwUrlPathLength   = -1;
+		urlComponents.dwExtraInfoLength = -1;
+
+		if(!WinHttpCrackUrl(target, (DWORD)wcslen(target), 0, &urlComponents)) {
+			totalBytesDownloaded = DOWNLOAD_FAIL_BAD_URL;
+			__leave;
+		}
+
+		wcsncpy_s( urlHost , BUFSIZE, urlComponents.lpszHostName ,urlComponents.dwHostNameLength );
+		wcsncpy_s( urlPath , BUFSIZE, urlComponents.lpszUrlPath, urlComponents.dwUrlPathLength );
+
+		// if we've got part of it from last time, only ask for the rest -- as long as it hasn't changed since.
+		if( ReadPartialValidator(validatorFilename, partValidator) && (resumeFrom = GetFileSizeByName(partFilename)) > 0 ) {
+			headers = Sprintf(L"Range: bytes=%I64d-\r\nIf-Range: %s\r\n", resumeFrom, partValidator);
+		} else {
+			resumeFrom = 0;
+			if( info && !IsNullOrEmpty(info->ifNoneMatch) ) {
+				headers = Sprintf(L"If-None-Match: %s\r\n", info->ifNoneMatch);
+			} else if( info && !IsNullOrEmpty(info->ifModifiedSince) ) {
+				headers = Sprintf(L"If-Modified-Since: %s\r\n", info->ifModifiedSince);
+			}
+		}
+
+		QueryPerformanceCounter(&attemptStarted);
+
+		// the session and the connection are shared with every other request (see coapp_http.h).
+		if( !GetHttpSession() ) {
+			totalBytesDownloaded = DOWNLOAD_FAIL_NO_CONNECTION;
+			__leave;
+		}
+
+		// Specify an HTTP server.
+		if (!(connection = GetHttpConnection( urlHost, urlComponents.nPort, &pooled))) {
+			totalBytesDownloaded = DOWNLOAD_FAIL_CANT_CONNECT;
+			__leave;
+		}
+
+		// Create an HTTP request handle.
+		if (!(request = WinHttpOpenRequest( connection, L"GET",urlPath , NULL, WINHTTP_NO_REFERER,  WINHTTP_DEFAULT_ACCEPT_TYPES, 0))) {
+			totalBytesDownloaded = DOWNLOAD_FAIL_OPENING_REQUEST;
+			__leave;
+		}
+
+		// Send a request.
+		if(!(WinHttpSendRequest( request, headers ? headers : WINHTTP_NO_ADDITIONAL_HEADERS, headers ? (DWORD)-1L : 0, WINHTTP_NO_REQUEST_DATA, 0, 0, 0))) {
+			totalBytesDownloaded = DOWNLOAD_FAIL_SEND_REQUEST;
+			__leave;
+		}
+ 
+		// End the request.
+		if(!(WinHttpReceiveResponse( request, NULL))) {
+			totalBytesDownloaded = DOWNLOAD_FAIL_NO_RESPONSE;
+			__leave;		
+		}
+		CountHttpResponse(request);
+		if( info ) {
+			QueryPerformanceCounter(&responded);
+			info->responseMicroseconds = ElapsedMicroseconds(&attemptStarted, &responded);
+		}
+
+		tmpValue = sizeof(DWORD);
+		WinHttpQueryHeaders( request, WINHTTP_QUERY_STATUS_CODE| WINHTTP_QUERY_FLAG_NUMBER, NULL, &dwStatusCode, &tmpValue, NULL );
+		RecordNetworkStatus(recording, dwStatusCode);
+
+		if( dwStatusCode == HTTP_STATUS_NOT_MODIFIED && resumeFrom == 0 && info ) {
+			// the copy we've got is still good.
+			info->notModified = TRUE;
+			totalBytesDownloaded = DOWNLOAD_SUCCESS;
+			__leave;
+		}
+
+		if( dwStatusCode == HTTP_STATUS_PARTIAL_CONTENT && resumeFrom > 0 ) {
+			// make sure it's picking up where we left off.
+			tmpValue = sizeof(contentRange);
+			if( !WinHttpQueryHeaders( request, WINHTTP_QUERY_CONTENT_RANGE, WINHTTP_HEADER_NAME_BY_INDEX, contentRange, &tmpValue, WINHTTP_NO_HEADER_INDEX) ||
+				swscanf_s(contentRange, L"bytes %I64d-%I64d/%I64d", &rangeStart, &rangeEnd, &expectedSize) != 3 || rangeStart != resumeFrom ) {
+				// start over.
+				DeleteFile(partFilename);
+				DeleteFile(validatorFilename);
+				totalBytesDownloaded = DOWNLOAD_FAIL_RANGE_REJECTED;
+				__leave;
+			}
+			TraceInfo(L"Resuming [%s] at %I64d of %I64d",URL, resumeFrom, expectedSize);
+		} else if( dwStatusCode == HTTP_STATUS_OK ) {
+			// the whole thing (either we didn't ask for a range, or it changed since we got the first part).
+			resumeFrom = 0;
+			tmpValue = sizeof(DWORD);
+			if( WinHttpQueryHeaders( request, WINHTTP_QUERY_CONTENT_LENGTH | WINHTTP_QUERY_FLAG_NUMBER, NULL, &contentLength, &tmpValue , NULL) ) {
+				expectedSize = contentLength;
+			}
+		} else {
+			if( resumeFrom > 0 ) {
+				// the part we've got is no use with this server (a 416, say). it goes, or this run
+				// and every one after it (the temp file is named after the url) would ask the same.
+				DeleteFile(partFilename);
+				DeleteFile(validatorFilename);
+			}
+			// it's not there (as opposed to the server having trouble handing it over).
+			totalBytesDownloaded = (dwStatusCode == HTTP_STATUS_NOT_FOUND || dwStatusCode == HTTP_STATUS_GONE) ? DOWNLOAD_FAIL_404 : 
+				resumeFrom > 0 ? DOWNLOAD_FAIL_RANGE_REJECTED : DOWNLOAD_FAIL_NOT_200_OK;
+			__leave;		
+		}
+
+		if( info && info->expectedSize > 0 && expectedSize >= 0 && expectedSize != info->expectedSize ) {
+			// not what we're looking for; don't bother fetching it.
+			TraceError(L"[%s] is %I64d bytes, expected %I64d",URL, expectedSize, info->expectedSize);
+			totalBytesDownloaded = DOWNLOAD_FAIL_WRONG_SIZE;
+			__leave;
+		}
+
+		// keep the validators, so that the cache can tell if this changes.
+		tmpValue = sizeof(etag);
+		if( !WinHttpQueryHeaders( request, WINHTTP_QUERY_ETAG, WINHTTP_HEADER_NAME_BY_INDEX, etag, &tmpValue, WINHTTP_NO_HEADER_INDEX) ) {
+			*etag = 0;
+		}
+		tmpValue = sizeof(lastModified);
+		if( !WinHttpQueryHeaders( request, WINHTTP_QUERY_LAST_MODIFIED, WINHTTP_HEADER_NAME_BY_INDEX, lastModified, &tmpValue, WINHTTP_NO_HEADER_INDEX) ) {
+			*lastModified = 0;
+		}
+		RecordNetworkValidators(recording, etag, lastModified, expectedSize);
+		if( info ) {
+			wcscpy_s(info->etag, MAX_VALIDATOR_LENGTH, etag);
+			wcscpy_s(info->lastModified, MAX_VALIDATOR_LENGTH, lastModified);
+		}
+
+		// a weak ETag can't be used with If-Range
+		validator = !IsNullOrEmpty(etag) && wcsncmp(etag, L"W/", 2) ? etag : lastModified;
+
+		if( resumeFrom > 0 ) {
+			// pick the hash up from the part we already have (before we lock the file for writing).
+			if( info && (hashing = BeginHash(&hash)) && !(hashing = UpdateHashFromFile(&hash, partFilename, resumeFrom)) ) {
+				AbandonHash(&hash);
+			}
+
+			if( INVALID_HANDLE_VALUE == (localFile = CreateFile(partFilename, GENERIC_WRITE, 0, NULL, OPEN_EXISTING,  FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED,NULL))) {
+				totalBytesDownloaded = DOWNLOAD_FAIL_CREATING_FILE;
+				__leave;		
+			}
+			position.QuadPart = resumeFrom;
+			SetFilePointerEx(localFile, position, NULL, FILE_BEGIN);
+			SetEndOfFile(localFile);
+		} else {
+			if( INVALID_HANDLE_VALUE == (localFile = CreateFile(partFilename, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,  FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED,NULL))) {
+				totalBytesDownloaded = DOWNLOAD_FAIL_CREATING_FILE;
+				__leave;		
+			}
+
+			// remember what version this is, so we can pick it up again if we get cut off.
+			WritePartialValidator(validatorFilename, validator);
+
+			// big enough to be worth splitting up, and the server lets us? (not while recording: it all has to come through here.)
+			tmpValue = sizeof(acceptRanges);
+			if( expectedSize >= SEGMENTED_MINIMUM_SIZE && expectedSize <= SEGMENTED_MAXIMUM_SIZE && !IsNullOrEmpty(validator) && !IsRecordingNetwork() &&
+				WinHttpQueryHeaders( request, WINHTTP_QUERY_ACCEPT_RANGES, WINHTTP_HEADER_NAME_BY_INDEX, acceptRanges, &tmpValue, WINHTTP_NO_HEADER_INDEX) && 
+				lstrcmpi(acceptRanges, L"bytes") == 0 ) {
+
+				// the pieces come in out of order, so there's no hashing them on the way.
+				WinHttpCloseHandle(request);
+				request = NULL;
+				totalBytesDownloaded = SegmentedDownload(connection, urlPath, validator, localFile, (LONG)expectedSize, info ? info->cancelled : NULL);
+				if( totalBytesDownloaded < 0 ) {
+					// the partial file has holes in it, so it can't be resumed.
+					DeleteFile(validatorFilename);
+				}
+				__leave;
+			}
+		}
+		totalBytesDownloaded = resumeFrom;
+		if( info && resumeFrom == 0 ) {
+			hashing = BeginHash(&hash);
+		}
+
+		OpenWritePipeline(&pipeline, localFile, resumeFrom, expectedSize >= 0 ? expectedSize - resumeFrom : -1);
+	
+		// Keep reading until there is nothing left; each buffer is written out
+		// in the background while the next one is being filled.
+		do  {
+			if( !(buffer = NextPipelineBuffer(&pipeline)) ) {
+				totalBytesDownloaded = pipeline.failed ? DOWNLOAD_FAIL_CREATING_FILE : DOWNLOAD_FAIL_ALLOCATION_FAILURE;
+				__leave;
+			}
+
+			fillStarted = GetTickCount();
+			do {
+				if( IsShuttingDown || (info && info->cancelled && *info->cancelled) ) {
+					totalBytesDownloaded = DOWNLOAD_FAIL_CANCELLED;
+					__leave;
+				}
+
+				if (!WinHttpReadData( request, (LPVOID)(buffer->data + buffer->length), pipeline.readSize - buffer->length, &bytesDownloaded))  {
+					totalBytesDownloaded = DOWNLOAD_FAIL_NO_DATA_AVAILABLE;
+					__leave;
+				}
+				RecordNetworkArrival(recording, buffer->data + buffer->length, bytesDownloaded);
+				buffer->length += bytesDownloaded;
+			} while( bytesDownloaded && buffer->length < pipeline.readSize );
+
+			// no length up front (or the server lied about it)? stop as soon as it's too big.
+			if( info && info->expectedSize > 0 && totalBytesDownloaded + buffer->length > info->expectedSize ) {
+				TraceError(L"[%s] is bigger than the expected %I64d bytes",URL, info->expectedSize);
+				totalBytesDownloaded = DOWNLOAD_FAIL_WRONG_SIZE;
+				__leave;
+			}
+
+			if( hashing && !UpdateHash(&hash, buffer->data, buffer->length) ) {
+				AbandonHash(&hash);
+				hashing = FALSE;
+			}
+
+			if( !QueuePipelineWrite(&pipeline, buffer, GetTickCount() - fillStarted) ) {
+				totalBytesDownloaded = DOWNLOAD_FAIL_CREATING_FILE;
+				__leave;
+			}
+			totalBytesDownloaded += buffer->length;
+
+			// we really don't support progress for this anymore.
+			// percentComplete = (int)(totalBytesDownloaded*100/contentLength );
+			// OnDownloadProgress( DOWNLOAD_PROGRESS , percentComplete);
+
+		} while (bytesDownloaded > 0);
+
+		if( !FlushWritePipeline(&pipeline) ) {
+			totalBytesDownloaded = DOWNLOAD_FAIL_CREATING_FILE;
+			__leave;
+		}
+
+		if( expectedSize >= 0 && totalBytesDownloaded != expectedSize ) {
+			// got cut off; what we have is still good for next time.
+			TraceError(L"Incomplete [%s]: %I64d of %I64d",URL, totalBytesDownloaded, expectedSize);
+			totalBytesDownloaded = DOWNLOAD_FAIL_INCOMPLETE;
+			__leave;
+		}
+
+		if( hashing ) {
+			FinishHash(&hash, info->sha256);
+		}
+	} __finally { 
+		AbandonHash(&hash);
+
+		// waits for any writes still in flight.
+		CloseWritePipeline(&pipeline);
+			
+		// Close open handles.
+		if (localFile != INVALID_HANDLE_VALUE)
+			CloseHandle( localFile );
+		if (request) 
+			WinHttpCloseHandle(request);
+		if (connection && !pooled) 
+			WinHttpCloseHandle(connection);
+
+		DeleteString(&headers);
+		DeleteString(&redirected);
+		EndNetworkRecording(recording, (int)totalBytesDownloaded);
+	}
+
+	return (int)totalBytesDownloaded; // bytes downloaded.
+}
+
+///
+/// <summary> 
+///		Downloads a file from a URL 
+///		the data goes to <destinationFilename>.part first, and an interrupted transfer is 
+///		picked up again with a Range request (in this run, or the next one)
+///		info is optional (see DownloadInfo)
+///		returns file size on success, -1 on error.
+/// </summary>
+int DownloadFileEx(const wchar_t* URL, const wchar_t* destinationFilename, DownloadInfo* info) {
+	wchar_t* partFilename = NULL;
+	wchar_t* validatorFilename = NULL;
+	__int64 partSize;
+	BOOL restarted = FALSE;
+	int attempt;
+	int result = DOWNLOAD_FAIL_CREATING_FILE;
+	LARGE_INTEGER started;
+	
+	TraceVerbose(L"HTTP GET: [%s]",URL);
+	QueryPerformanceCounter(&started);
+
+	if( info ) {
+		info->notModified = FALSE;
+		info->responseMicroseconds = 0;
+		*info->sha256 = 0;
+	}
+
+	__try {
+		if( !(partFilename = Sprintf(L"%s.part", destinationFilename)) || !(validatorFilename = Sprintf(L"%s.part.validator", destinationFilename)) ) {
+			result = DOWNLOAD_FAIL_ALLOCATION_FAILURE;
+			__leave;
+		}
+
+		for( attempt = 0; attempt < DOWNLOAD_ATTEMPTS; attempt++ ) {
+			partSize = GetFileSizeByName(partFilename);
+			result = DownloadAttempt(URL, partFilename, validatorFilename, info);
+
+			if( result >= 0 || result == DOWNLOAD_FAIL_CANCELLED ) {
+				break;
+			}
+
+			if( result == DOWNLOAD_FAIL_RANGE_REJECTED && !restarted ) {
+				// the partial file is gone now; one more go, from the top (whatever attempt this was).
+				restarted = TRUE;
+				attempt--;
+				continue;
+			}
+
+			if( result == DOWNLOAD_FAIL_WRONG_SIZE ) {
+				// nothing here is worth keeping for next time.
+				DeleteFile(partFilename);
+				DeleteFile(validatorFilename);
+				break;
+			}
+
+			// only worth trying again if the link dropped partway through.
+			if( GetFileSizeByName(partFilename) <= partSize || !FileExists(validatorFilename) ) {
+				break;
+			}
+		}
+
+		if( result > 0 || (result == 0 && !(info && info->notModified)) ) {
+			if( !MoveFileEx(partFilename, destinationFilename, MOVEFILE_REPLACE_EXISTING) ) {
+				result = DOWNLOAD_FAIL_CREATING_FILE;
+			}
+			DeleteFile(validatorFilename);
+		}
+	} __finally {
+		DeleteString(&validatorFilename);
+		DeleteString(&partFilename);
+	}
+
+	EndPhase(PHASE_DOWNLOAD, &started, result > 0 ? result : 0);
+	return result;
+}
+
+int DownloadFile(const wchar_t* URL, const wchar_t* destinationFilename) {
+	return DownloadFileEx(URL, destinationFilename, NULL);
+}
+
+wchar_t* DownloadRelativeFile( const wchar_t* baseUrl, const wchar_t* filename) {
+	wchar_t* result = NULL;
+	wchar_t* url = NULL;
+	const ManifestArtifact* artifact;
+	DownloadInfo info;
+
+	__try {
+		if( !IsNullOrEmpty(baseUrl)) {
+			result = TempFileName(filename);
+			url = UrlOrPathCombine( baseUrl , filename, '/' );
+			ZeroMemory(&info, sizeof(info));
+			if( (artifact = GetManifestArtifact(filename)) ) {
+				info.expectedSize = artifact->size;
+			}
+			
+			if( DownloadFileEx( url, result, &info) > 0 ) {
+				if( IsTrustedFile( result, filename, info.sha256 ) ) {
+					__leave;
+				}
+				DeleteFile( result );
+			}
+			DeleteString(&result);
+		}
+	} __finally {
+		DeleteString(&url);
+	}
+
+	return result;
+}
+
+
+#define MAX_RACE_FILES			(MAX_REMOTE_CANDIDATES*4)
+#define RACE_HEDGE_MILLISECONDS	2000	// once a candidate is in, how much longer the ones ahead of it get
+
+#define CANDIDATE_RUNNING		0
+#define CANDIDATE_SUCCEEDED		1
+#define CANDIDATE_FAILED		2
+#define CANDIDATE_ABANDONED		3
+
+
+struct DownloadRace;
+
+typedef struct RaceEntry {
+	struct DownloadRace* race;
+	int candidate;
+	wchar_t* filename;
+	wchar_t* server;
+	wchar_t* url;
+	wchar_t* tempFilename;
+	wchar_t* missValidator;
+	wchar_t* cachedFilename;	// the cached copy, when the server says it's still current
+	DownloadInfo info;
+	volatile LONG state;
+} RaceEntry;
+
+// shared between AcquireFile and the download threads. 
+// the losers can outlive the resolver, so it's reference counted and the last one out frees it.
+typedef struct DownloadRace {
+	volatile LONG references;
+	volatile LONG cancelled;
+	HANDLE changed;
+	int count;
+	RaceEntry entries[MAX_REMOTE_CANDIDATES];
+} DownloadRace;
+
+BOOL IsAlreadyRacing(DownloadRace* race, const wchar_t* url) {
+	int i;
+
+	for( i=0; i< race->count; i++ ) {
+		if( race->entries[i].url && lstrcmpi(race->entries[i].url, url) == 0 ) {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+// the temp files race threads are writing to. the losers keep going until they notice they've
+// been called off, so another race for the same file (the GUI and the worker thread both go
+// looking for the resources dll) mustn't pick the same names while they're at it.
+CRITICAL_SECTION RaceFilesLock;
+wchar_t* RaceFiles[MAX_RACE_FILES];
+
+// where they go: when we're elevated, the Downloads folder in the bootstrap data folder, which
+// only administrators can write to. what's checked as it comes in there can't be changed before 
+// it's used, so the cache can take it as it is (see CacheStore). NULL for %TEMP%.
+wchar_t* RaceFolder = NULL;
+BOOL RaceFolderChecked = FALSE;
+
+void InitializeDownloadRaces() {
+	InitializeCriticalSection(&RaceFilesLock);
+}
+
+///
+/// <summary>
+///		picks the temp file a race entry downloads into (in RaceFolder, or %TEMP%): 
+///		<filename>.<hash of the url>.download, so an
+///		interrupted download is picked up again (in this run or the next) -- unless another race is
+///		still using that one, in which case a numbered one. returns the name (malloc'd; give it back
+///		with ReleaseRaceFile), or NULL.
+/// </summary>
+wchar_t* ClaimRaceFile( const wchar_t* filename, const wchar_t* url ) {
+	DWORD hash = 2166136261U;
+	wchar_t* result = NULL;
+	wchar_t* name;
+	wchar_t* folder;
+	int slot;
+	int attempt;
+	int i;
+
+	// FNV-1a
+	for( ; *url; url++ ) {
+		hash = (hash ^ towlower(*url)) * 16777619U;
+	}
+
+	EnterCriticalSection(&RaceFilesLock);
+	__try {
+		for( slot = 0; slot < MAX_RACE_FILES && RaceFiles[slot]; slot++ ) {
+		}
+		if( slot == MAX_RACE_FILES ) {
+			__leave;
+		}
+
+		if( !RaceFolderChecked ) {
+			RaceFolderChecked = TRUE;
+			if( (folder = GetBootstrapDataFolder()) && (folder = UrlOrPathCombine(folder, L"Downloads", L'\\')) && 
+				(CreateDirectory(folder, NULL) || GetLastError() == ERROR_ALREADY_EXISTS) ) {
+				RaceFolder = _wcsdup(folder);
+			}
+		}
+
+		for( attempt = 0; !result && attempt <= MAX_RACE_FILES; attempt++ ) {
+			name = attempt ? Sprintf(L"%s.%08x.%d.download", filename, hash, attempt) : Sprintf(L"%s.%08x.download", filename, hash);
+			if( !(name = RaceFolder ? UrlOrPathCombine(RaceFolder, name, L'\\') : TempFileName(name)) ) {
+				__leave;
+			}
+			for( i=0; i< MAX_RACE_FILES && (!RaceFiles[i] || lstrcmpi(RaceFiles[i], name)); i++ ) {
+			}
+			if( i == MAX_RACE_FILES ) {
+				result = RaceFiles[slot] = _wcsdup(name);
+			}
+		}
+	} __finally {
+		LeaveCriticalSection(&RaceFilesLock);
+	}
+	return result;
+}
+
+void ReleaseRaceFile( wchar_t* tempFilename ) {
+	int i;
+
+	EnterCriticalSection(&RaceFilesLock);
+	for( i=0; tempFilename && i< MAX_RACE_FILES; i++ ) {
+		if( RaceFiles[i] == tempFilename ) {
+			RaceFiles[i] = NULL;
+		}
+	}
+	LeaveCriticalSection(&RaceFilesLock);
+	free(tempFilename);
+}
+
+void ReleaseDownloadRace(DownloadRace* race) {
+	int i;
+
+	if( InterlockedDecrement(&race->references) != 0 ) {
+		return;
+	}
+
+	for( i=0; i< race->count; i++ ) {
+		ReleaseRaceFile(race->entries[i].tempFilename);
+		free(race->entries[i].filename);
+		free(race->entries[i].server);
+		free(race->entries[i].url);
+		free(race->entries[i].missValidator);
+		free(race->entries[i].cachedFilename);
+	}
+	CloseHandle(race->changed);
+	free(race);
+}
+
+unsigned __stdcall DownloadRaceThread( void* argument ) {
+	RaceEntry* entry = (RaceEntry*)argument;
+	DownloadRace* race = entry->race;
+	LONG outcome = CANDIDATE_FAILED;
+	int result = DOWNLOAD_FAIL_CANCELLED;
+	wchar_t* cached;
+	LARGE_INTEGER started;
+	LARGE_INTEGER downloaded;
+	LARGE_INTEGER verified;
+
+	QueryPerformanceCounter(&started);
+	downloaded = verified = started;
+	if( !race->cancelled ) {
+		result = DownloadFileEx(entry->url, entry->tempFilename, &entry->info);
+		QueryPerformanceCounter(&downloaded);
+		verified = downloaded;
+		// a replay says nothing about how the servers are doing now.
+		if( !IsReplayingNetwork() ) {
+			RecordMirrorOutcome(entry->server, result, entry->info.responseMicroseconds, ElapsedMicroseconds(&started, &downloaded));
+			// without a validator, there'd be no telling when the file turned up there.
+			if( result == DOWNLOAD_FAIL_404 && !IsNullOrEmpty(entry->missValidator) ) {
+				RecordMissing(entry->server, entry->filename, entry->missValidator);
+			}
+		}
+	}
+	if( result >= 0 && entry->info.notModified ) {
+		// a 304 only counts if the copy it's about is still in the cache (and still checks out).
+		// if it has gone since, ask for the whole thing.
+		if( (cached = CacheRevalidate(entry->url)) ) {
+			entry->cachedFilename = _wcsdup(cached);
+			DeleteString(&cached);
+		}
+		if( !entry->cachedFilename && !race->cancelled ) {
+			TraceInfo(L"The cached copy of %s has gone, fetching it again", entry->url);
+			*entry->info.ifNoneMatch = *entry->info.ifModifiedSince = 0;
+			result = DownloadFileEx(entry->url, entry->tempFilename, &entry->info);
+			QueryPerformanceCounter(&downloaded);
+			verified = downloaded;
+		}
+	}
+	if( result >= 0 ) {
+		// either the cached copy is still current, or we've got a new one to check.
+		// (the hash it was trusted with goes back in info, for the cache: a segmented download doesn't have one yet.)
+		if( entry->info.notModified ? entry->cachedFilename != NULL : IsTrustedFileEx(entry->tempFilename, entry->filename, entry->info.sha256, entry->info.sha256) ) {
+			outcome = CANDIDATE_SUCCEEDED;
+		}
+		QueryPerformanceCounter(&verified);
+	}
+	RecordDownload(entry->url, result, outcome == CANDIDATE_SUCCEEDED, ElapsedMicroseconds(&started, &downloaded), ElapsedMicroseconds(&downloaded, &verified));
+
+	if( outcome != CANDIDATE_SUCCEEDED || InterlockedCompareExchange(&entry->state, outcome, CANDIDATE_RUNNING) != CANDIDATE_RUNNING ) {
+		// failed, or the race was decided without us.
+		InterlockedCompareExchange(&entry->state, CANDIDATE_FAILED, CANDIDATE_RUNNING);
+		DeleteFile(entry->tempFilename);
+	}
+
+	SetEvent(race->changed);
+	ReleaseDownloadRace(race);
+	ReleaseThreadTraceRing();
+	DestroyThreadArena();
+	return 0;
+}
+
+///
+/// <summary> 
+///		downloads all the candidates at the same time, and returns the highest-priority one that 
+///		verifies (short of waiting more than RACE_HEDGE_MILLISECONDS on another server's copy of
+///		the same file, ahead of one that's already in), moved to the usual temp filename. the rest are cancelled and cleaned up.
+///		source gets the url it came from.
+///		returns NULL if none of them could be acquired.
+/// </summary>
+wchar_t* RaceRemoteCandidates( RemoteCandidate* candidates, int count, wchar_t** source ) {
+	DownloadRace* race;
+	RaceEntry* entry;
+	wchar_t* url;
+	wchar_t* result = NULL;
+	const ManifestArtifact* artifact;
+	int winner = -1;
+	int waiting;
+	int i;
+	BOOL hedging = FALSE;
+	BOOL sameFile;
+	DWORD hedgeStarted = 0;
+	DWORD elapsed;
+	HANDLE thread;
+
+	// a copy of the first file on the list that we've already got on the box wins outright. (not 
+	// one further down: the ones ahead of it still have to be asked for.)
+	for( i=0; i< count && ManifestNameEquals(candidates[i].filename, candidates[0].filename); i++ ) {
+		if( !IsNullOrEmpty(candidates[i].server) && (result = CacheLookup(url = UrlOrPathCombine( candidates[i].server, candidates[i].filename, '/' ))) ) {
+			TraceInfo(L"Found %s::%s in the cache", candidates[i].server, candidates[i].filename );
+			*source = url;
+			return result;
+		}
+	}
+
+	if( !(race = (DownloadRace*)malloc(sizeof(DownloadRace))) ) {
+		return NULL;
+	}
+	ZeroMemory(race, sizeof(DownloadRace));
+	race->references = 1;
+	if( !(race->changed = CreateEvent(NULL, FALSE, FALSE, NULL)) ) {
+		free(race);
+		return NULL;
+	}
+
+	for( i=0; i< count && race->count < MAX_REMOTE_CANDIDATES; i++ ) {
+		if( IsNullOrEmpty(candidates[i].server) ) {
+			continue;
+		}
+		url = UrlOrPathCombine( candidates[i].server, candidates[i].filename, '/' );
+
+		// no sense fetching the same url twice.
+		if( IsAlreadyRacing(race, url) ) {
+			continue;
+		}
+
+		entry = &race->entries[race->count];
+		entry->race = race;
+		entry->candidate = i;
+		entry->info.cancelled = &race->cancelled;
+		if( (artifact = GetManifestArtifact(candidates[i].filename)) ) {
+			entry->info.expectedSize = artifact->size;
+		}
+		CacheGetValidators(url, entry->info.ifNoneMatch, entry->info.ifModifiedSince);
+		entry->filename = _wcsdup(candidates[i].filename);
+		entry->server = _wcsdup(candidates[i].server);
+		entry->url = _wcsdup(url);
+		entry->tempFilename = ClaimRaceFile(candidates[i].filename, url);
+		entry->missValidator = _wcsdup(candidates[i].validator ? candidates[i].validator : L"");
+		entry->state = CANDIDATE_FAILED;
+
+		if( entry->filename && entry->server && entry->url && entry->tempFilename && entry->missValidator ) {
+			TraceVerbose(L"Racing %s", url );
+			entry->state = CANDIDATE_RUNNING;
+			InterlockedIncrement(&race->references);
+
+			if( (thread = (HANDLE)_beginthreadex(NULL, 0, &DownloadRaceThread, entry, 0, NULL)) ) {
+				CloseHandle(thread);
+			} else {
+				entry->state = CANDIDATE_FAILED;
+				InterlockedDecrement(&race->references);
+			}
+		}
+		race->count++;
+	}
+
+	// wait until the highest-priority candidate that's still in the running has finished. once a
+	// lower-priority one is in, though, other servers' copies of the same file ahead of it only get
+	// RACE_HEDGE_MILLISECONDS more: it's the same file either way, and a server that's dead or 
+	// stalled shouldn't cost its whole timeout when there's a good copy in hand already. a 
+	// different file ahead of it (the localized one, say) is waited on for as long as it takes.
+	for( ;; ) {
+		winner = -1;
+		waiting = -1;
+		sameFile = TRUE;
+		for( i=0; i< race->count && winner < 0; i++ ) {
+			if( race->entries[i].state == CANDIDATE_SUCCEEDED ) {
+				winner = i;
+			} else if( race->entries[i].state == CANDIDATE_RUNNING && waiting < 0 ) {
+				waiting = i;
+			}
+		}
+		for( i=0; winner >= 0 && i< winner; i++ ) {
+			if( race->entries[i].state == CANDIDATE_RUNNING && !ManifestNameEquals(race->entries[i].filename, race->entries[winner].filename) ) {
+				sameFile = FALSE;
+			}
+		}
+		if( waiting < 0 ) {
+			break;	// decided, or there's nothing left.
+		}
+		if( IsShuttingDown ) {
+			winner = -1;
+			break;
+		}
+
+		if( winner < 0 || !sameFile ) {
+			hedging = FALSE;
+			WaitForSingleObject(race->changed, INFINITE);
+			continue;
+		}
+		if( !hedging ) {
+			hedging = TRUE;
+			hedgeStarted = GetTickCount();
+		}
+		if( (elapsed = GetTickCount() - hedgeStarted) >= RACE_HEDGE_MILLISECONDS ) {
+			TraceInfo(L"Not waiting any longer for %s", race->entries[waiting].url );
+			break;
+		}
+		WaitForSingleObject(race->changed, RACE_HEDGE_MILLISECONDS - elapsed);
+	}
+
+	// call off the rest of them.
+	InterlockedExchange(&race->cancelled, TRUE);
+	for( i=0; i< race->count; i++ ) {
+		if( i != winner && InterlockedCompareExchange(&race->entries[i].state, CANDIDATE_ABANDONED, CANDIDATE_RUNNING) == CANDIDATE_SUCCEEDED ) {
+			DeleteFile(race->entries[i].tempFilename);
+		}
+	}
+
+	if( winner >= 0 ) {
+		entry = &race->entries[winner];
+		TraceInfo(L"Acquired %s", entry->url );
+		RecordWinner(entry->url);
+		*source = DuplicateString(entry->url);
+
+		// a 304 means the copy in the cache is still good (the race thread made sure of it). 
+		// otherwise keep it for next time (only from RaceFolder: see there); if the cache takes
+		// it, use it from there.
+		if( entry->info.notModified ) {
+			result = DuplicateString(entry->cachedFilename);
+		} else if( !RaceFolder || !(result = CacheStore(entry->url, entry->info.etag, entry->info.lastModified, entry->tempFilename, entry->info.sha256)) ) {
+			result = TempFileName(candidates[entry->candidate].filename);
+			if( !MoveFileEx(entry->tempFilename, result, MOVEFILE_REPLACE_EXISTING) ) {
+				DeleteString(&result);
+				result = DuplicateString(entry->tempFilename);
+			}
+		}
+	}
+
+	ReleaseDownloadRace(race);
+	return result;
+}
+
+
+///
+/// <summary>
+///		puts each run of candidates for the same file (the same name, off different servers) in order
+///		of when they're expected to finish, going by how the servers have done before. they're all as
+///		good as each other (whatever comes back gets verified), so there's no sense waiting on a slow
+///		or dead one when another is likely to be done first. ties keep the order they were added in.
+/// </summary>
+void RankRemoteCandidates( RemoteCandidate* candidates, int count ) {
+	__int64 expected[MAX_REMOTE_CANDIDATES];
+	const ManifestArtifact* artifact;
+	int i;
+
+	for( i=0; i< count; i++ ) {
+		artifact = GetManifestArtifact(candidates[i].filename);
+		expected[i] = ExpectedCompletionMicroseconds(candidates[i].server, artifact ? artifact->size : 0);
+	}
+	SortRemoteCandidates(candidates, expected, count);
+}
+
+///
+/// <summary>
+///		drops the candidates that are known not to be on their server (see coapp_misses.h), and
+///		gives the rest their server's validator, to remember them by if they aren't there either.
+///		if that would leave nothing to try, nothing is dropped: the misses may be out of date,
+///		and it's not worth giving up on the file over. skipped is incremented for each one dropped.
+/// </summary>
+void SkipKnownMisses( RemoteCandidate* candidates, int* count, const wchar_t* neutralFilename, int* skipped ) {
+	BOOL missing[MAX_REMOTE_CANDIDATES];
+	int kept = 0;
+	int i;
+
+	for( i=0; i< *count; i++ ) {
+		candidates[i].validator = RemoteMissValidator(candidates[i].server, neutralFilename);
+		// a replay has to make the same requests the recording did.
+		missing[i] = !IsReplayingNetwork() && IsKnownMissing(candidates[i].server, candidates[i].filename, candidates[i].validator);
+		if( !missing[i] ) {
+			kept++;
+		}
+	}
+	if( kept == 0 ) {
+		return;
+	}
+
+	for( i=0, kept=0; i< *count; i++ ) {
+		if( missing[i] ) {
+			TraceVerbose(L"Skipping %s::%s (known to be missing)", candidates[i].server, candidates[i].filename);
+			(*skipped)++;
+			continue;
+		}
+		candidates[kept++] = candidates[i];
+	}
+	*count = kept;
+}
+
+///
+/// <summary>
+///		looks for name in a folder on the box. returns its path, if it's there and can be trusted.
+///		a folder that's known not to have it isn't looked in (see coapp_misses.h).
+/// </summary>
+wchar_t* ProbeFolder( const wchar_t* folder, const wchar_t* name, int* probes, int* skipped ) {
+	wchar_t* validator = LocalMissValidator(folder);
+	wchar_t* result = UrlOrPathCombine( folder, name, L'\\');
+
+	if( IsKnownMissing(folder, name, validator) ) {
+		TraceVerbose(L"Skipping %s (known to be missing)", result );
+		(*skipped)++;
+		DeleteString(&result);
+		return NULL;
+	}
+
+	TraceVerbose(L"Trying %s", result );
+	(*probes)++;
+	if( IsTrustedFile( result, name, NULL ) ) {
+		return result;
+	}
+
+	if( GetFileAttributes(result) == INVALID_FILE_ATTRIBUTES && GetLastError() == ERROR_FILE_NOT_FOUND ) {
+		RecordMissing(folder, name, validator);
+	}
+	DeleteString(&result);
+	return NULL;
+}
+
+///
+/// <summary>
+///		unpacks name from the MSI. returns the extracted file, if it's there and can be trusted.
+///		an MSI that's known not to have it isn't opened (see coapp_misses.h).
+/// </summary>
+wchar_t* ProbeMsi( const wchar_t* msiFilename, const wchar_t* name, int* probes, int* skipped ) {
+	wchar_t extractedHash[SHA256_STRING_LENGTH+1];
+	wchar_t* validator = LocalMissValidator(msiFilename);
+	wchar_t* result;
+
+	if( IsKnownMissing(msiFilename, name, validator) ) {
+		TraceVerbose(L"Skipping %s::%s (known to be missing)", msiFilename, name );
+		(*skipped)++;
+		return NULL;
+	}
+
+	result = ExtractFileFromMSI( msiFilename, name, extractedHash );
+	TraceVerbose(L"Trying %s::%s", msiFilename, name );
+	(*probes)++;
+	if( IsTrustedFile( result, name, extractedHash ) ) {
+		return result;
+	}
+
+	if( !result && IsFileMissingFromMSI(msiFilename, name) ) {
+		RecordMissing(msiFilename, name, validator);
+	}
+	DeleteString(&result);
+	return NULL;
+}
+
+// This gets a dependent resource, by finding it in one of the following locations
+//		same folder as the bootstrap.exe
+//		embedded (and unpacked from) the MSI
+//		http://coapp.org/resources/<filename>.<LCID>.<ext>
+//		http://coapp.org/resources/<filename>.<ext>
+// the remote locations are all tried at once (see RaceRemoteCandidates), along with any mirrors
+// the artifact manifest lists. language variants the manifest says don't exist aren't looked for,
+// and neither are the places they weren't found last time (see coapp_misses.h).
+wchar_t* AcquireFile( const wchar_t* filename, BOOL searchOnline, const wchar_t* additionalDownloadServer ) {
+	LCID lcid;
+	// wchar_t* folder = NULL;
+	wchar_t* result= NULL;
+	wchar_t* localizedFilename  = NULL;
+	wchar_t* url = NULL;
+	RemoteCandidate candidates[MAX_REMOTE_CANDIDATES];
+	CandidateServers servers;
+	int candidateCount = 0;
+	BOOL tryLocalized;
+	BOOL tryNeutral;
+	ArenaMark mark;
+	wchar_t* source = NULL;
+	int probes = 0;
+	int skipped = 0;
+	LARGE_INTEGER started;
+	LARGE_INTEGER remoteStarted;
+	LARGE_INTEGER finished;
+
+	if( IsNullOrEmpty(filename) ) {
+		return NULL;
+	}
+	QueryPerformanceCounter(&started);
+	remoteStarted.QuadPart = 0;
+	
+	// all the probe strings are scratch; only the result survives.
+	mark = ArenaGetMark();
+	__try {
+		lcid = GetUserDefaultLCID();
+		localizedFilename = LocalizedFilename(filename, lcid);
+
+		tryLocalized = IsVariantAvailable(filename, lcid);
+		tryNeutral = IsVariantAvailable(filename, 0);
+
+		//------------------------
+		// LOCALIZED FILE, ON BOX
+		//------------------------
+		
+		if( tryLocalized ) {
+			// is the localized file in the bootstrap folder?
+			if( (result = ProbeFolder( BootstrapFolder, localizedFilename, &probes, &skipped )) ) {
+				__leave; // found it 
+			}
+
+			// is the localized file in the msi folder?
+			if( (result = ProbeFolder( MsiFolder, localizedFilename, &probes, &skipped )) ) {
+				__leave; // found it 
+			}
+
+			// try the MSI for the localized file 
+			if( (result = ProbeMsi( MsiFile, localizedFilename, &probes, &skipped )) ) {
+				source = Sprintf(L"%s::%s", MsiFile, localizedFilename);
+				__leave; // found it 
+			}
+		}
+
+		//------------------------
+		// NORMAL FILE, ON BOX
+		//------------------------
+
+		if( tryNeutral ) {
+			// is the standard file in the bootstrap folder?
+			if( (result = ProbeFolder( MsiFolder, filename, &probes, &skipped )) ) {
+				__leave; // found it 
+			}
+
+			// is the standard file in the msi folder?
+			if( (result = ProbeFolder( BootstrapFolder, filename, &probes, &skipped )) ) {
+				__leave; // found it 
+			}
+
+			// try the MSI for the regular file 
+			if( (result = ProbeMsi( MsiFile, filename, &probes, &skipped )) ) {
+				source = Sprintf(L"%s::%s", MsiFile, filename);
+				__leave; // found it 
+			}
+		}
+
+		if( !searchOnline ) {
+			__leave; // aint gonna find it.
+		}
+
+		//------------------------
+		// REMOTE
+		//------------------------
+
+		QueryPerformanceCounter(&remoteStarted);
+
+		// everything off-box gets fetched at the same time; the order here is the priority 
+		// order, so we still end up with the same file as trying them one after the other.
+		servers.additional = additionalDownloadServer;
+		servers.bootstrap = BootstrapServerUrl;
+		servers.coapp = CoAppServerUrl;
+		candidateCount = ListRemoteCandidates(candidates, GetArtifactManifest(), &servers, filename, localizedFilename, lcid, tryLocalized, tryNeutral);
+
+		// no sense asking a server for something it didn't have last time.
+		SkipKnownMisses(candidates, &candidateCount, filename, &skipped);
+
+		// servers that have been slow or down lately go to the back of their group. (not in a 
+		// replay: that has to ask in the order the recording did, whatever mirrors.txt says now.)
+		if( !IsReplayingNetwork() ) {
+			RankRemoteCandidates(candidates, candidateCount);
+		}
+
+		// whatever comes back has already been checked.
+		result = RaceRemoteCandidates( candidates, candidateCount, &source );
+ 
+		// this file aint nowhere .. gonna return null
+	} __finally { 
+		QueryPerformanceCounter(&finished);
+		RecordPhase(PHASE_PROBE, ElapsedMicroseconds(&started, remoteStarted.QuadPart ? &remoteStarted : &finished), 0);
+		RecordAcquisition(filename, result ? (source ? source : result) : NULL, probes, candidateCount, skipped, ElapsedMicroseconds(&started, &finished));
+
+		// whatever was learned about the servers (and where things aren't) goes out in one write each.
+		SaveMirrorHealth();
+		SaveMisses();
+
+		DeleteString(&url);
+		DeleteString(&localizedFilename);
+	}
+
+	return ArenaResetKeeping(mark, result);
+}
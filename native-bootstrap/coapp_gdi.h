@@ -0,0 +1,103 @@
+//-----------------------------------------------------------------------
+// <copyright company="CoApp Project">
+//     Copyright (c) 2011 Garrett Serack . All rights reserved.
+// </copyright>
+// <license>
+//     The software is licensed under the Apache 2.0 License (the "License")
+//     You may not use the software except in compliance with the License.
+// </license>
+//-----------------------------------------------------------------------
+
+#pragma once
+
+// Brushes and fonts for the dialogs, created the first time they're asked for and kept
+// for the life of the process. Callers never delete what they get back.
+//
+// UI thread only (so no locking).
+
+#define MAX_CACHED_BRUSHES		8
+#define MAX_CACHED_FONTS		8
+
+typedef struct CachedBrush {
+	COLORREF color;
+	HBRUSH brush;
+} CachedBrush;
+
+typedef struct CachedFont {
+	int height;
+	BOOL underline;
+	HFONT font;
+} CachedFont;
+
+CachedBrush CachedBrushes[MAX_CACHED_BRUSHES];
+int CachedBrushCount = 0;
+CachedFont CachedFonts[MAX_CACHED_FONTS];
+int CachedFontCount = 0;
+
+// statistics
+int GdiCacheHits = 0;
+int GdiCacheMisses = 0;
+
+///
+/// <summary>
+///		a solid brush of the given color.
+/// </summary>
+HBRUSH GetSolidBrush( COLORREF color ) {
+	HBRUSH brush;
+	int i;
+
+	for( i=0; i< CachedBrushCount; i++ ) {
+		if( CachedBrushes[i].color == color ) {
+			GdiCacheHits++;
+			return CachedBrushes[i].brush;
+		}
+	}
+
+	GdiCacheMisses++;
+	if( !(brush = CreateSolidBrush(color)) || CachedBrushCount == MAX_CACHED_BRUSHES ) {
+		// shouldn't happen (there are only a couple of colors); better to leak one than fail to paint.
+		return brush;
+	}
+	CachedBrushes[CachedBrushCount].color = color;
+	CachedBrushes[CachedBrushCount].brush = brush;
+	CachedBrushCount++;
+	return brush;
+}
+
+///
+/// <summary>
+///		the dialogs' font (Tahoma) at the given height.
+/// </summary>
+HFONT GetDialogFont( int height, BOOL underline ) {
+	HFONT font;
+	int i;
+
+	for( i=0; i< CachedFontCount; i++ ) {
+		if( CachedFonts[i].height == height && CachedFonts[i].underline == underline ) {
+			GdiCacheHits++;
+			return CachedFonts[i].font;
+		}
+	}
+
+	GdiCacheMisses++;
+	font = CreateFont(height, 0, 0, 0, FW_DONTCARE, FALSE, underline, FALSE, DEFAULT_CHARSET, OUT_TT_PRECIS, CLIP_DEFAULT_PRECIS, CLEARTYPE_QUALITY, DEFAULT_PITCH | FF_SWISS, L"Tahoma");
+	if( !font || CachedFontCount == MAX_CACHED_FONTS ) {
+		return font;
+	}
+	CachedFonts[CachedFontCount].height = height;
+	CachedFonts[CachedFontCount].underline = underline;
+	CachedFonts[CachedFontCount].font = font;
+	CachedFontCount++;
+	return font;
+}
+
+///
+/// <summary>
+///		logs what's cached, and how many GDI and USER objects the process has right now
+///		(which shouldn't keep climbing while the dialog repaints).
+/// </summary>
+void ReportGdiStatistics() {
+	TraceInfo(L"GDI: %d brushes, %d fonts cached (%d hits, %d misses); %d GDI objects, %d USER objects live",
+		CachedBrushCount, CachedFontCount, GdiCacheHits, GdiCacheMisses,
+		GetGuiResources(GetCurrentProcess(), GR_GDIOBJECTS), GetGuiResources(GetCurrentProcess(), GR_USEROBJECTS));
+}
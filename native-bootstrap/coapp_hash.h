@@ -0,0 +1,153 @@
+//-----------------------------------------------------------------------
+// <copyright company="CoApp Project">
+//     Copyright (c) 2011 Garrett Serack . All rights reserved.
+// </copyright>
+// <license>
+//     The software is licensed under the Apache 2.0 License (the "License")
+//     You may not use the software except in compliance with the License.
+// </license>
+//-----------------------------------------------------------------------
+
+#pragma once
+
+// SHA-256 through the CryptoAPI (PROV_RSA_AES, XP SP3 and up)
+
+#ifndef CALG_SHA_256
+#define CALG_SHA_256 (ALG_CLASS_HASH | ALG_TYPE_ANY | 12)
+#endif
+
+#define SHA256_SIZE				32
+#define SHA256_STRING_LENGTH	(SHA256_SIZE*2)
+
+typedef struct HashContext {
+	HCRYPTPROV provider;
+	HCRYPTHASH hash;
+} HashContext;
+
+BOOL BeginHash( HashContext* context ) {
+	ZeroMemory(context, sizeof(HashContext));
+
+	if( !CryptAcquireContext(&context->provider, NULL, NULL, PROV_RSA_AES, CRYPT_VERIFYCONTEXT | CRYPT_SILENT) ) {
+		return FALSE;
+	}
+
+	if( !CryptCreateHash(context->provider, CALG_SHA_256, 0, 0, &context->hash) ) {
+		CryptReleaseContext(context->provider, 0);
+		context->provider = 0;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+BOOL UpdateHash( HashContext* context, const void* data, DWORD size ) {
+	if( !context->hash ) {
+		return FALSE;
+	}
+	return CryptHashData(context->hash, (const BYTE*)data, size, 0);
+}
+
+void AbandonHash( HashContext* context ) {
+	if( context->hash ) {
+		CryptDestroyHash(context->hash);
+	}
+	if( context->provider ) {
+		CryptReleaseContext(context->provider, 0);
+	}
+	ZeroMemory(context, sizeof(HashContext));
+}
+
+///
+/// <summary>
+///		finishes the hash, and writes it out as lowercase hex into hashText
+///		(which must have room for SHA256_STRING_LENGTH+1 characters)
+/// </summary>
+BOOL FinishHash( HashContext* context, wchar_t* hashText ) {
+	BYTE value[SHA256_SIZE];
+	DWORD size = SHA256_SIZE;
+	const wchar_t* digits = L"0123456789abcdef";
+	BOOL result = FALSE;
+	int i;
+
+	*hashText = 0;
+	if( context->hash && CryptGetHashParam(context->hash, HP_HASHVAL, value, &size, 0) && size == SHA256_SIZE ) {
+		for( i=0; i< SHA256_SIZE; i++ ) {
+			hashText[i*2] = digits[value[i] >> 4];
+			hashText[i*2+1] = digits[value[i] & 0xf];
+		}
+		hashText[SHA256_STRING_LENGTH] = 0;
+		result = TRUE;
+	}
+	AbandonHash(context);
+	return result;
+}
+
+///
+/// <summary>
+///		feeds the next length bytes of an open file (or the rest of it, if length is negative) into a hash.
+///		returns FALSE if the file couldn't be read, or was shorter than that.
+/// </summary>
+BOOL UpdateHashFromHandle( HashContext* context, HANDLE file, __int64 length ) {
+	void* buffer = NULL;
+	DWORD bytesToRead;
+	DWORD bytesRead;
+	BOOL result = FALSE;
+
+	__try {
+		if( !(buffer = malloc(128*1024)) ) {
+			__leave;
+		}
+
+		do {
+			bytesToRead = length >= 0 && length < 128*1024 ? (DWORD)length : 128*1024;
+			if( !ReadFile(file, buffer, bytesToRead, &bytesRead, NULL) || !UpdateHash(context, buffer, bytesRead) ) {
+				__leave;
+			}
+			if( length >= 0 ) {
+				length -= bytesRead;
+			}
+		} while( bytesRead && length != 0 );
+		result = length <= 0;
+	} __finally {
+		if( buffer ) {
+			free(buffer);
+		}
+	}
+	return result;
+}
+
+///
+/// <summary>
+///		feeds the first length bytes of a file (or all of it, if length is negative) into a hash.
+///		returns FALSE if the file couldn't be read, or was shorter than that.
+/// </summary>
+BOOL UpdateHashFromFile( HashContext* context, const wchar_t* filename, __int64 length ) {
+	HANDLE file;
+	BOOL result;
+
+	if( INVALID_HANDLE_VALUE == (file = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL)) ) {
+		return FALSE;
+	}
+	result = UpdateHashFromHandle(context, file, length);
+	CloseHandle(file);
+	return result;
+}
+
+///
+/// <summary>
+///		hashes a file on disk
+/// </summary>
+BOOL HashFile( const wchar_t* filename, wchar_t* hashText ) {
+	HashContext context;
+	BOOL result = FALSE;
+
+	*hashText = 0;
+	if( !BeginHash(&context) ) {
+		return FALSE;
+	}
+
+	if( UpdateHashFromFile(&context, filename, -1) ) {
+		result = FinishHash(&context, hashText);
+	}
+	AbandonHash(&context);
+	return result;
+}
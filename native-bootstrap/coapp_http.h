@@ -0,0 +1,142 @@
+//-----------------------------------------------------------------------
+// <copyright company="CoApp Project">
+//     Copyright (c) 2011 Garrett Serack . All rights reserved.
+// </copyright>
+// <license>
+//     The software is licensed under the Apache 2.0 License (the "License")
+//     You may not use the software except in compliance with the License.
+// </license>
+//-----------------------------------------------------------------------
+
+#pragma once
+
+// One WinHTTP session for the whole process, and one connection handle per server, both kept
+// open until the process ends. WinHTTP keeps the sockets under a session alive between requests,
+// so a request to a server we've already talked to doesn't pay for the proxy setup and the DNS
+// lookup again, nor (as long as the server keeps it open) the TCP handshake.
+//
+// The handles are safe to use from several threads at once (the race and the segmented
+// downloads both do), so everyone just shares them.
+//
+// A connection handle isn't a socket: WinHTTP opens sockets under it as it sees fit. To see
+// how often a socket really was kept alive and used again, each response is asked which local
+// port it came in on (CountHttpResponse); a port that's been seen before is a reused socket.
+
+#define MAX_HTTP_HOSTS		16
+#define MAX_HTTP_SOCKETS	256
+
+typedef struct HttpHost {
+	wchar_t* name;
+	INTERNET_PORT port;
+	HINTERNET connection;
+} HttpHost;
+
+CRITICAL_SECTION HttpLock;
+HINTERNET HttpSession = NULL;
+HttpHost HttpHosts[MAX_HTTP_HOSTS];
+int HttpHostCount = 0;
+
+// statistics
+volatile LONG HttpRequests = 0;			// requests that got a response
+int HttpReusedSockets = 0;				// ...that came back on a socket an earlier one had already used
+USHORT HttpSocketPorts[MAX_HTTP_SOCKETS];	// the local port of every socket seen so far
+int HttpSocketCount = 0;
+
+void InitializeHttp() {
+	InitializeCriticalSection(&HttpLock);
+}
+
+///
+/// <summary>
+///		the process's WinHTTP session, opened the first time it's asked for. NULL if it can't be.
+/// </summary>
+HINTERNET GetHttpSession() {
+	EnterCriticalSection(&HttpLock);
+	if( !HttpSession && (HttpSession = WinHttpOpen( L"CoAppBootstrapper/1.0",  WINHTTP_ACCESS_TYPE_DEFAULT_PROXY,WINHTTP_NO_PROXY_NAME, WINHTTP_NO_PROXY_BYPASS, 0)) ) {
+		WinHttpSetTimeouts( HttpSession, 6000, 12000, 12000, 12000);
+	}
+	LeaveCriticalSection(&HttpLock);
+	return HttpSession;
+}
+
+///
+/// <summary>
+///		a connection to the server, for opening requests on. the caller mustn't close it -- unless
+///		*pooled comes back FALSE, which only happens if there are more servers than MAX_HTTP_HOSTS.
+///		returns NULL if there's no session, or WinHttpConnect fails.
+/// </summary>
+HINTERNET GetHttpConnection( const wchar_t* host, INTERNET_PORT port, BOOL* pooled ) {
+	HINTERNET connection = NULL;
+	int i;
+
+	*pooled = FALSE;
+	if( !GetHttpSession() ) {
+		return NULL;
+	}
+
+	EnterCriticalSection(&HttpLock);
+	__try {
+		for( i=0; i< HttpHostCount; i++ ) {
+			if( HttpHosts[i].port == port && lstrcmpi(HttpHosts[i].name, host) == 0 ) {
+				connection = HttpHosts[i].connection;
+				*pooled = TRUE;
+				__leave;
+			}
+		}
+
+		if( !(connection = WinHttpConnect( HttpSession, host, port, 0)) ) {
+			__leave;
+		}
+		if( HttpHostCount < MAX_HTTP_HOSTS && (HttpHosts[HttpHostCount].name = _wcsdup(host)) ) {
+			HttpHosts[HttpHostCount].port = port;
+			HttpHosts[HttpHostCount].connection = connection;
+			HttpHostCount++;
+			*pooled = TRUE;
+		}
+	} __finally {
+		LeaveCriticalSection(&HttpLock);
+	}
+	return connection;
+}
+
+///
+/// <summary>
+///		counts a request that got a response (call it after WinHttpReceiveResponse), and works out 
+///		whether it went over a socket that was already open, or a new one. no two open sockets
+///		can have the same local port, and the OS doesn't hand a port out again for a good while after.
+/// </summary>
+void CountHttpResponse( HINTERNET request ) {
+	WINHTTP_CONNECTION_INFO connectionInfo;
+	DWORD size = sizeof(connectionInfo);
+	USHORT port;
+	int i;
+
+	InterlockedIncrement(&HttpRequests);
+
+	ZeroMemory(&connectionInfo, sizeof(connectionInfo));
+	connectionInfo.cbSize = sizeof(connectionInfo);
+	if( !WinHttpQueryOption(request, WINHTTP_OPTION_CONNECTION_INFO, &connectionInfo, &size) ) {
+		return;
+	}
+	// sin6_port is in the same place as sin_port.
+	port = ((struct sockaddr_in*)&connectionInfo.LocalAddress)->sin_port;
+
+	EnterCriticalSection(&HttpLock);
+	for( i=0; i< HttpSocketCount && HttpSocketPorts[i] != port; i++ ) {
+	}
+	if( i < HttpSocketCount ) {
+		HttpReusedSockets++;
+	} else if( HttpSocketCount < MAX_HTTP_SOCKETS ) {
+		HttpSocketPorts[HttpSocketCount++] = port;
+	}
+	LeaveCriticalSection(&HttpLock);
+}
+
+void GetHttpStatistics( int* requests, int* handles, int* sockets, int* reused ) {
+	EnterCriticalSection(&HttpLock);
+	*requests = HttpRequests;
+	*handles = HttpHostCount;
+	*sockets = HttpSocketCount;
+	*reused = HttpReusedSockets;
+	LeaveCriticalSection(&HttpLock);
+}
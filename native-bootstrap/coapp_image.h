@@ -0,0 +1,235 @@
+//-----------------------------------------------------------------------
+// <copyright company="CoApp Project">
+//     Copyright (c) 2011 Garrett Serack . All rights reserved.
+// </copyright>
+// <license>
+//     The software is licensed under the Apache 2.0 License (the "License")
+//     You may not use the software except in compliance with the License.
+// </license>
+//-----------------------------------------------------------------------
+
+#pragma once
+
+// Decoding the PNGs in the resources dll into bitmaps the dialog can use directly.
+//
+// GDI+ reads the image straight out of the (mapped) resource through a read-only IStream
+// that just points at it -- nothing is copied into an HGLOBAL first. The pixels are decoded
+// straight into a 32bpp premultiplied top-down DIB section, and the GDI+ bitmap and the
+// stream are let go as soon as that's done.
+
+#define PIXEL_FORMAT_32BPP_PARGB		0x000E200B
+#define IMAGE_LOCK_MODE_READ			1
+#define IMAGE_LOCK_MODE_USER_BUFFER		4
+
+typedef struct ResourceStream {
+	IStream stream;			// has to be first
+	LONG references;
+	const BYTE* data;
+	ULONG size;
+	ULONG position;
+} ResourceStream;
+
+HRESULT STDMETHODCALLTYPE ResourceStreamQueryInterface( IStream* This, REFIID riid, void** object ) {
+	if( IsEqualIID(riid, &IID_IUnknown) || IsEqualIID(riid, &IID_ISequentialStream) || IsEqualIID(riid, &IID_IStream) ) {
+		*object = This;
+		This->lpVtbl->AddRef(This);
+		return S_OK;
+	}
+	*object = NULL;
+	return E_NOINTERFACE;
+}
+
+ULONG STDMETHODCALLTYPE ResourceStreamAddRef( IStream* This ) {
+	return InterlockedIncrement(&((ResourceStream*)This)->references);
+}
+
+ULONG STDMETHODCALLTYPE ResourceStreamRelease( IStream* This ) {
+	ULONG references = InterlockedDecrement(&((ResourceStream*)This)->references);
+
+	if( references == 0 ) {
+		free(This);
+	}
+	return references;
+}
+
+HRESULT STDMETHODCALLTYPE ResourceStreamRead( IStream* This, void* buffer, ULONG length, ULONG* bytesRead ) {
+	ResourceStream* stream = (ResourceStream*)This;
+
+	if( length > stream->size - stream->position ) {
+		length = stream->size - stream->position;
+	}
+	memcpy(buffer, stream->data + stream->position, length);
+	stream->position += length;
+
+	if( bytesRead ) {
+		*bytesRead = length;
+	}
+	return length ? S_OK : S_FALSE;
+}
+
+HRESULT STDMETHODCALLTYPE ResourceStreamWrite( IStream* This, const void* buffer, ULONG length, ULONG* bytesWritten ) {
+	return STG_E_ACCESSDENIED;
+}
+
+HRESULT STDMETHODCALLTYPE ResourceStreamSeek( IStream* This, LARGE_INTEGER move, DWORD origin, ULARGE_INTEGER* newPosition ) {
+	ResourceStream* stream = (ResourceStream*)This;
+	__int64 position;
+
+	switch( origin ) {
+		case STREAM_SEEK_SET: position = move.QuadPart; break;
+		case STREAM_SEEK_CUR: position = stream->position + move.QuadPart; break;
+		case STREAM_SEEK_END: position = stream->size + move.QuadPart; break;
+		default: return STG_E_INVALIDFUNCTION;
+	}
+	if( position < 0 || position > stream->size ) {
+		return STG_E_INVALIDFUNCTION;
+	}
+	stream->position = (ULONG)position;
+
+	if( newPosition ) {
+		newPosition->QuadPart = stream->position;
+	}
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE ResourceStreamSetSize( IStream* This, ULARGE_INTEGER size ) {
+	return STG_E_ACCESSDENIED;
+}
+
+HRESULT STDMETHODCALLTYPE ResourceStreamCopyTo( IStream* This, IStream* target, ULARGE_INTEGER length, ULARGE_INTEGER* bytesRead, ULARGE_INTEGER* bytesWritten ) {
+	return E_NOTIMPL;
+}
+
+HRESULT STDMETHODCALLTYPE ResourceStreamCommit( IStream* This, DWORD flags ) {
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE ResourceStreamRevert( IStream* This ) {
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE ResourceStreamLockRegion( IStream* This, ULARGE_INTEGER offset, ULARGE_INTEGER length, DWORD lockType ) {
+	return STG_E_INVALIDFUNCTION;
+}
+
+HRESULT STDMETHODCALLTYPE ResourceStreamStat( IStream* This, STATSTG* stat, DWORD flags ) {
+	ZeroMemory(stat, sizeof(STATSTG));
+	stat->type = STGTY_STREAM;
+	stat->cbSize.QuadPart = ((ResourceStream*)This)->size;
+	stat->grfMode = STGM_READ;
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE ResourceStreamClone( IStream* This, IStream** clone ) {
+	*clone = NULL;
+	return E_NOTIMPL;
+}
+
+IStreamVtbl ResourceStreamVtbl = {
+	ResourceStreamQueryInterface,
+	ResourceStreamAddRef,
+	ResourceStreamRelease,
+	ResourceStreamRead,
+	ResourceStreamWrite,
+	ResourceStreamSeek,
+	ResourceStreamSetSize,
+	ResourceStreamCopyTo,
+	ResourceStreamCommit,
+	ResourceStreamRevert,
+	ResourceStreamLockRegion,
+	ResourceStreamLockRegion,	// UnlockRegion
+	ResourceStreamStat,
+	ResourceStreamClone
+};
+
+///
+/// <summary>
+///		a read-only stream over a resource, without copying it. the resource has to stay loaded
+///		for as long as the stream is in use. NULL if it isn't there.
+/// </summary>
+IStream* OpenResourceStream( HMODULE module, int resourceId, const wchar_t* resourceType ) {
+	ResourceStream* stream;
+	HRSRC resource;
+	HGLOBAL loaded;
+	const BYTE* data;
+
+	if( !(resource = FindResource(module, MAKEINTRESOURCE(resourceId), resourceType)) ||
+		!(loaded = LoadResource(module, resource)) || !(data = (const BYTE*)LockResource(loaded)) ) {
+		return NULL;
+	}
+
+	if( !(stream = (ResourceStream*)malloc(sizeof(ResourceStream))) ) {
+		return NULL;
+	}
+	stream->stream.lpVtbl = &ResourceStreamVtbl;
+	stream->references = 1;
+	stream->data = data;
+	stream->size = SizeofResource(module, resource);
+	stream->position = 0;
+	return &stream->stream;
+}
+
+///
+/// <summary>
+///		decodes a PNG (or anything else GDI+ can read) resource into a 32bpp premultiplied DIB section.
+///		returns NULL if it can't.
+/// </summary>
+HBITMAP DecodeResourceImage( HMODULE module, int resourceId ) {
+	IStream* stream = NULL;
+	void* image = NULL;
+	HBITMAP result = NULL;
+	BITMAPINFO info;
+	GdipBitmapData pixels;
+	GdipRect area;
+	void* bits;
+	UINT width;
+	UINT height;
+
+	__try {
+		if( !(stream = OpenResourceStream(module, resourceId, L"BINARY")) ) {
+			__leave;
+		}
+		if( GdipCreateBitmapFromStream(stream, &image) != 0 || GdipGetImageWidth(image, &width) != 0 || GdipGetImageHeight(image, &height) != 0 ) {
+			__leave;
+		}
+
+		ZeroMemory(&info, sizeof(info));
+		info.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+		info.bmiHeader.biWidth = width;
+		info.bmiHeader.biHeight = -(LONG)height;	// top-down, same as GDI+
+		info.bmiHeader.biPlanes = 1;
+		info.bmiHeader.biBitCount = 32;
+		info.bmiHeader.biCompression = BI_RGB;
+
+		if( !(result = CreateDIBSection(NULL, &info, DIB_RGB_COLORS, &bits, NULL, 0)) ) {
+			__leave;
+		}
+
+		// have GDI+ decode right into the DIB's pixels.
+		area.X = 0;
+		area.Y = 0;
+		area.Width = width;
+		area.Height = height;
+		ZeroMemory(&pixels, sizeof(pixels));
+		pixels.Width = width;
+		pixels.Height = height;
+		pixels.Stride = width * 4;
+		pixels.PixelFormat = PIXEL_FORMAT_32BPP_PARGB;
+		pixels.Scan0 = bits;
+
+		if( GdipBitmapLockBits(image, &area, IMAGE_LOCK_MODE_READ | IMAGE_LOCK_MODE_USER_BUFFER, PIXEL_FORMAT_32BPP_PARGB, &pixels) != 0 ) {
+			DeleteObject(result);
+			result = NULL;
+			__leave;
+		}
+		GdipBitmapUnlockBits(image, &pixels);
+	} __finally {
+		if( image ) {
+			GdipDisposeImage(image);
+		}
+		if( stream ) {
+			stream->lpVtbl->Release(stream);
+		}
+	}
+	return result;
+}
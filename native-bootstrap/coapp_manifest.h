@@ -0,0 +1,369 @@
+//-----------------------------------------------------------------------
+// <copyright company="CoApp Project">
+//     Copyright (c) 2011 Garrett Serack . All rights reserved.
+// </copyright>
+// <license>
+//     The software is licensed under the Apache 2.0 License (the "License")
+//     You may not use the software except in compliance with the License.
+// </license>
+//-----------------------------------------------------------------------
+
+#pragma once
+
+// Artifact manifest: what the bootstrapper expects to find, and where.
+//
+// The manifest is UTF-8 text. The first line is the header, then one artifact per line:
+//
+//		CoAppBootstrapManifest 1
+//		<filename> <lcid> <size> <sha256> [<mirror> ...]
+//
+// fields are tab-separated. lcid 0 is the language-neutral file; any other lcid is the
+// localized variant, published as <name>.<lcid>.<ext>. mirrors are base urls the published
+// name gets appended to. blank lines and lines starting with # are skipped.
+//
+// It's embedded in the (signed) bootstrapper, so it's only ever as trustworthy as that is;
+// any line that doesn't parse throws the whole thing out.
+//
+// This part is plain C with no Windows dependencies, so it can be built and poked at anywhere.
+
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <wctype.h>
+
+#define MANIFEST_HEADER			"CoAppBootstrapManifest 1"
+#define MANIFEST_HASH_LENGTH	64
+#define MANIFEST_MAX_MIRRORS	4
+#define MANIFEST_MAX_FIELDS		(4 + MANIFEST_MAX_MIRRORS)
+
+typedef struct ManifestArtifact {
+	wchar_t* filename;			// the language-neutral name
+	wchar_t* publishedName;		// what it's called on a server (includes the lcid, for a localized file)
+	unsigned long lcid;
+	long long size;
+	wchar_t sha256[MANIFEST_HASH_LENGTH+1];
+	int mirrorCount;
+	wchar_t* mirrors[MANIFEST_MAX_MIRRORS];
+} ManifestArtifact;
+
+typedef struct ArtifactManifest {
+	int count;
+	ManifestArtifact* artifacts;
+} ArtifactManifest;
+
+// decodes UTF-8 into a new wide string (UTF-16 where wchar_t is 16 bits). NULL on bad input.
+wchar_t* ManifestDecode( const char* text, size_t length ) {
+	wchar_t* result;
+	wchar_t* out;
+	const unsigned char* p = (const unsigned char*)text;
+	const unsigned char* end = p + length;
+	unsigned long c;
+	int extra;
+
+	if( !(result = (wchar_t*)malloc((length+1) * sizeof(wchar_t))) ) {
+		return NULL;
+	}
+
+	for( out = result; p < end; ) {
+		c = *p++;
+		if( c < 0x80 ) {
+			extra = 0;
+		} else if( (c & 0xe0) == 0xc0 ) {
+			c &= 0x1f;
+			extra = 1;
+		} else if( (c & 0xf0) == 0xe0 ) {
+			c &= 0x0f;
+			extra = 2;
+		} else if( (c & 0xf8) == 0xf0 ) {
+			c &= 0x07;
+			extra = 3;
+		} else {
+			free(result);
+			return NULL;
+		}
+
+		for( ; extra > 0; extra-- ) {
+			if( p >= end || (*p & 0xc0) != 0x80 ) {
+				free(result);
+				return NULL;
+			}
+			c = (c << 6) | (*p++ & 0x3f);
+		}
+
+		if( c == 0 || c > 0x10ffff ) {
+			free(result);
+			return NULL;
+		}
+
+		if( c > 0xffff && sizeof(wchar_t) == 2 ) {
+			c -= 0x10000;
+			*out++ = (wchar_t)(0xd800 + (c >> 10));
+			*out++ = (wchar_t)(0xdc00 + (c & 0x3ff));
+		} else {
+			*out++ = (wchar_t)c;
+		}
+	}
+	*out = 0;
+	return result;
+}
+
+// parses an unsigned decimal number that takes up the whole field.
+int ManifestNumber( const char* text, size_t length, long long* value ) {
+	size_t i;
+
+	if( length == 0 || length > 18 ) {
+		return 0;
+	}
+	*value = 0;
+	for( i=0; i< length; i++ ) {
+		if( text[i] < '0' || text[i] > '9' ) {
+			return 0;
+		}
+		*value = *value * 10 + (text[i] - '0');
+	}
+	return 1;
+}
+
+int ManifestNameEquals( const wchar_t* a, const wchar_t* b ) {
+	for( ; *a && *b; a++, b++ ) {
+		if( towlower(*a) != towlower(*b) ) {
+			return 0;
+		}
+	}
+	return *a == *b;
+}
+
+// <name>.<lcid>.<ext> (or <name>.<lcid> when there's no extension)
+wchar_t* ManifestPublishedName( const wchar_t* filename, unsigned long lcid ) {
+	wchar_t digits[12];
+	wchar_t* result;
+	const wchar_t* dot;
+	size_t length = wcslen(filename);
+	size_t nameLength;
+	int count = 0;
+
+	if( lcid == 0 ) {
+		if( (result = (wchar_t*)malloc((length+1) * sizeof(wchar_t))) ) {
+			memcpy(result, filename, (length+1) * sizeof(wchar_t));
+		}
+		return result;
+	}
+
+	do {
+		digits[count++] = (wchar_t)(L'0' + lcid % 10);
+		lcid /= 10;
+	} while( lcid );
+
+	dot = wcsrchr(filename, L'.');
+	nameLength = dot ? (size_t)(dot - filename) : length;
+
+	if( !(result = (wchar_t*)malloc((length + count + 2) * sizeof(wchar_t))) ) {
+		return NULL;
+	}
+	memcpy(result, filename, nameLength * sizeof(wchar_t));
+	result[nameLength] = L'.';
+	for( length = nameLength+1; count > 0; length++ ) {
+		result[length] = digits[--count];
+	}
+	if( dot ) {
+		memcpy(result + length, dot, (wcslen(dot)+1) * sizeof(wchar_t));
+	} else {
+		result[length] = 0;
+	}
+	return result;
+}
+
+void FreeArtifactManifest( ArtifactManifest* manifest ) {
+	ManifestArtifact* artifact;
+	int i, j;
+
+	for( i=0; i< manifest->count; i++ ) {
+		artifact = &manifest->artifacts[i];
+		free(artifact->filename);
+		free(artifact->publishedName);
+		for( j=0; j< artifact->mirrorCount; j++ ) {
+			free(artifact->mirrors[j]);
+		}
+	}
+	free(manifest->artifacts);
+	manifest->artifacts = NULL;
+	manifest->count = 0;
+}
+
+// fills in one artifact from its fields. returns 0 if anything is off.
+int ParseManifestArtifact( ManifestArtifact* artifact, const char** field, const size_t* fieldLength, int fields ) {
+	long long value;
+	int i;
+
+	memset(artifact, 0, sizeof(ManifestArtifact));
+	if( fields < 4 || fieldLength[3] != MANIFEST_HASH_LENGTH ) {
+		return 0;
+	}
+
+	if( !ManifestNumber(field[1], fieldLength[1], &value) || value > (long long)0xffffffffUL ) {
+		return 0;
+	}
+	artifact->lcid = (unsigned long)value;
+
+	if( !ManifestNumber(field[2], fieldLength[2], &artifact->size) ) {
+		return 0;
+	}
+
+	for( i=0; i< MANIFEST_HASH_LENGTH; i++ ) {
+		if( !field[3][i] || !strchr("0123456789abcdefABCDEF", field[3][i]) ) {
+			return 0;
+		}
+		artifact->sha256[i] = (wchar_t)towlower((wchar_t)field[3][i]);
+	}
+	artifact->sha256[MANIFEST_HASH_LENGTH] = 0;
+
+	if( fieldLength[0] == 0 || !(artifact->filename = ManifestDecode(field[0], fieldLength[0])) ||
+		!(artifact->publishedName = ManifestPublishedName(artifact->filename, artifact->lcid)) ) {
+		return 0;
+	}
+
+	for( i=4; i< fields; i++ ) {
+		if( fieldLength[i] == 0 || !(artifact->mirrors[artifact->mirrorCount] = ManifestDecode(field[i], fieldLength[i])) ) {
+			return 0;
+		}
+		artifact->mirrorCount++;
+	}
+	return 1;
+}
+
+///
+/// <summary>
+///		parses a manifest (see the top of this file) into manifest, which the caller frees with FreeArtifactManifest.
+///		returns the number of artifacts, or -1 if it isn't a valid manifest (in which case there's nothing to free).
+/// </summary>
+int ParseArtifactManifest( const char* text, size_t size, ArtifactManifest* manifest ) {
+	const char* end = text + size;
+	const char* line;
+	const char* next;
+	const char* field[MANIFEST_MAX_FIELDS];
+	size_t fieldLength[MANIFEST_MAX_FIELDS];
+	size_t length;
+	size_t headerLength = strlen(MANIFEST_HEADER);
+	int lines = 0;
+	int fields;
+	int header = 1;
+	int bad = 0;
+
+	memset(manifest, 0, sizeof(ArtifactManifest));
+
+	// skip a UTF-8 BOM, if there is one.
+	if( size >= 3 && memcmp(text, "\xef\xbb\xbf", 3) == 0 ) {
+		text += 3;
+	}
+
+	for( line = text; line < end; line++ ) {
+		if( *line == '\n' ) {
+			lines++;
+		}
+	}
+	if( !(manifest->artifacts = (ManifestArtifact*)malloc((lines+1) * sizeof(ManifestArtifact))) ) {
+		return -1;
+	}
+
+	for( line = text; line < end; line = next ) {
+		for( next = line; next < end && *next != '\n'; next++ ) {
+		}
+		length = (size_t)(next - line);
+		if( next < end ) {
+			next++;
+		}
+		if( length && line[length-1] == '\r' ) {
+			length--;
+		}
+
+		if( header ) {
+			if( length != headerLength || memcmp(line, MANIFEST_HEADER, headerLength) ) {
+				break;
+			}
+			header = 0;
+			continue;
+		}
+
+		if( length == 0 || *line == '#' ) {
+			continue;
+		}
+
+		// split it on tabs.
+		for( fields = 0; ; ) {
+			if( fields == MANIFEST_MAX_FIELDS ) {
+				bad = 1;
+				break;
+			}
+			field[fields] = line;
+			while( length && *line != '\t' ) {
+				line++;
+				length--;
+			}
+			fieldLength[fields] = (size_t)(line - field[fields]);
+			fields++;
+			if( !length ) {
+				break;
+			}
+			line++;
+			length--;
+		}
+
+		if( bad ) {
+			break;
+		}
+		// counted either way, so that a half-built one gets freed too.
+		bad = !ParseManifestArtifact(&manifest->artifacts[manifest->count], field, fieldLength, fields);
+		manifest->count++;
+		if( bad ) {
+			break;
+		}
+	}
+
+	if( header || bad ) {
+		// no header, or something in it didn't parse.
+		FreeArtifactManifest(manifest);
+		return -1;
+	}
+	return manifest->count;
+}
+
+// finds an artifact by the name it's published under.
+const ManifestArtifact* FindManifestArtifact( const ArtifactManifest* manifest, const wchar_t* publishedName ) {
+	int i;
+
+	for( i=0; i< manifest->count; i++ ) {
+		if( ManifestNameEquals(manifest->artifacts[i].publishedName, publishedName) ) {
+			return &manifest->artifacts[i];
+		}
+	}
+	return NULL;
+}
+
+// finds a particular language variant of a file (lcid 0 for the neutral one).
+const ManifestArtifact* FindManifestVariant( const ArtifactManifest* manifest, const wchar_t* filename, unsigned long lcid ) {
+	int i;
+
+	for( i=0; i< manifest->count; i++ ) {
+		if( manifest->artifacts[i].lcid == lcid && ManifestNameEquals(manifest->artifacts[i].filename, filename) ) {
+			return &manifest->artifacts[i];
+		}
+	}
+	return NULL;
+}
+
+// does the manifest say anything at all about this file?
+int ManifestListsFile( const ArtifactManifest* manifest, const wchar_t* filename ) {
+	int i;
+
+	for( i=0; i< manifest->count; i++ ) {
+		if( ManifestNameEquals(manifest->artifacts[i].filename, filename) ) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// is this language variant worth looking for? only if the manifest lists it, or doesn't know about the file at all.
+int ManifestVariantAvailable( const ArtifactManifest* manifest, const wchar_t* filename, unsigned long lcid ) {
+	return !ManifestListsFile(manifest, filename) || FindManifestVariant(manifest, filename, lcid);
+}
@@ -0,0 +1,249 @@
+//-----------------------------------------------------------------------
+// <copyright company="CoApp Project">
+//     Copyright (c) 2011 Garrett Serack . All rights reserved.
+// </copyright>
+// <license>
+//     The software is licensed under the Apache 2.0 License (the "License")
+//     You may not use the software except in compliance with the License.
+// </license>
+//-----------------------------------------------------------------------
+
+#pragma once
+
+// Mirror health: how each download server has done in the past, kept between runs, so that
+// the race can give priority to the ones that are likely to finish first (see RankRemoteCandidates).
+//
+// For each server: how many times it's been used, how often that didn't get anywhere (no
+// connection, no response, cut off partway), how long it takes to answer, and how fast it
+// sends. The averages are weighted towards the recent, so they follow a server that gets
+// better or worse. They're kept in mirrors.txt in the bootstrap's data folder:
+//
+//		<attempts> <failure rate, per 1000> <response microseconds> <bytes per second> <last used> <server>
+//
+// tab-separated, one per line, in UTF-16.
+
+#define MIRROR_HEALTH_HEADER		L"CoAppBootstrapMirrors 1"
+#define MIRROR_HEALTH_FILENAME		L"mirrors.txt"
+#define MAX_MIRRORS					32
+#define MIRROR_WEIGHT				4			// a new sample counts for 1/MIRROR_WEIGHT of the average
+#define MIRROR_MINIMUM_SAMPLE		(64*1024)	// smaller downloads don't say much about throughput
+#define MIRROR_DEFAULT_RESPONSE		500000		// microseconds, for a server we don't know yet
+#define MIRROR_DEFAULT_THROUGHPUT	(256*1024)	// bytes per second, likewise
+#define MIRROR_FAILURE_PENALTY		12000000	// microseconds; what a failure costs (about one receive timeout)
+
+typedef struct MirrorHealth {
+	wchar_t* server;
+	int attempts;
+	int failureRate;				// per 1000
+	__int64 responseMicroseconds;	// 0 if we don't know yet
+	__int64 throughput;				// bytes per second; 0 if we don't know yet
+	__int64 lastUsed;
+} MirrorHealth;
+
+// the race threads all report in at once.
+CRITICAL_SECTION MirrorLock;
+BOOL MirrorsLoaded = FALSE;
+BOOL MirrorsChanged = FALSE;
+wchar_t* MirrorHealthFilename = NULL;
+MirrorHealth Mirrors[MAX_MIRRORS];
+int MirrorCount = 0;
+
+void InitializeMirrorHealth() {
+	InitializeCriticalSection(&MirrorLock);
+}
+
+// (the lock must be held)
+void LoadMirrorHealth() {
+	TableReader reader;
+	wchar_t* folder;
+	wchar_t* line;
+	wchar_t* cursor;
+	MirrorHealth* mirror;
+	ArenaMark mark;
+
+	if( MirrorsLoaded ) {
+		return;
+	}
+	MirrorsLoaded = TRUE;
+	mark = ArenaGetMark();
+
+	if( (folder = GetBootstrapDataFolder()) && (MirrorHealthFilename = _wcsdup(UrlOrPathCombine(folder, MIRROR_HEALTH_FILENAME, L'\\'))) &&
+		OpenTableReader(&reader, MirrorHealthFilename, MIRROR_HEALTH_HEADER, 64*1024) ) {
+		while( MirrorCount < MAX_MIRRORS && (line = NextTableLine(&reader)) ) {
+			cursor = line;
+			mirror = &Mirrors[MirrorCount];
+			mirror->attempts = _wtoi(SplitIndexField(&cursor));
+			mirror->failureRate = _wtoi(SplitIndexField(&cursor));
+			mirror->responseMicroseconds = _wtoi64(SplitIndexField(&cursor));
+			mirror->throughput = _wtoi64(SplitIndexField(&cursor));
+			mirror->lastUsed = _wtoi64(SplitIndexField(&cursor));
+			mirror->server = _wcsdup(SplitIndexField(&cursor));
+
+			if( IsNullOrEmpty(mirror->server) || mirror->failureRate < 0 || mirror->failureRate > 1000 ) {
+				free(mirror->server);
+				continue;
+			}
+			MirrorCount++;
+		}
+		CloseTableReader(&reader);
+	}
+	ArenaReset(mark);
+}
+
+///
+/// <summary>
+///		writes out what's changed since the last time. the race threads only update the list as 
+///		they go; AcquireFile saves it once, when it's done with a file.
+/// </summary>
+void SaveMirrorHealth() {
+	TableWriter writer;
+	MirrorHealth* mirror;
+	int i;
+	ArenaMark mark;
+
+	EnterCriticalSection(&MirrorLock);
+	__try {
+		if( !MirrorsChanged || MirrorHealthFilename == NULL ) {
+			__leave;
+		}
+		MirrorsChanged = FALSE;
+		mark = ArenaGetMark();
+
+		if( CreateTableWriter(&writer, MirrorHealthFilename, MIRROR_HEALTH_HEADER) ) {
+			for( i=0; i< MirrorCount; i++ ) {
+				mirror = &Mirrors[i];
+				WriteTableLine(&writer, L"%d\t%d\t%I64d\t%I64d\t%I64d\t%s", mirror->attempts, mirror->failureRate, mirror->responseMicroseconds, mirror->throughput, mirror->lastUsed, mirror->server);
+			}
+			CloseTableWriter(&writer);
+		}
+		ArenaReset(mark);
+	} __finally {
+		LeaveCriticalSection(&MirrorLock);
+	}
+}
+
+// where the server is in the list, or -1. with add set, a new one is added (over the least
+// recently used, if the list is full). (the lock must be held)
+int FindMirror( const wchar_t* server, BOOL add ) {
+	int oldest = 0;
+	int i;
+
+	for( i=0; i< MirrorCount; i++ ) {
+		if( lstrcmpi(Mirrors[i].server, server) == 0 ) {
+			return i;
+		}
+		if( Mirrors[i].lastUsed < Mirrors[oldest].lastUsed ) {
+			oldest = i;
+		}
+	}
+	if( !add ) {
+		return -1;
+	}
+
+	if( MirrorCount < MAX_MIRRORS ) {
+		i = MirrorCount;
+	} else {
+		i = oldest;
+		free(Mirrors[i].server);
+	}
+	ZeroMemory(&Mirrors[i], sizeof(MirrorHealth));
+	if( !(Mirrors[i].server = _wcsdup(server)) ) {
+		return -1;
+	}
+	if( i == MirrorCount ) {
+		MirrorCount++;
+	}
+	return i;
+}
+
+///
+/// <summary>
+///		how long a download of size bytes from the server should take, going by how it's done before
+///		(a failure counts as MIRROR_FAILURE_PENALTY). servers we haven't used get middling defaults.
+/// </summary>
+__int64 ExpectedCompletionMicroseconds( const wchar_t* server, __int64 size ) {
+	__int64 response = MIRROR_DEFAULT_RESPONSE;
+	__int64 throughput = MIRROR_DEFAULT_THROUGHPUT;
+	__int64 expected;
+	int failureRate = 0;
+	int index;
+
+	EnterCriticalSection(&MirrorLock);
+	__try {
+		LoadMirrorHealth();
+		if( (index = FindMirror(server, FALSE)) >= 0 ) {
+			failureRate = Mirrors[index].failureRate;
+			if( Mirrors[index].responseMicroseconds ) {
+				response = Mirrors[index].responseMicroseconds;
+			}
+			if( Mirrors[index].throughput ) {
+				throughput = Mirrors[index].throughput;
+			}
+		}
+	} __finally {
+		LeaveCriticalSection(&MirrorLock);
+	}
+
+	expected = response + (size > 0 ? size * 1000000 / throughput : 0);
+	return (expected * (1000 - failureRate) + (__int64)MIRROR_FAILURE_PENALTY * failureRate) / 1000;
+}
+
+// failures that are the server's (or the way to it's) fault, rather than the file's.
+BOOL IsMirrorFailure( int result ) {
+	switch( result ) {
+		case DOWNLOAD_FAIL_NO_CONNECTION:
+		case DOWNLOAD_FAIL_CANT_CONNECT:
+		case DOWNLOAD_FAIL_OPENING_REQUEST:
+		case DOWNLOAD_FAIL_SEND_REQUEST:
+		case DOWNLOAD_FAIL_NO_RESPONSE:
+		case DOWNLOAD_FAIL_NO_DATA_AVAILABLE:
+		case DOWNLOAD_FAIL_INCOMPLETE:
+			return TRUE;
+	}
+	return FALSE;
+}
+
+__int64 MirrorAverage( __int64 average, __int64 sample ) {
+	return average ? (average * (MIRROR_WEIGHT-1) + sample) / MIRROR_WEIGHT : sample;
+}
+
+///
+/// <summary>
+///		adds what happened to a download from the server to its record (SaveMirrorHealth writes it out).
+///		result is what DownloadFileEx returned; responseMicroseconds is how long the server took
+///		to answer (0 if it didn't), and microseconds is how long the whole thing took.
+///		a download that was called off says nothing about the server, past how quickly it answered.
+/// </summary>
+void RecordMirrorOutcome( const wchar_t* server, int result, __int64 responseMicroseconds, __int64 microseconds ) {
+	MirrorHealth* mirror;
+	BOOL failed = IsMirrorFailure(result);
+	int index;
+
+	if( IsNullOrEmpty(server) ) {
+		return;
+	}
+
+	EnterCriticalSection(&MirrorLock);
+	__try {
+		LoadMirrorHealth();
+		if( (index = FindMirror(server, TRUE)) < 0 ) {
+			__leave;
+		}
+		mirror = &Mirrors[index];
+		mirror->lastUsed = CurrentTimeInSeconds();
+
+		if( responseMicroseconds > 0 ) {
+			mirror->responseMicroseconds = MirrorAverage(mirror->responseMicroseconds, responseMicroseconds);
+		}
+		if( result != DOWNLOAD_FAIL_CANCELLED ) {
+			mirror->failureRate = mirror->attempts ? (mirror->failureRate * (MIRROR_WEIGHT-1) + (failed ? 1000 : 0)) / MIRROR_WEIGHT : (failed ? 1000 : 0);
+			mirror->attempts++;
+		}
+		if( result >= MIRROR_MINIMUM_SAMPLE && microseconds > responseMicroseconds ) {
+			mirror->throughput = MirrorAverage(mirror->throughput, (__int64)result * 1000000 / (microseconds - responseMicroseconds));
+		}
+		MirrorsChanged = TRUE;
+	} __finally {
+		LeaveCriticalSection(&MirrorLock);
+	}
+}
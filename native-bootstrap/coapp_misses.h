@@ -0,0 +1,278 @@
+//-----------------------------------------------------------------------
+// <copyright company="CoApp Project">
+//     Copyright (c) 2011 Garrett Serack . All rights reserved.
+// </copyright>
+// <license>
+//     The software is licensed under the Apache 2.0 License (the "License")
+//     You may not use the software except in compliance with the License.
+// </license>
+//-----------------------------------------------------------------------
+
+#pragma once
+
+// Negative lookup cache: the places AcquireFile has looked for a file and not found it, kept
+// between runs, so it doesn't go asking again. Most of what it looks for (the localized
+// variants, mostly) doesn't exist anywhere, and on a cold start those dead lookups -- a 404
+// off every server, for every file -- cost more than the real downloads.
+//
+// A miss is kept against a validator for the place it was looked for, and is forgotten as soon
+// as that changes, or after BootstrapMissCacheHours (MISS_DEFAULT_HOURS if that isn't set; 0
+// turns the whole thing off):
+//
+//		a folder		when it was last written to (which is whenever a file is added or renamed)
+//		the MSI			its size and when it was last written to
+//		a server		the ETag (or Last-Modified) the download cache has for the language-neutral
+//						file off the same server, so a new release there takes its misses with it
+//
+// A server miss needs a validator: without one, there'd be no telling when a new release had
+// put the file there, so it isn't kept at all.
+//
+// They're kept in misses.txt in the bootstrap's data folder (written once per AcquireFile):
+//
+//		<recorded> <validator> <name> <location>
+//
+// tab-separated, one per line, in UTF-16.
+
+#define MISS_CACHE_HEADER		L"CoAppBootstrapMisses 1"
+#define MISS_CACHE_FILENAME		L"misses.txt"
+#define MAX_MISSES				128
+#define MISS_DEFAULT_HOURS		24
+
+typedef struct KnownMiss {
+	__int64 recorded;
+	wchar_t* validator;
+	wchar_t* name;
+	wchar_t* location;
+} KnownMiss;
+
+// the race threads record their 404s while AcquireFile is looking things up.
+CRITICAL_SECTION MissLock;
+BOOL MissesLoaded = FALSE;
+BOOL MissesChanged = FALSE;
+wchar_t* MissCacheFilename = NULL;
+__int64 MissLifetime = MISS_DEFAULT_HOURS*60*60;
+KnownMiss Misses[MAX_MISSES];
+int MissCount = 0;
+
+void InitializeMisses() {
+	InitializeCriticalSection(&MissLock);
+}
+
+void FreeKnownMiss( KnownMiss* miss ) {
+	free(miss->validator);
+	free(miss->name);
+	free(miss->location);
+	ZeroMemory(miss, sizeof(KnownMiss));
+}
+
+void RemoveKnownMiss( int index ) {
+	FreeKnownMiss(&Misses[index]);
+	Misses[index] = Misses[--MissCount];
+	ZeroMemory(&Misses[MissCount], sizeof(KnownMiss));
+}
+
+// (the lock must be held)
+void LoadMisses() {
+	TableReader reader;
+	wchar_t* folder;
+	wchar_t* line;
+	wchar_t* cursor;
+	KnownMiss* miss;
+	DWORD* hours;
+	ArenaMark mark;
+
+	if( MissesLoaded ) {
+		return;
+	}
+	MissesLoaded = TRUE;
+	mark = ArenaGetMark();
+
+	__try {
+		if( (hours = (DWORD*)GetRegistryValue(L"Software\\CoApp", L"BootstrapMissCacheHours", REG_DWORD)) ) {
+			MissLifetime = ((__int64)*hours)*60*60;
+		}
+		if( MissLifetime == 0 ) {
+			__leave;	// turned off; nothing gets looked up or saved.
+		}
+
+		if( !(folder = GetBootstrapDataFolder()) || !(MissCacheFilename = _wcsdup(UrlOrPathCombine(folder, MISS_CACHE_FILENAME, L'\\'))) ) {
+			__leave;
+		}
+		if( !OpenTableReader(&reader, MissCacheFilename, MISS_CACHE_HEADER, 256*1024) ) {
+			__leave;
+		}
+		while( MissCount < MAX_MISSES && (line = NextTableLine(&reader)) ) {
+			cursor = line;
+			miss = &Misses[MissCount];
+			miss->recorded = _wtoi64(SplitIndexField(&cursor));
+			miss->validator = _wcsdup(SplitIndexField(&cursor));
+			miss->name = _wcsdup(SplitIndexField(&cursor));
+			miss->location = _wcsdup(SplitIndexField(&cursor));
+
+			if( !miss->validator || IsNullOrEmpty(miss->name) || IsNullOrEmpty(miss->location) ) {
+				FreeKnownMiss(miss);
+				continue;
+			}
+			MissCount++;
+		}
+		CloseTableReader(&reader);
+	} __finally {
+		ArenaReset(mark);
+	}
+}
+
+///
+/// <summary>
+///		writes out the misses, if any have come or gone since the last time. lookups only change
+///		the list; AcquireFile saves it once, when it's done with a file.
+/// </summary>
+void SaveMisses() {
+	TableWriter writer;
+	KnownMiss* miss;
+	int i;
+	ArenaMark mark;
+
+	EnterCriticalSection(&MissLock);
+	__try {
+		if( !MissesChanged || MissCacheFilename == NULL ) {
+			__leave;
+		}
+		MissesChanged = FALSE;
+		mark = ArenaGetMark();
+
+		if( CreateTableWriter(&writer, MissCacheFilename, MISS_CACHE_HEADER) ) {
+			for( i=0; i< MissCount; i++ ) {
+				miss = &Misses[i];
+				WriteTableLine(&writer, L"%I64d\t%s\t%s\t%s", miss->recorded, miss->validator, miss->name, miss->location);
+			}
+			CloseTableWriter(&writer);
+		}
+		ArenaReset(mark);
+	} __finally {
+		LeaveCriticalSection(&MissLock);
+	}
+}
+
+// (the lock must be held)
+int FindKnownMiss( const wchar_t* location, const wchar_t* name ) {
+	int i;
+
+	for( i=0; i< MissCount; i++ ) {
+		if( lstrcmpi(Misses[i].name, name) == 0 && lstrcmpi(Misses[i].location, location) == 0 ) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+///
+/// <summary>
+///		TRUE if name was looked for at location before, and wasn't there -- as long as that was
+///		recently enough, and the location's validator hasn't changed since. a miss that's gone
+///		stale is dropped.
+/// </summary>
+BOOL IsKnownMissing( const wchar_t* location, const wchar_t* name, const wchar_t* validator ) {
+	BOOL result = FALSE;
+	int index;
+
+	if( IsNullOrEmpty(location) || IsNullOrEmpty(name) ) {
+		return FALSE;
+	}
+
+	EnterCriticalSection(&MissLock);
+	__try {
+		LoadMisses();
+		if( (index = FindKnownMiss(location, name)) < 0 ) {
+			__leave;
+		}
+		if( CurrentTimeInSeconds() - Misses[index].recorded > MissLifetime || lstrcmp(Misses[index].validator, validator ? validator : L"") ) {
+			TraceVerbose(L"Forgetting that %s wasn't at %s", name, location);
+			RemoveKnownMiss(index);
+			MissesChanged = TRUE;
+			__leave;
+		}
+		result = TRUE;
+	} __finally {
+		LeaveCriticalSection(&MissLock);
+	}
+	return result;
+}
+
+///
+/// <summary>
+///		remembers that name isn't at location (while the location's validator stays the same).
+///		the oldest miss makes room, if there are already MAX_MISSES of them.
+/// </summary>
+void RecordMissing( const wchar_t* location, const wchar_t* name, const wchar_t* validator ) {
+	KnownMiss* miss;
+	int oldest = 0;
+	int index;
+	int i;
+
+	if( IsNullOrEmpty(location) || IsNullOrEmpty(name) ) {
+		return;
+	}
+
+	EnterCriticalSection(&MissLock);
+	__try {
+		LoadMisses();
+		if( MissCacheFilename == NULL ) {
+			__leave;
+		}
+
+		if( (index = FindKnownMiss(location, name)) >= 0 ) {
+			FreeKnownMiss(&Misses[index]);
+		} else if( MissCount < MAX_MISSES ) {
+			index = MissCount++;
+		} else {
+			for( i=1; i< MissCount; i++ ) {
+				if( Misses[i].recorded < Misses[oldest].recorded ) {
+					oldest = i;
+				}
+			}
+			FreeKnownMiss(&Misses[index = oldest]);
+		}
+
+		miss = &Misses[index];
+		miss->recorded = CurrentTimeInSeconds();
+		miss->validator = _wcsdup(validator ? validator : L"");
+		miss->name = _wcsdup(name);
+		miss->location = _wcsdup(location);
+		if( !miss->validator || !miss->name || !miss->location ) {
+			RemoveKnownMiss(index);
+			__leave;
+		}
+		MissesChanged = TRUE;
+	} __finally {
+		LeaveCriticalSection(&MissLock);
+	}
+}
+
+///
+/// <summary>
+///		the validator for a folder or a file on the box: its size and when it was last written to.
+///		empty if it isn't there.
+/// </summary>
+wchar_t* LocalMissValidator( const wchar_t* path ) {
+	WIN32_FILE_ATTRIBUTE_DATA fileData;
+
+	if( IsNullOrEmpty(path) || !GetFileAttributesEx(path, GetFileExInfoStandard, &fileData) ) {
+		return NewStringOfLength(0);
+	}
+	return Sprintf(L"%I64d:%I64d", ((__int64)fileData.nFileSizeHigh << 32) | fileData.nFileSizeLow, ((__int64)fileData.ftLastWriteTime.dwHighDateTime << 32) | fileData.ftLastWriteTime.dwLowDateTime);
+}
+
+///
+/// <summary>
+///		the validator for a server: the ETag (or Last-Modified) of the language-neutral file off it,
+///		if the download cache has it. empty if it doesn't.
+/// </summary>
+wchar_t* RemoteMissValidator( const wchar_t* server, const wchar_t* neutralFilename ) {
+	wchar_t etag[MAX_VALIDATOR_LENGTH];
+	wchar_t lastModified[MAX_VALIDATOR_LENGTH];
+
+	if( IsNullOrEmpty(server) || !CacheGetValidators(UrlOrPathCombine(server, neutralFilename, L'/'), etag, lastModified) ) {
+		return NewStringOfLength(0);
+	}
+	return DuplicateString(*etag ? etag : lastModified);
+}
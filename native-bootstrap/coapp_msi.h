@@ -0,0 +1,321 @@
+//-----------------------------------------------------------------------
+// <copyright company="CoApp Project">
+//     Copyright (c) 2011 Garrett Serack . All rights reserved.
+// </copyright>
+// <license>
+//     The software is licensed under the Apache 2.0 License (the "License")
+//     You may not use the software except in compliance with the License.
+// </license>
+//-----------------------------------------------------------------------
+
+#pragma once
+
+// The MSI we were started with, opened once for the life of the process.
+//
+// When it's opened, the names in the Binary table are read into a hash table, so asking
+// for something that isn't there never touches MSI at all. Extraction goes through a
+// single prepared (parameterized) view.
+//
+// MSI handles aren't meant to be shared between threads without some care, so all of
+// it happens under MsiSessionLock.
+
+#define MSI_INDEX_BUCKETS		64
+#define MSI_EXTRACT_CHUNK_SIZE	(256*1024)
+
+typedef struct MsiBinaryName {
+	struct MsiBinaryName* next;
+	DWORD hash;
+	wchar_t* name;
+} MsiBinaryName;
+
+CRITICAL_SECTION MsiSessionLock;
+wchar_t* MsiSessionFilename = NULL;			// what's open (or what we tried to open, if that failed)
+MSIHANDLE MsiSessionDatabase = 0;
+MSIHANDLE MsiSessionView = 0;				// SELECT `Data` FROM `Binary` WHERE `Name`=?
+MsiBinaryName* MsiBinaryIndex[MSI_INDEX_BUCKETS];
+int MsiBinaryCount = 0;
+BOOL MsiBinaryIndexComplete = FALSE;		// every name in the Binary table made it into the index
+
+void InitializeMsiSession() {
+	InitializeCriticalSection(&MsiSessionLock);
+}
+
+// FNV-1a
+DWORD HashBinaryName( const wchar_t* name ) {
+	DWORD hash = 2166136261U;
+
+	for( ; *name; name++ ) {
+		hash = (hash ^ *name) * 16777619U;
+	}
+	return hash;
+}
+
+// called with MsiSessionLock held.
+BOOL IsBinaryInMsi( const wchar_t* name ) {
+	MsiBinaryName* entry;
+	DWORD hash = HashBinaryName(name);
+
+	for( entry = MsiBinaryIndex[hash % MSI_INDEX_BUCKETS]; entry; entry = entry->next ) {
+		if( entry->hash == hash && wcscmp(entry->name, name) == 0 ) {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+// called with MsiSessionLock held.
+BOOL IndexBinaryName( const wchar_t* name ) {
+	MsiBinaryName* entry;
+
+	if( !(entry = (MsiBinaryName*)malloc(sizeof(MsiBinaryName))) ) {
+		return FALSE;
+	}
+	if( !(entry->name = _wcsdup(name)) ) {
+		free(entry);
+		return FALSE;
+	}
+	entry->hash = HashBinaryName(name);
+	entry->next = MsiBinaryIndex[entry->hash % MSI_INDEX_BUCKETS];
+	MsiBinaryIndex[entry->hash % MSI_INDEX_BUCKETS] = entry;
+	MsiBinaryCount++;
+	return TRUE;
+}
+
+// called with MsiSessionLock held.
+void CloseMsiSessionLocked() {
+	MsiBinaryName* entry;
+	MsiBinaryName* next;
+	int i;
+
+	for( i=0; i< MSI_INDEX_BUCKETS; i++ ) {
+		for( entry = MsiBinaryIndex[i]; entry; entry = next ) {
+			next = entry->next;
+			free(entry->name);
+			free(entry);
+		}
+		MsiBinaryIndex[i] = NULL;
+	}
+	MsiBinaryCount = 0;
+	MsiBinaryIndexComplete = FALSE;
+
+	if( MsiSessionView ) {
+		MsiCloseHandle(MsiSessionView);
+		MsiSessionView = 0;
+	}
+	if( MsiSessionDatabase ) {
+		MsiCloseHandle(MsiSessionDatabase);
+		MsiSessionDatabase = 0;
+	}
+	free(MsiSessionFilename);
+	MsiSessionFilename = NULL;
+}
+
+///
+/// <summary>
+///		lets go of the MSI (say, before handing it to something else).
+///		it's opened again if anything else needs to come out of it.
+/// </summary>
+void CloseMsiSession() {
+	EnterCriticalSection(&MsiSessionLock);
+	CloseMsiSessionLocked();
+	LeaveCriticalSection(&MsiSessionLock);
+}
+
+// opens the MSI and indexes the Binary table, unless that's been done already. an index that
+// isn't complete would say things aren't in there when they are, so if the table can't be read
+// all the way through, the session isn't usable. called with MsiSessionLock held.
+BOOL OpenMsiSession( const wchar_t* msiFilename ) {
+	MSIHANDLE view = 0;
+	MSIHANDLE record = 0;
+	wchar_t name[BUFSIZE];
+	DWORD size;
+	UINT fetched;
+	BOOL indexed = TRUE;
+
+	if( MsiSessionFilename && lstrcmpi(MsiSessionFilename, msiFilename) == 0 ) {
+		// already open (or already known not to be worth opening)
+		return MsiSessionView != 0;
+	}
+
+	CloseMsiSessionLocked();
+	MsiSessionFilename = _wcsdup(msiFilename);
+
+	if( ERROR_SUCCESS != MsiOpenDatabase(msiFilename, MSIDBOPEN_READONLY, &MsiSessionDatabase) ) {
+		MsiSessionDatabase = 0;
+		return FALSE;
+	}
+
+	__try {
+		if( ERROR_SUCCESS != MsiDatabaseOpenView(MsiSessionDatabase, L"SELECT `Name` FROM `Binary`", &view) || ERROR_SUCCESS != MsiViewExecute(view, 0) ) {
+			__leave;
+		}
+		while( indexed && ERROR_SUCCESS == (fetched = MsiViewFetch(view, &record)) ) {
+			size = BUFSIZE;
+			indexed = ERROR_SUCCESS == MsiRecordGetString(record, 1, name, &size) && IndexBinaryName(name);
+			MsiCloseHandle(record);
+			record = 0;
+		}
+		if( !indexed || fetched != ERROR_NO_MORE_ITEMS ) {
+			TraceError(L"Couldn't read the Binary table in %s", msiFilename);
+			__leave;
+		}
+		MsiBinaryIndexComplete = TRUE;
+
+		if( ERROR_SUCCESS != MsiDatabaseOpenView(MsiSessionDatabase, L"SELECT `Data` FROM `Binary` WHERE `Name`=?", &MsiSessionView) ) {
+			MsiSessionView = 0;
+			__leave;
+		}
+		TraceInfo(L"Indexed %d binaries in %s", MsiBinaryCount, msiFilename);
+	} __finally {
+		if( view ) {
+			MsiCloseHandle(view);
+		}
+	}
+	return MsiSessionView != 0;
+}
+
+///
+/// <summary>
+///		unpacks a file from the MSI's Binary table into the temp folder.
+///		it's copied a chunk at a time (some of these are big -- the .NET installer can be in there),
+///		and hashed on the way; sha256 (optional) gets the hash if it worked.
+///		returns the filename, or NULL if it isn't there.
+/// </summary>
+wchar_t* ExtractFileFromMSI( const wchar_t* msiFilename, const wchar_t* binaryFile, wchar_t* sha256 ) {
+	MSIHANDLE parameters = 0;
+	MSIHANDLE record = 0;
+	BOOL executed = FALSE;
+	DWORD streamSize = 0;
+	DWORD bytesRead = 0;
+	DWORD bytesWritten = 0;
+	DWORD totalBytes = 0;
+	char* byteBuffer = NULL;
+	HANDLE localFile = INVALID_HANDLE_VALUE;
+	LARGE_INTEGER fileSize;
+	HashContext hash;
+	BOOL hashing = FALSE;
+	BOOL complete = FALSE;
+	LARGE_INTEGER started;
+
+	wchar_t* result = NULL;
+
+	if( sha256 ) {
+		*sha256 = 0;
+	}
+
+	if( IsNullOrEmpty(msiFilename) || IsNullOrEmpty(binaryFile) ) {
+		return NULL;
+	}
+
+	ZeroMemory(&hash, sizeof(hash));
+	QueryPerformanceCounter(&started);
+
+	EnterCriticalSection(&MsiSessionLock);
+	__try {
+		if( !OpenMsiSession(msiFilename) || !IsBinaryInMsi(binaryFile) ) {
+			__leave;
+		}
+
+		if( !(parameters = MsiCreateRecord(1)) || ERROR_SUCCESS != MsiRecordSetString(parameters, 1, binaryFile) ) {
+			__leave;
+		}
+		if( ERROR_SUCCESS != MsiViewExecute(MsiSessionView, parameters) ) {
+			__leave;
+		}
+		executed = TRUE;
+		if( ERROR_SUCCESS != MsiViewFetch(MsiSessionView, &record) ) {
+			__leave;
+		}
+
+		if( (streamSize = MsiRecordDataSize(record, 1)) == 0 ) {
+			__leave;
+		}
+
+		if( !(byteBuffer = (char*)malloc(MSI_EXTRACT_CHUNK_SIZE)) ) {
+			__leave;
+		}
+
+		result = TempFileName(binaryFile);
+		if( INVALID_HANDLE_VALUE == (localFile = CreateFile(result, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,  FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,NULL))) {
+			DeleteString(&result);
+			__leave;
+		}
+
+		// make room for the whole thing up front, so it doesn't get extended a chunk at a time.
+		fileSize.QuadPart = streamSize;
+		if( SetFilePointerEx(localFile, fileSize, NULL, FILE_BEGIN) && SetEndOfFile(localFile) ) {
+			fileSize.QuadPart = 0;
+			SetFilePointerEx(localFile, fileSize, NULL, FILE_BEGIN);
+		}
+
+		hashing = sha256 && BeginHash(&hash);
+
+		// copy it over a chunk at a time.
+		while( totalBytes < streamSize ) {
+			bytesRead = MSI_EXTRACT_CHUNK_SIZE;
+			if( ERROR_SUCCESS != MsiRecordReadStream(record, 1, byteBuffer, &bytesRead) || bytesRead == 0 ) {
+				__leave;
+			}
+
+			if( !WriteFile( localFile, byteBuffer, bytesRead, &bytesWritten, NULL ) || bytesWritten != bytesRead ) {
+				__leave;
+			}
+
+			if( hashing && !UpdateHash(&hash, byteBuffer, bytesRead) ) {
+				AbandonHash(&hash);
+				hashing = FALSE;
+			}
+			totalBytes += bytesRead;
+		}
+
+		if( hashing ) {
+			FinishHash(&hash, sha256);
+		}
+		complete = TRUE;
+	} __finally {
+		AbandonHash(&hash);
+
+		if( localFile != INVALID_HANDLE_VALUE ) {
+			CloseHandle( localFile );
+			if( !complete ) {
+				// don't leave half a file lying around for someone to pick up.
+				DeleteFile(result);
+				DeleteString(&result);
+			}
+		}
+
+		if ( record )
+			MsiCloseHandle(record);
+		if ( executed )
+			MsiViewClose(MsiSessionView);	// so it can be executed again
+		if ( parameters )
+			MsiCloseHandle(parameters);
+
+		LeaveCriticalSection(&MsiSessionLock);
+
+		if( byteBuffer ) {
+			free( (void*) byteBuffer );
+		}
+	}
+	EndPhase(PHASE_EXTRACT, &started, complete ? totalBytes : 0);
+    return result;
+}
+
+///
+/// <summary>
+///		TRUE if the MSI opened, its whole Binary table was indexed, and there's nothing by that
+///		name in it (as opposed to ExtractFileFromMSI not getting it out for some other reason).
+///		anything short of that isn't proof it's missing, and mustn't end up in the miss cache.
+/// </summary>
+BOOL IsFileMissingFromMSI( const wchar_t* msiFilename, const wchar_t* binaryFile ) {
+	BOOL result;
+
+	if( IsNullOrEmpty(msiFilename) || IsNullOrEmpty(binaryFile) ) {
+		return FALSE;
+	}
+
+	EnterCriticalSection(&MsiSessionLock);
+	result = OpenMsiSession(msiFilename) && MsiBinaryIndexComplete && !IsBinaryInMsi(binaryFile);
+	LeaveCriticalSection(&MsiSessionLock);
+	return result;
+}
@@ -0,0 +1,99 @@
+//-----------------------------------------------------------------------
+// <copyright company="CoApp Project">
+//     Copyright (c) 2011 Garrett Serack . All rights reserved.
+// </copyright>
+// <license>
+//     The software is licensed under the Apache 2.0 License (the "License")
+//     You may not use the software except in compliance with the License.
+// </license>
+//-----------------------------------------------------------------------
+
+#pragma once
+
+// Putting together and taking apart paths, urls and filenames. It's all arena strings (see
+// coapp_string.h) and nothing else, so it builds anywhere coapp_platform.h does.
+
+///
+/// <summary> 
+///		combines a path and a filename
+/// </summary>
+ wchar_t* UrlOrPathCombine(const wchar_t* path, const wchar_t* name, wchar_t seperator) {
+	if( IsNullOrEmpty(path) && IsNullOrEmpty(name) ) {
+		 return DuplicateString(L"");
+	}
+
+	if( IsNullOrEmpty(path) ){
+		 return DuplicateString(name);
+	}
+
+	if( IsNullOrEmpty(name) ){
+		 return DuplicateString(path);
+	}
+
+	if( path[wcslen( path )-1] == seperator  ) {
+		return Sprintf( L"%s%s" , path, name );
+	}
+	return Sprintf(L"%s%c%s" , path, seperator, name );
+}
+
+// given a path, returns the folder that contains it.
+wchar_t* GetFolderFromPath( const wchar_t* path ) {
+	wchar_t* result = DuplicateString(path);
+	wchar_t* position = NULL;
+	int length= wcslen(result);
+
+	position = result+length;
+	while( position >= result && position[0] != L'\\')
+		position--;
+	position[1] = 0;
+
+	return result;
+}
+
+const wchar_t* GetFilenameFromPath( const wchar_t* path ) {
+	const wchar_t* position = NULL;
+	int length= wcslen(path);
+
+	position = path+length;
+	while( position >= path && position[0] != L'\\')
+		position--;
+
+	return position+1;
+}
+
+wchar_t* GetExtension(const wchar_t* filename) {
+	int i;
+	
+	for(i=SafeStringLengthInCharacters(filename);i>=0;i--) {
+		if( filename[i] == '.' ) {
+			return DuplicateString(filename+i+1);
+		}
+	}
+
+	return NULL;
+}
+
+wchar_t* GetFilenameWithoutExtension(const wchar_t* filename) {
+	wchar_t* result;
+	int i;
+	
+	result = DuplicateString(filename);
+	for(i=SafeStringLengthInCharacters(result);i>=0;i--) {
+		if( result[i] == '.' ) {
+			result[i] =0;
+			break;
+		}
+	}
+	return result;
+}
+
+// <name>.<lcid>.<ext>: what a localized file is published as.
+wchar_t* LocalizedFilename( const wchar_t* filename, DWORD lcid ) {
+	wchar_t* name = GetFilenameWithoutExtension(filename);
+	wchar_t* extension = GetExtension(filename);
+	wchar_t* result = Sprintf(L"%s.%d.%s", name, lcid, extension);
+
+	DeleteString(&extension);
+	DeleteString(&name);
+	return result;
+}
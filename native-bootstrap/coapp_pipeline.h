@@ -0,0 +1,208 @@
+//-----------------------------------------------------------------------
+// <copyright company="CoApp Project">
+//     Copyright (c) 2011 Garrett Serack . All rights reserved.
+// </copyright>
+// <license>
+//     The software is licensed under the Apache 2.0 License (the "License")
+//     You may not use the software except in compliance with the License.
+// </license>
+//-----------------------------------------------------------------------
+
+#pragma once
+
+// Write pipeline: a handful of buffers that take turns being filled from the network
+// while the ones before them are written out with overlapped I/O, so a slow disk
+// (or a network share) doesn't hold up the next read.
+//
+// The file must be opened with FILE_FLAG_OVERLAPPED. The amount read into each buffer
+// grows while the network keeps up, and shrinks when it doesn't, so that a buffer
+// always holds roughly PIPELINE_TARGET_MILLISECONDS worth of data.
+//
+// Buffers are only allocated when they're first needed, and only as big as the reads going
+// into them (which never go past what's left of the file, when that's known): a small file
+// gets one small buffer, not PIPELINE_BUFFERS of the biggest size.
+
+#define PIPELINE_BUFFERS				3
+#define PIPELINE_MINIMUM_READ			(64*1024)
+#define PIPELINE_MAXIMUM_READ			(1024*1024)
+#define PIPELINE_SMALLEST_READ			(4*1024)	// for what's left of a file
+#define PIPELINE_TARGET_MILLISECONDS	250
+
+typedef struct PipelineBuffer {
+	OVERLAPPED overlapped;
+	BYTE* data;
+	DWORD capacity;
+	DWORD length;
+	BOOL pending;
+} PipelineBuffer;
+
+typedef struct WritePipeline {
+	HANDLE file;
+	__int64 offset;		// where the next buffer goes in the file
+	DWORD readSize;		// how much to try and put in the next buffer
+	DWORD largestRead;	// PIPELINE_MAXIMUM_READ, or less if the file's smaller than that
+	int next;
+	BOOL failed;
+	PipelineBuffer buffers[PIPELINE_BUFFERS];
+} WritePipeline;
+
+///
+/// <summary>
+///		writes a block at the given position, and waits for it to finish.
+///		works for files opened with or without FILE_FLAG_OVERLAPPED; event may be NULL for the latter.
+/// </summary>
+BOOL WriteFileAt( HANDLE file, const void* data, DWORD length, __int64 offset, HANDLE event ) {
+	OVERLAPPED overlapped;
+	DWORD bytesWritten = 0;
+
+	ZeroMemory(&overlapped, sizeof(overlapped));
+	overlapped.Offset = (DWORD)offset;
+	overlapped.OffsetHigh = (DWORD)(offset >> 32);
+	overlapped.hEvent = event;
+
+	if( !WriteFile(file, data, length, &bytesWritten, &overlapped) ) {
+		if( GetLastError() != ERROR_IO_PENDING || !GetOverlappedResult(file, &overlapped, &bytesWritten, TRUE) ) {
+			return FALSE;
+		}
+	}
+	return bytesWritten == length;
+}
+
+BOOL FinishPipelineWrite( WritePipeline* pipeline, PipelineBuffer* buffer ) {
+	DWORD bytesWritten = 0;
+
+	if( !buffer->pending ) {
+		return TRUE;
+	}
+	buffer->pending = FALSE;
+
+	if( !GetOverlappedResult(pipeline->file, &buffer->overlapped, &bytesWritten, TRUE) || bytesWritten != buffer->length ) {
+		pipeline->failed = TRUE;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+///
+/// <summary>
+///		waits for every outstanding write to land.
+///		returns FALSE if any of them didn't make it to disk in full.
+/// </summary>
+BOOL FlushWritePipeline( WritePipeline* pipeline ) {
+	int i;
+
+	for( i=0; i< PIPELINE_BUFFERS; i++ ) {
+		FinishPipelineWrite(pipeline, &pipeline->buffers[i]);
+	}
+	return !pipeline->failed;
+}
+
+void CloseWritePipeline( WritePipeline* pipeline ) {
+	int i;
+
+	// the buffers can't go away while the system is still writing from them.
+	FlushWritePipeline(pipeline);
+
+	for( i=0; i< PIPELINE_BUFFERS; i++ ) {
+		if( pipeline->buffers[i].overlapped.hEvent ) {
+			CloseHandle(pipeline->buffers[i].overlapped.hEvent);
+		}
+		if( pipeline->buffers[i].data ) {
+			free(pipeline->buffers[i].data);
+		}
+	}
+	ZeroMemory(pipeline, sizeof(WritePipeline));
+}
+
+///
+/// <summary>
+///		sets up a pipeline to write to the file from the given offset on.
+///		remaining is how much more there is to come, or -1 if that isn't known.
+///		nothing's allocated yet; that waits for the first buffer.
+/// </summary>
+void OpenWritePipeline( WritePipeline* pipeline, HANDLE file, __int64 offset, __int64 remaining ) {
+	ZeroMemory(pipeline, sizeof(WritePipeline));
+	pipeline->file = file;
+	pipeline->offset = offset;
+	pipeline->largestRead = PIPELINE_MAXIMUM_READ;
+
+	if( remaining >= 0 && remaining < PIPELINE_MAXIMUM_READ ) {
+		pipeline->largestRead = remaining > PIPELINE_SMALLEST_READ ? (DWORD)remaining : PIPELINE_SMALLEST_READ;
+	}
+	pipeline->readSize = min(PIPELINE_MINIMUM_READ, pipeline->largestRead);
+}
+
+///
+/// <summary>
+///		hands back the next buffer to fill, once whatever was last written from it is on disk,
+///		with room for at least readSize bytes.
+///		returns NULL if an earlier write failed, or there isn't the memory for it.
+/// </summary>
+PipelineBuffer* NextPipelineBuffer( WritePipeline* pipeline ) {
+	PipelineBuffer* buffer = &pipeline->buffers[pipeline->next];
+
+	if( pipeline->failed || !FinishPipelineWrite(pipeline, buffer) ) {
+		return NULL;
+	}
+
+	if( !buffer->overlapped.hEvent && !(buffer->overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL)) ) {
+		return NULL;
+	}
+	if( buffer->capacity < pipeline->readSize ) {
+		// nothing in it needs keeping.
+		free(buffer->data);
+		buffer->capacity = 0;
+		if( !(buffer->data = (BYTE*)malloc(pipeline->readSize)) ) {
+			return NULL;
+		}
+		buffer->capacity = pipeline->readSize;
+	}
+	buffer->length = 0;
+	return buffer;
+}
+
+///
+/// <summary>
+///		starts writing a filled buffer out at the end of what's been queued so far,
+///		and adjusts the size of the next read by how long this one took to fill.
+/// </summary>
+BOOL QueuePipelineWrite( WritePipeline* pipeline, PipelineBuffer* buffer, DWORD fillMilliseconds ) {
+	DWORD bytesWritten = 0;
+	HANDLE event = buffer->overlapped.hEvent;
+
+	if( !buffer->length ) {
+		return TRUE;
+	}
+
+	ZeroMemory(&buffer->overlapped, sizeof(OVERLAPPED));
+	buffer->overlapped.hEvent = event;
+	buffer->overlapped.Offset = (DWORD)pipeline->offset;
+	buffer->overlapped.OffsetHigh = (DWORD)(pipeline->offset >> 32);
+	ResetEvent(buffer->overlapped.hEvent);
+
+	if( WriteFile(pipeline->file, buffer->data, buffer->length, &bytesWritten, &buffer->overlapped) ) {
+		// done already (cached, or small enough to go synchronously)
+		if( bytesWritten != buffer->length ) {
+			pipeline->failed = TRUE;
+			return FALSE;
+		}
+	} else if( GetLastError() == ERROR_IO_PENDING ) {
+		buffer->pending = TRUE;
+	} else {
+		pipeline->failed = TRUE;
+		return FALSE;
+	}
+
+	pipeline->offset += buffer->length;
+	pipeline->next = (pipeline->next + 1) % PIPELINE_BUFFERS;
+
+	// only a full buffer says anything about how fast the data is coming in.
+	if( buffer->length == pipeline->readSize ) {
+		if( fillMilliseconds < PIPELINE_TARGET_MILLISECONDS/2 && pipeline->readSize < pipeline->largestRead ) {
+			pipeline->readSize = min(pipeline->readSize*2, pipeline->largestRead);
+		} else if( fillMilliseconds > PIPELINE_TARGET_MILLISECONDS*2 && pipeline->readSize > PIPELINE_MINIMUM_READ ) {
+			pipeline->readSize /= 2;
+		}
+	}
+	return TRUE;
+}
@@ -0,0 +1,156 @@
+//-----------------------------------------------------------------------
+// <copyright company="CoApp Project">
+//     Copyright (c) 2011 Garrett Serack . All rights reserved.
+// </copyright>
+// <license>
+//     The software is licensed under the Apache 2.0 License (the "License")
+//     You may not use the software except in compliance with the License.
+// </license>
+//-----------------------------------------------------------------------
+
+#pragma once
+
+// The few things the portable parts of the bootstrapper (the string arena, the strings and
+// paths, the manifest and the candidate list) need from the OS: per-thread variables, atomic
+// updates, and the StrSafe formatting calls.
+//
+// On Windows they're the Win32 calls, as before. Anywhere else (say, building those parts by
+// themselves with gcc to measure them, see tests\) there's a POSIX/GCC version, along with
+// the handful of Windows types the code uses.
+
+#ifdef _WIN32
+
+#define THREAD_LOCAL							__declspec(thread)
+
+#define AtomicIncrement(target)					InterlockedIncrement(target)
+#define AtomicExchangeAdd(target, value)		InterlockedExchangeAdd(target, value)		// returns the value before
+#define AtomicCompareExchange(target, value, comparand)	InterlockedCompareExchange(target, value, comparand)
+
+#else
+
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+typedef int32_t LONG;
+typedef uint32_t DWORD;
+typedef unsigned int UINT;
+typedef int32_t HRESULT;
+typedef int BOOL;
+#define __int64									long long
+
+#ifndef TRUE
+#define TRUE	1
+#define FALSE	0
+#endif
+
+#define S_OK									((HRESULT)0)
+#define STRSAFE_E_INVALID_PARAMETER				((HRESULT)0x80070057)
+#define STRSAFE_E_INSUFFICIENT_BUFFER			((HRESULT)0x8007007A)
+#define SUCCEEDED(result)						((HRESULT)(result) >= 0)
+
+#define ZeroMemory(destination, length)			memset((destination), 0, (length))
+
+#define THREAD_LOCAL							__thread
+
+#define AtomicIncrement(target)					__sync_add_and_fetch(target, 1)
+#define AtomicExchangeAdd(target, value)		__sync_fetch_and_add(target, value)
+#define AtomicCompareExchange(target, value, comparand)	__sync_val_compare_and_swap(target, comparand, value)
+
+HRESULT StringCchLengthW( const wchar_t* text, size_t maximum, size_t* length ) {
+	size_t i;
+
+	if( text == NULL ) {
+		return STRSAFE_E_INVALID_PARAMETER;
+	}
+	for( i=0; i< maximum && text[i]; i++ ) {
+	}
+	if( i == maximum ) {
+		return STRSAFE_E_INVALID_PARAMETER;
+	}
+	*length = i;
+	return S_OK;
+}
+
+///
+/// <summary>
+///		StringCchVPrintf, with Windows' wide format strings: there, %s and %c are wide and %hs
+///		and %S are narrow (the other way around from C99), and %I64d is a 64-bit number. the
+///		format is turned into the C99 one, and handed to vswprintf.
+/// </summary>
+HRESULT StringCchVPrintf( wchar_t* destination, size_t count, const wchar_t* format, va_list args ) {
+	wchar_t stackFormat[128];
+	wchar_t* converted = stackFormat;
+	wchar_t* out;
+	size_t size;
+	int narrow;
+	int result;
+
+	if( destination == NULL || count == 0 || format == NULL ) {
+		return STRSAFE_E_INVALID_PARAMETER;
+	}
+	// no conversion comes out more than three characters longer than it went in; a short format is done on the stack.
+	size = wcslen(format)*3 + 1;
+	if( size > sizeof(stackFormat)/sizeof(wchar_t) && !(converted = (wchar_t*)malloc(size * sizeof(wchar_t))) ) {
+		*destination = 0;
+		return STRSAFE_E_INSUFFICIENT_BUFFER;
+	}
+
+	for( out = converted; *format; ) {
+		if( *format != L'%' ) {
+			*out++ = *format++;
+			continue;
+		}
+		*out++ = *format++;
+		if( *format == L'%' ) {
+			*out++ = *format++;
+			continue;
+		}
+		// flags, width, precision
+		while( *format && wcschr(L"-+ #0123456789.*", *format) ) {
+			*out++ = *format++;
+		}
+		// size
+		narrow = 0;
+		if( wcsncmp(format, L"I64", 3) == 0 ) {
+			*out++ = L'l';
+			*out++ = L'l';
+			format += 3;
+		} else if( *format == L'h' && (format[1] == L's' || format[1] == L'c') ) {
+			narrow = 1;
+			format++;
+		} else {
+			while( *format && wcschr(L"hlLqjzt", *format) ) {
+				*out++ = *format++;
+			}
+		}
+		// the conversion itself
+		if( *format == L's' || *format == L'c' ) {
+			if( !narrow && out[-1] != L'l' ) {
+				*out++ = L'l';
+			}
+			*out++ = *format++;
+		} else if( *format == L'S' || *format == L'C' ) {
+			*out++ = *format++ == L'S' ? L's' : L'c';
+		} else if( *format ) {
+			*out++ = *format++;
+		}
+	}
+	*out = 0;
+
+	result = vswprintf(destination, count, converted, args);
+	if( converted != stackFormat ) {
+		free(converted);
+	}
+	if( result < 0 ) {
+		// too long for the buffer; StrSafe hands back as much as fits.
+		destination[count-1] = 0;
+		return STRSAFE_E_INSUFFICIENT_BUFFER;
+	}
+	return S_OK;
+}
+
+#endif
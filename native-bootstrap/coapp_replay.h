@@ -0,0 +1,471 @@
+//-----------------------------------------------------------------------
+// <copyright company="CoApp Project">
+//     Copyright (c) 2011 Garrett Serack . All rights reserved.
+// </copyright>
+// <license>
+//     The software is licensed under the Apache 2.0 License (the "License")
+//     You may not use the software except in compliance with the License.
+// </license>
+//-----------------------------------------------------------------------
+
+#pragma once
+
+// Recording what the network did, and playing it back.
+//
+// With BootstrapNetworkRecord (under HKLM\Software\CoApp) set to a filename, every request
+// DownloadAttempt makes is written to that file: the url, the status, how long the headers
+// took, the validators, and when each piece of the body turned up (to RECORD_RESOLUTION).
+// The body itself goes alongside, in <file>.<n>.body. Segmented downloads are turned off
+// while recording, so that everything comes through the one place.
+//
+// With BootstrapNetworkReplay set to such a file instead, nothing goes out on the network:
+// each request is answered from the next exchange recorded for its url, with the same
+// status, the same delays and the same bytes arriving at the same times. A url that wasn't
+// recorded (or has been used up) can't be connected to. BootstrapNetworkReplaySpeed (a
+// DWORD, percent) plays it faster or slower; 100 is as recorded, and 0 is no waiting at all.
+// Replays always start from the beginning of the file (there's no resuming), and the
+// download cache still applies (so empty it first to replay the downloads).
+//
+// That replay stands in for WinHTTP, so the connection pool, the write pipeline and segmented
+// downloads don't run. To run them against a recording, play it with tests/replay_server.py
+// and set BootstrapNetworkRedirect to where that's listening (say, http://localhost:8080/):
+// every request -- to the bootstrap server, the CoApp server or any mirror -- then goes there
+// instead, with the original host and path as the path (http://coapp.org/resources/x.dll is
+// asked for as http://localhost:8080/coapp.org/resources/x.dll), so the server can tell them apart.
+
+#define NETWORK_TRACE_HEADER	L"CoApp network trace 1"
+#define RECORD_RESOLUTION		10000		// microseconds; data arriving closer together than this is one sample
+#define MAX_REPLAY_EXCHANGES	256
+#define MAX_NETWORK_TRACE_SIZE	(16*1024*1024)
+#define REPLAY_BUFFER_SIZE		(64*1024)
+#define REPLAY_WAIT_SLICE		100			// milliseconds; how often a long wait looks for cancellation
+
+#define NETWORK_TRACE_OFF		0
+#define NETWORK_TRACE_RECORD	1
+#define NETWORK_TRACE_REPLAY	2
+
+typedef struct NetworkSample {
+	__int64 offset;				// microseconds after the request started
+	__int64 bytes;
+} NetworkSample;
+
+struct NetworkRecording {
+	int index;
+	wchar_t* url;
+	LARGE_INTEGER started;
+	DWORD status;				// 0 if there never was a response
+	__int64 headersMicroseconds;
+	__int64 contentLength;		// -1 if the server didn't say
+	wchar_t etag[MAX_VALIDATOR_LENGTH];
+	wchar_t lastModified[MAX_VALIDATOR_LENGTH];
+	HANDLE body;
+	NetworkSample* samples;
+	int sampleCount;
+	int sampleCapacity;
+};
+
+typedef struct ReplayExchange {
+	int index;
+	wchar_t* url;
+	volatile LONG claimed;
+	int result;					// what DownloadAttempt returned when it was recorded
+	DWORD status;
+	__int64 headersMicroseconds;
+	__int64 contentLength;
+	wchar_t* etag;
+	wchar_t* lastModified;
+	NetworkSample* samples;
+	int sampleCount;
+	int sampleCapacity;
+} ReplayExchange;
+
+CRITICAL_SECTION NetworkTraceLock;
+int NetworkTraceMode = NETWORK_TRACE_OFF;
+wchar_t* NetworkTraceFilename = NULL;
+wchar_t* NetworkRedirect = NULL;
+DWORD ReplaySpeed = 100;
+volatile LONG NetworkRecordingCount = 0;
+ReplayExchange ReplayExchanges[MAX_REPLAY_EXCHANGES];
+int ReplayExchangeCount = 0;
+
+BOOL IsRecordingNetwork() {
+	return NetworkTraceMode == NETWORK_TRACE_RECORD;
+}
+
+BOOL IsReplayingNetwork() {
+	return NetworkTraceMode == NETWORK_TRACE_REPLAY;
+}
+
+// adds a sample (or adds to the last one, if it's close enough); FALSE if there's no memory for it.
+BOOL AddNetworkSample( NetworkSample** samples, int* count, int* capacity, __int64 offset, __int64 bytes, BOOL coalesce ) {
+	NetworkSample* grown;
+
+	if( coalesce && *count && offset - (*samples)[*count-1].offset < RECORD_RESOLUTION ) {
+		(*samples)[*count-1].bytes += bytes;
+		return TRUE;
+	}
+	if( *count == *capacity ) {
+		if( !(grown = (NetworkSample*)realloc(*samples, (*capacity ? *capacity * 2 : 64) * sizeof(NetworkSample))) ) {
+			return FALSE;
+		}
+		*samples = grown;
+		*capacity = *capacity ? *capacity * 2 : 64;
+	}
+	(*samples)[*count].offset = offset;
+	(*samples)[*count].bytes = bytes;
+	(*count)++;
+	return TRUE;
+}
+
+wchar_t* NetworkBodyFilename( int index ) {
+	return Sprintf(L"%s.%d.body", NetworkTraceFilename, index);
+}
+
+void LoadNetworkTrace() {
+	TableReader reader;
+	wchar_t* line;
+	wchar_t* cursor;
+	wchar_t* kind;
+	ReplayExchange* exchange = NULL;
+	__int64 offset;
+
+	if( OpenTableReader(&reader, NetworkTraceFilename, NETWORK_TRACE_HEADER, MAX_NETWORK_TRACE_SIZE) ) {
+		while( (line = NextTableLine(&reader)) ) {
+			cursor = line;
+			kind = SplitIndexField(&cursor);
+
+			if( lstrcmp(kind, L"request") == 0 ) {
+				if( ReplayExchangeCount == MAX_REPLAY_EXCHANGES ) {
+					break;
+				}
+				exchange = &ReplayExchanges[ReplayExchangeCount];
+				ZeroMemory(exchange, sizeof(ReplayExchange));
+				exchange->index = _wtoi(SplitIndexField(&cursor));
+				exchange->result = _wtoi(SplitIndexField(&cursor));
+				exchange->status = _wtoi(SplitIndexField(&cursor));
+				exchange->headersMicroseconds = _wtoi64(SplitIndexField(&cursor));
+				exchange->contentLength = _wtoi64(SplitIndexField(&cursor));
+				exchange->etag = _wcsdup(SplitIndexField(&cursor));
+				exchange->lastModified = _wcsdup(SplitIndexField(&cursor));
+				exchange->url = _wcsdup(SplitIndexField(&cursor));
+				if( IsNullOrEmpty(exchange->url) || !exchange->etag || !exchange->lastModified ) {
+					exchange = NULL;
+					continue;
+				}
+				ReplayExchangeCount++;
+			} else if( lstrcmp(kind, L"data") == 0 && exchange ) {
+				offset = _wtoi64(SplitIndexField(&cursor));
+				AddNetworkSample(&exchange->samples, &exchange->sampleCount, &exchange->sampleCapacity, offset, _wtoi64(SplitIndexField(&cursor)), FALSE);
+			}
+		}
+		CloseTableReader(&reader);
+	}
+	TraceInfo(L"Replaying %d exchanges from %s at %d%% speed", ReplayExchangeCount, NetworkTraceFilename, ReplaySpeed);
+}
+
+///
+/// <summary>
+///		looks to see if the network is to be recorded or replayed (see the top of this file).
+/// </summary>
+void InitializeNetworkTrace() {
+	TableWriter writer;
+	wchar_t* filename;
+	wchar_t* redirect;
+	DWORD* speed;
+
+	InitializeCriticalSection(&NetworkTraceLock);
+
+	if( (redirect = (wchar_t*)GetRegistryValue(L"Software\\CoApp", L"BootstrapNetworkRedirect", REG_SZ)) && !IsNullOrEmpty(redirect) ) {
+		// always with the slash on the end, so the original host can just be tacked on.
+		filename = Sprintf(redirect[wcslen(redirect)-1] == L'/' ? L"%s" : L"%s/", redirect);
+		if( filename && (NetworkRedirect = _wcsdup(filename)) ) {
+			TraceInfo(L"Sending every request to %s", NetworkRedirect);
+		}
+		DeleteString(&filename);
+	}
+	DeleteString(&redirect);
+
+	if( (filename = (wchar_t*)GetRegistryValue(L"Software\\CoApp", L"BootstrapNetworkReplay", REG_SZ)) && (NetworkTraceFilename = _wcsdup(filename)) ) {
+		if( (speed = (DWORD*)GetRegistryValue(L"Software\\CoApp", L"BootstrapNetworkReplaySpeed", REG_DWORD)) ) {
+			ReplaySpeed = *speed;
+		}
+		NetworkTraceMode = NETWORK_TRACE_REPLAY;
+		LoadNetworkTrace();
+		return;
+	}
+
+	if( (filename = (wchar_t*)GetRegistryValue(L"Software\\CoApp", L"BootstrapNetworkRecord", REG_SZ)) && (NetworkTraceFilename = _wcsdup(filename)) ) {
+		// start it over: just the header, for now.
+		if( CreateTableWriter(&writer, NetworkTraceFilename, NETWORK_TRACE_HEADER) && CloseTableWriter(&writer) ) {
+			NetworkTraceMode = NETWORK_TRACE_RECORD;
+			TraceInfo(L"Recording the network to %s", NetworkTraceFilename);
+		}
+	}
+}
+
+///
+/// <summary>
+///		where a request for the url really goes, if it's being sent to a replay server 
+///		(see the top of this file): the redirect, then the url's host and path. NULL if it isn't.
+/// </summary>
+wchar_t* RedirectNetworkUrl( const wchar_t* url ) {
+	const wchar_t* hostAndPath;
+
+	if( !NetworkRedirect || !url ) {
+		return NULL;
+	}
+	hostAndPath = wcsstr(url, L"://");
+	return Sprintf(L"%s%s", NetworkRedirect, hostAndPath ? hostAndPath + 3 : url);
+}
+
+///
+/// <summary>
+///		starts recording a request. returns NULL if the network isn't being recorded (the rest
+///		of the Record calls accept that, and do nothing).
+/// </summary>
+NetworkRecording* BeginNetworkRecording( const wchar_t* url ) {
+	NetworkRecording* recording;
+	wchar_t* bodyFilename;
+
+	if( !IsRecordingNetwork() || !(recording = (NetworkRecording*)calloc(1, sizeof(NetworkRecording))) ) {
+		return NULL;
+	}
+	QueryPerformanceCounter(&recording->started);
+	recording->index = InterlockedIncrement(&NetworkRecordingCount) - 1;
+	recording->url = _wcsdup(url);
+	recording->contentLength = -1;
+	recording->body = INVALID_HANDLE_VALUE;
+	if( (bodyFilename = NetworkBodyFilename(recording->index)) ) {
+		recording->body = CreateFile(bodyFilename, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		DeleteString(&bodyFilename);
+	}
+	return recording;
+}
+
+void RecordNetworkStatus( NetworkRecording* recording, DWORD status ) {
+	LARGE_INTEGER now;
+
+	if( recording ) {
+		QueryPerformanceCounter(&now);
+		recording->status = status;
+		recording->headersMicroseconds = ElapsedMicroseconds(&recording->started, &now);
+	}
+}
+
+void RecordNetworkValidators( NetworkRecording* recording, const wchar_t* etag, const wchar_t* lastModified, __int64 contentLength ) {
+	if( recording ) {
+		wcscpy_s(recording->etag, MAX_VALIDATOR_LENGTH, etag);
+		wcscpy_s(recording->lastModified, MAX_VALIDATOR_LENGTH, lastModified);
+		recording->contentLength = contentLength;
+	}
+}
+
+void RecordNetworkArrival( NetworkRecording* recording, const void* data, DWORD length ) {
+	LARGE_INTEGER now;
+	DWORD bytesWritten;
+
+	if( recording && length ) {
+		QueryPerformanceCounter(&now);
+		AddNetworkSample(&recording->samples, &recording->sampleCount, &recording->sampleCapacity, ElapsedMicroseconds(&recording->started, &now), length, TRUE);
+		if( recording->body != INVALID_HANDLE_VALUE ) {
+			WriteFile(recording->body, data, length, &bytesWritten, NULL);
+		}
+	}
+}
+
+///
+/// <summary>
+///		finishes recording a request (result is what DownloadAttempt is returning), and adds it to the trace.
+/// </summary>
+void EndNetworkRecording( NetworkRecording* recording, int result ) {
+	TableWriter writer;
+	LARGE_INTEGER now;
+	int i;
+
+	if( !recording ) {
+		return;
+	}
+	if( !recording->status ) {
+		QueryPerformanceCounter(&now);
+		recording->headersMicroseconds = ElapsedMicroseconds(&recording->started, &now);
+	}
+	if( recording->body != INVALID_HANDLE_VALUE ) {
+		CloseHandle(recording->body);
+	}
+
+	EnterCriticalSection(&NetworkTraceLock);
+	__try {
+		if( !AppendTableWriter(&writer, NetworkTraceFilename) ) {
+			__leave;
+		}
+		WriteTableLine(&writer, L"request\t%d\t%d\t%d\t%I64d\t%I64d\t%s\t%s\t%s", recording->index, result, recording->status, recording->headersMicroseconds,
+			recording->contentLength, recording->etag, recording->lastModified, recording->url);
+		for( i=0; i< recording->sampleCount; i++ ) {
+			WriteTableLine(&writer, L"data\t%I64d\t%I64d", recording->samples[i].offset, recording->samples[i].bytes);
+		}
+		CloseTableWriter(&writer);
+	} __finally {
+		LeaveCriticalSection(&NetworkTraceLock);
+		free(recording->samples);
+		free(recording->url);
+		free(recording);
+	}
+}
+
+// the next exchange recorded for the url that hasn't been played back yet.
+ReplayExchange* ClaimReplayExchange( const wchar_t* url ) {
+	int i;
+
+	for( i=0; i< ReplayExchangeCount; i++ ) {
+		if( lstrcmpi(ReplayExchanges[i].url, url) == 0 && InterlockedCompareExchange(&ReplayExchanges[i].claimed, TRUE, FALSE) == FALSE ) {
+			return &ReplayExchanges[i];
+		}
+	}
+	return NULL;
+}
+
+// waits until offset (recorded microseconds, scaled by the replay speed) after started. FALSE if it's cancelled.
+BOOL ReplayWait( LARGE_INTEGER* started, __int64 offset, DownloadInfo* info ) {
+	LARGE_INTEGER now;
+	__int64 remaining;
+
+	if( !ReplaySpeed ) {
+		return !IsShuttingDown && !(info && info->cancelled && *info->cancelled);
+	}
+	offset = offset * 100 / ReplaySpeed;
+
+	for(;;) {
+		if( IsShuttingDown || (info && info->cancelled && *info->cancelled) ) {
+			return FALSE;
+		}
+		QueryPerformanceCounter(&now);
+		if( (remaining = (offset - ElapsedMicroseconds(started, &now)) / 1000) <= 0 ) {
+			return TRUE;
+		}
+		Sleep(remaining > REPLAY_WAIT_SLICE ? REPLAY_WAIT_SLICE : (DWORD)remaining);
+	}
+}
+
+///
+/// <summary>
+///		stands in for DownloadAttempt when the network is being replayed: same inputs, same results.
+/// </summary>
+int ReplayDownloadAttempt( const wchar_t* url, const wchar_t* partFilename, const wchar_t* validatorFilename, DownloadInfo* info ) {
+	ReplayExchange* exchange;
+	HANDLE body = INVALID_HANDLE_VALUE;
+	HANDLE localFile = INVALID_HANDLE_VALUE;
+	wchar_t* bodyFilename = NULL;
+	char* buffer = NULL;
+	HashContext hash;
+	BOOL hashing = FALSE;
+	LARGE_INTEGER started;
+	DWORD chunk;
+	DWORD bytesRead;
+	DWORD bytesWritten;
+	__int64 remaining;
+	__int64 total = 0;
+	int result = DOWNLOAD_FAIL_CREATING_FILE;
+	int i;
+
+	QueryPerformanceCounter(&started);
+	ZeroMemory(&hash, sizeof(hash));
+
+	// there's no resuming a replay.
+	DeleteFile(validatorFilename);
+
+	if( !(exchange = ClaimReplayExchange(url)) ) {
+		TraceInfo(L"Nothing recorded for [%s]", url);
+		return DOWNLOAD_FAIL_CANT_CONNECT;
+	}
+
+	__try {
+		if( !ReplayWait(&started, exchange->headersMicroseconds, info) ) {
+			result = DOWNLOAD_FAIL_CANCELLED;
+			__leave;
+		}
+		if( info && exchange->status ) {
+			info->responseMicroseconds = ReplaySpeed ? exchange->headersMicroseconds * 100 / ReplaySpeed : 0;
+		}
+
+		if( exchange->status == 0 ) {
+			// never got as far as a response; it failed the same way this time.
+			result = exchange->result;
+			__leave;
+		}
+
+		if( exchange->status == HTTP_STATUS_NOT_MODIFIED && info ) {
+			info->notModified = TRUE;
+			result = DOWNLOAD_SUCCESS;
+			__leave;
+		}
+
+		if( exchange->status != HTTP_STATUS_OK && exchange->status != HTTP_STATUS_PARTIAL_CONTENT ) {
+			result = (exchange->status == HTTP_STATUS_NOT_FOUND || exchange->status == HTTP_STATUS_GONE) ? DOWNLOAD_FAIL_404 : DOWNLOAD_FAIL_NOT_200_OK;
+			__leave;
+		}
+
+		if( info ) {
+			wcscpy_s(info->etag, MAX_VALIDATOR_LENGTH, exchange->etag);
+			wcscpy_s(info->lastModified, MAX_VALIDATOR_LENGTH, exchange->lastModified);
+			if( info->expectedSize > 0 && exchange->contentLength >= 0 && exchange->contentLength != info->expectedSize ) {
+				result = DOWNLOAD_FAIL_WRONG_SIZE;
+				__leave;
+			}
+		}
+
+		if( !(buffer = (char*)malloc(REPLAY_BUFFER_SIZE)) || !(bodyFilename = NetworkBodyFilename(exchange->index)) ) {
+			result = DOWNLOAD_FAIL_ALLOCATION_FAILURE;
+			__leave;
+		}
+		if( INVALID_HANDLE_VALUE == (localFile = CreateFile(partFilename, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL)) ) {
+			__leave;
+		}
+		body = CreateFile(bodyFilename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		hashing = info && BeginHash(&hash);
+
+		for( i=0; i< exchange->sampleCount; i++ ) {
+			if( !ReplayWait(&started, exchange->samples[i].offset, info) ) {
+				result = DOWNLOAD_FAIL_CANCELLED;
+				__leave;
+			}
+			for( remaining = exchange->samples[i].bytes; remaining > 0; remaining -= bytesRead ) {
+				chunk = remaining > REPLAY_BUFFER_SIZE ? REPLAY_BUFFER_SIZE : (DWORD)remaining;
+				if( body == INVALID_HANDLE_VALUE || !ReadFile(body, buffer, chunk, &bytesRead, NULL) || bytesRead == 0 ) {
+					result = DOWNLOAD_FAIL_NO_DATA_AVAILABLE;
+					__leave;
+				}
+				if( !WriteFile(localFile, buffer, bytesRead, &bytesWritten, NULL) || bytesWritten != bytesRead ) {
+					result = DOWNLOAD_FAIL_CREATING_FILE;
+					__leave;
+				}
+				if( hashing && !UpdateHash(&hash, buffer, bytesRead) ) {
+					AbandonHash(&hash);
+					hashing = FALSE;
+				}
+				total += bytesRead;
+			}
+		}
+
+		if( exchange->result < 0 ) {
+			// it stalled, or got cut off, or was too big (the data up to that point is all there is).
+			result = exchange->result;
+			__leave;
+		}
+
+		if( hashing ) {
+			FinishHash(&hash, info->sha256);
+		}
+		result = (int)total;
+	} __finally {
+		AbandonHash(&hash);
+		if( body != INVALID_HANDLE_VALUE ) {
+			CloseHandle(body);
+		}
+		if( localFile != INVALID_HANDLE_VALUE ) {
+			CloseHandle(localFile);
+		}
+		DeleteString(&bodyFilename);
+		free(buffer);
+	}
+	return result;
+}
@@ -0,0 +1,315 @@
+//-----------------------------------------------------------------------
+// <copyright company="CoApp Project">
+//     Copyright (c) 2011 Garrett Serack . All rights reserved.
+// </copyright>
+// <license>
+//     The software is licensed under the Apache 2.0 License (the "License")
+//     You may not use the software except in compliance with the License.
+// </license>
+//-----------------------------------------------------------------------
+
+#pragma once
+
+// The run report: where the time went in this run of the bootstrap, for tooling that
+// collects them from a lot of machines (to find slow mirrors, and things getting slower).
+//
+// Each phase (elevating, looking on the box, downloading, verifying, unpacking from the MSI,
+// waiting on the .NET installer) is timed with QueryPerformanceCounter, and totalled up.
+// Every download the race starts is kept (url, bytes, how long it took to come down and to
+// check), and so is where each file we went looking for was found in the end, and how many
+// requests went out on a socket that was already open (see coapp_http.h).
+//
+// It's written out as JSON (UTF-8) when the process ends, however it ends (a cancelled run is
+// the one that most needs explaining), to the file named by the BootstrapReport value under
+// HKLM\Software\CoApp, or else as <msi>.bootstrap.json: in the Reports folder under the
+// bootstrap data folder when we're elevated (the MSI's folder is usually the user's, and
+// that's no place to be writing with admin rights), and next to the MSI when we're not.
+// Whatever is there already is deleted first, and the new one is only ever created, never
+// opened, so it can't be a link to some other file. Phases can overlap: looking on the box
+// includes verifying what's found there.
+
+void* GetRegistryValue(const wchar_t* keyname, const wchar_t* valueName,DWORD expectedDataType  );
+__int64 ElapsedMicroseconds( LARGE_INTEGER* start, LARGE_INTEGER* end );
+__int64 MicrosecondsSinceStart();
+void GetHttpStatistics( int* requests, int* handles, int* sockets, int* reused );
+BOOL IsElevated();
+wchar_t* GetBootstrapDataFolder();
+
+#define MAX_REPORTED_DOWNLOADS		64
+#define MAX_REPORTED_ACQUISITIONS	32
+#define REPORT_BUFFER_LENGTH		(128*1024)		// characters
+
+typedef enum RunPhase {
+	PHASE_ELEVATE = 0,		// ElevateSelf
+	PHASE_PROBE,			// AcquireFile, looking on the box (bootstrap folder, MSI folder, inside the MSI)
+	PHASE_DOWNLOAD,			// DownloadFileEx
+	PHASE_VERIFY,			// IsTrustedFile: the manifest hash, or the embedded signature
+	PHASE_EXTRACT,			// ExtractFileFromMSI
+	PHASE_MONITOR,			// MonitorChainedInstaller
+	PHASE_COUNT
+} RunPhase;
+
+const wchar_t* RunPhaseNames[PHASE_COUNT] = { L"elevate", L"probe", L"download", L"verify", L"extract", L"monitor" };
+
+typedef struct PhaseTotal {
+	int count;
+	__int64 microseconds;
+	__int64 bytes;
+} PhaseTotal;
+
+typedef struct DownloadRecord {
+	wchar_t* url;
+	int result;					// what DownloadFileEx returned
+	BOOL verified;
+	BOOL winner;
+	__int64 bytes;
+	__int64 downloadMicroseconds;
+	__int64 verifyMicroseconds;
+} DownloadRecord;
+
+typedef struct AcquisitionRecord {
+	wchar_t* filename;
+	wchar_t* source;			// where it came from in the end (NULL if it wasn't found)
+	int probes;					// places looked on the box
+	int candidates;				// places it could be downloaded from
+	int skipped;				// places not looked, because it wasn't there last time (see coapp_misses.h)
+	__int64 microseconds;
+} AcquisitionRecord;
+
+typedef struct ReportWriter {
+	wchar_t* out;
+	size_t remaining;
+	BOOL overflowed;
+} ReportWriter;
+
+CRITICAL_SECTION ReportLock;
+SYSTEMTIME RunStartedAt;
+PhaseTotal PhaseTotals[PHASE_COUNT];
+DownloadRecord ReportedDownloads[MAX_REPORTED_DOWNLOADS];
+int ReportedDownloadCount = 0;
+AcquisitionRecord ReportedAcquisitions[MAX_REPORTED_ACQUISITIONS];
+int ReportedAcquisitionCount = 0;
+BOOL ReportWritten = FALSE;
+
+void InitializeRunReport() {
+	InitializeCriticalSection(&ReportLock);
+	GetSystemTime(&RunStartedAt);
+}
+
+void RecordPhase( RunPhase phase, __int64 microseconds, __int64 bytes ) {
+	EnterCriticalSection(&ReportLock);
+	PhaseTotals[phase].count++;
+	PhaseTotals[phase].microseconds += microseconds;
+	PhaseTotals[phase].bytes += bytes;
+	LeaveCriticalSection(&ReportLock);
+}
+
+// records a phase that began at *started (a QueryPerformanceCounter reading), and ends now. returns how long it took.
+__int64 EndPhase( RunPhase phase, LARGE_INTEGER* started, __int64 bytes ) {
+	LARGE_INTEGER now;
+	__int64 microseconds;
+
+	QueryPerformanceCounter(&now);
+	microseconds = ElapsedMicroseconds(started, &now);
+	RecordPhase(phase, microseconds, bytes);
+	return microseconds;
+}
+
+void RecordDownload( const wchar_t* url, int result, BOOL verified, __int64 downloadMicroseconds, __int64 verifyMicroseconds ) {
+	DownloadRecord* record;
+
+	EnterCriticalSection(&ReportLock);
+	if( ReportedDownloadCount < MAX_REPORTED_DOWNLOADS ) {
+		record = &ReportedDownloads[ReportedDownloadCount++];
+		record->url = _wcsdup(url);
+		record->result = result;
+		record->verified = verified;
+		record->winner = FALSE;
+		record->bytes = result > 0 ? result : 0;
+		record->downloadMicroseconds = downloadMicroseconds;
+		record->verifyMicroseconds = verifyMicroseconds;
+	}
+	LeaveCriticalSection(&ReportLock);
+}
+
+// marks the (latest) download of url as the one that was used.
+void RecordWinner( const wchar_t* url ) {
+	int i;
+
+	EnterCriticalSection(&ReportLock);
+	for( i=ReportedDownloadCount-1; i>=0; i-- ) {
+		if( ReportedDownloads[i].url && lstrcmpi(ReportedDownloads[i].url, url) == 0 ) {
+			ReportedDownloads[i].winner = TRUE;
+			break;
+		}
+	}
+	LeaveCriticalSection(&ReportLock);
+}
+
+void RecordAcquisition( const wchar_t* filename, const wchar_t* source, int probes, int candidates, int skipped, __int64 microseconds ) {
+	AcquisitionRecord* record;
+
+	EnterCriticalSection(&ReportLock);
+	if( ReportedAcquisitionCount < MAX_REPORTED_ACQUISITIONS ) {
+		record = &ReportedAcquisitions[ReportedAcquisitionCount++];
+		record->filename = _wcsdup(filename);
+		record->source = source ? _wcsdup(source) : NULL;
+		record->probes = probes;
+		record->candidates = candidates;
+		record->skipped = skipped;
+		record->microseconds = microseconds;
+	}
+	LeaveCriticalSection(&ReportLock);
+}
+
+void ReportAppend( ReportWriter* writer, const wchar_t* format, ... ) {
+	va_list args;
+
+	va_start(args, format);
+	if( !writer->overflowed && FAILED(StringCchVPrintfEx(writer->out, writer->remaining, &writer->out, &writer->remaining, 0, format, args)) ) {
+		writer->overflowed = TRUE;
+	}
+	va_end(args);
+}
+
+// a JSON string (quoted and escaped), or null.
+void ReportAppendString( ReportWriter* writer, const wchar_t* text ) {
+	if( !text ) {
+		ReportAppend(writer, L"null");
+		return;
+	}
+
+	ReportAppend(writer, L"\"");
+	for( ; *text && !writer->overflowed; text++ ) {
+		if( *text == L'"' || *text == L'\\' ) {
+			ReportAppend(writer, L"\\%c", *text);
+		} else if( *text < 0x20 ) {
+			ReportAppend(writer, L"\\u%04x", *text);
+		} else {
+			ReportAppend(writer, L"%c", *text);
+		}
+	}
+	ReportAppend(writer, L"\"");
+}
+
+// where the report goes when the registry doesn't say (see the top of this file).
+wchar_t* DefaultReportPath() {
+	wchar_t* folder;
+
+	if( IsNullOrEmpty(MsiFile) ) {
+		return NULL;
+	}
+	if( !IsElevated() ) {
+		return Sprintf(L"%s.bootstrap.json", MsiFile);
+	}
+	if( !(folder = GetBootstrapDataFolder()) ) {
+		return NULL;
+	}
+	folder = UrlOrPathCombine(folder, L"Reports", L'\\');
+	CreateDirectory(folder, NULL);
+	return Sprintf(L"%s\\%s.bootstrap.json", folder, GetFilenameFromPath(MsiFile));
+}
+
+// bytes per second, or 0 if it was too quick to tell.
+__int64 Throughput( __int64 bytes, __int64 microseconds ) {
+	return microseconds > 0 ? bytes * 1000000 / microseconds : 0;
+}
+
+///
+/// <summary>
+///		writes the report out (see the top of this file). outcome is the exit code the process
+///		is about to end with. only the first call does anything: more than one thread can be 
+///		on its way out. anything that goes wrong here is ignored; it's only a report.
+/// </summary>
+void WriteRunReport( int outcome ) {
+	ReportWriter writer;
+	wchar_t* buffer = NULL;
+	wchar_t* path;
+	char* utf8 = NULL;
+	int utf8Length;
+	HANDLE file;
+	DWORD bytesWritten;
+	DownloadRecord* download;
+	AcquisitionRecord* acquisition;
+	int httpRequests;
+	int httpHandles;
+	int httpSockets;
+	int httpReused;
+	int i;
+
+	EnterCriticalSection(&ReportLock);
+	__try {
+		if( ReportWritten ) {
+			__leave;
+		}
+		ReportWritten = TRUE;
+
+		if( !(path = (wchar_t*)GetRegistryValue(L"Software\\CoApp", L"BootstrapReport", REG_SZ)) ) {
+			path = DefaultReportPath();
+		}
+		if( IsNullOrEmpty(path) || !(buffer = (wchar_t*)malloc(REPORT_BUFFER_LENGTH * sizeof(wchar_t))) ) {
+			__leave;
+		}
+
+		writer.out = buffer;
+		writer.remaining = REPORT_BUFFER_LENGTH;
+		writer.overflowed = FALSE;
+
+		ReportAppend(&writer, L"{\r\n  \"started\": \"%04d-%02d-%02dT%02d:%02d:%02d.%03dZ\",\r\n  \"msi\": ", RunStartedAt.wYear, RunStartedAt.wMonth, RunStartedAt.wDay,
+			RunStartedAt.wHour, RunStartedAt.wMinute, RunStartedAt.wSecond, RunStartedAt.wMilliseconds);
+		ReportAppendString(&writer, MsiFile);
+		ReportAppend(&writer, L",\r\n  \"outcome\": %d,\r\n  \"cancelled\": %s,\r\n  \"totalMicroseconds\": %I64d,\r\n  \"phases\": {", outcome, 
+			IsShuttingDown ? L"true" : L"false", MicrosecondsSinceStart());
+
+		for( i=0; i< PHASE_COUNT; i++ ) {
+			ReportAppend(&writer, L"%s\r\n    \"%s\": { \"count\": %d, \"microseconds\": %I64d, \"bytes\": %I64d, \"bytesPerSecond\": %I64d }", i ? L"," : L"",
+				RunPhaseNames[i], PhaseTotals[i].count, PhaseTotals[i].microseconds, PhaseTotals[i].bytes, Throughput(PhaseTotals[i].bytes, PhaseTotals[i].microseconds));
+		}
+
+		GetHttpStatistics(&httpRequests, &httpHandles, &httpSockets, &httpReused);
+		ReportAppend(&writer, L"\r\n  },\r\n  \"http\": { \"requests\": %d, \"connectionHandles\": %d, \"sockets\": %d, \"reusedSockets\": %d },", 
+			httpRequests, httpHandles, httpSockets, httpReused);
+
+		ReportAppend(&writer, L"\r\n  \"acquisitions\": [");
+		for( i=0; i< ReportedAcquisitionCount; i++ ) {
+			acquisition = &ReportedAcquisitions[i];
+			ReportAppend(&writer, L"%s\r\n    { \"file\": ", i ? L"," : L"");
+			ReportAppendString(&writer, acquisition->filename);
+			ReportAppend(&writer, L", \"source\": ");
+			ReportAppendString(&writer, acquisition->source);
+			ReportAppend(&writer, L", \"probes\": %d, \"candidates\": %d, \"skipped\": %d, \"microseconds\": %I64d }", acquisition->probes, acquisition->candidates, acquisition->skipped, acquisition->microseconds);
+		}
+
+		ReportAppend(&writer, L"\r\n  ],\r\n  \"downloads\": [");
+		for( i=0; i< ReportedDownloadCount; i++ ) {
+			download = &ReportedDownloads[i];
+			ReportAppend(&writer, L"%s\r\n    { \"url\": ", i ? L"," : L"");
+			ReportAppendString(&writer, download->url);
+			ReportAppend(&writer, L", \"result\": %d, \"bytes\": %I64d, \"microseconds\": %I64d, \"bytesPerSecond\": %I64d, \"verifyMicroseconds\": %I64d, \"verified\": %s, \"winner\": %s }",
+				download->result, download->bytes, download->downloadMicroseconds, Throughput(download->bytes, download->downloadMicroseconds),
+				download->verifyMicroseconds, download->verified ? L"true" : L"false", download->winner ? L"true" : L"false");
+		}
+		ReportAppend(&writer, L"\r\n  ]\r\n}\r\n");
+
+		if( writer.overflowed ) {
+			// half a report is no use to anyone.
+			__leave;
+		}
+
+		utf8Length = WideCharToMultiByte(CP_UTF8, 0, buffer, -1, NULL, 0, NULL, NULL);
+		if( utf8Length <= 1 || !(utf8 = (char*)malloc(utf8Length)) || !WideCharToMultiByte(CP_UTF8, 0, buffer, -1, utf8, utf8Length, NULL, NULL) ) {
+			__leave;
+		}
+
+		// if something else turns up at that name in between, it's left alone.
+		DeleteFile(path);
+		if( INVALID_HANDLE_VALUE != (file = CreateFile(path, GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OPEN_REPARSE_POINT, NULL)) ) {
+			WriteFile(file, utf8, utf8Length-1, &bytesWritten, NULL);
+			CloseHandle(file);
+		}
+	} __finally {
+		LeaveCriticalSection(&ReportLock);
+		free(utf8);
+		free(buffer);
+	}
+}
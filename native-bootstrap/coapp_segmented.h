@@ -0,0 +1,257 @@
+//-----------------------------------------------------------------------
+// <copyright company="CoApp Project">
+//     Copyright (c) 2011 Garrett Serack . All rights reserved.
+// </copyright>
+// <license>
+//     The software is licensed under the Apache 2.0 License (the "License")
+//     You may not use the software except in compliance with the License.
+// </license>
+//-----------------------------------------------------------------------
+
+#pragma once
+
+// Segmented downloads: a big file is split into byte ranges, each fetched on its own
+// connection and written straight to its place in the (preallocated) file.
+// A segment that stops making progress has the rest of its range handed to a new connection.
+// Offsets are LONGs (so the monitor can read them while the workers update them), which is why
+// DownloadAttempt only segments files up to SEGMENTED_MAXIMUM_SIZE; bigger ones come down in one piece.
+
+#define SEGMENT_CONNECTIONS			4
+#define MAX_SEGMENTS				16
+#define SEGMENT_STALL_MILLISECONDS	8000
+#define SEGMENT_BUFFER_SIZE			(64*1024)
+
+struct SegmentedTransfer;
+
+typedef struct Segment {
+	struct SegmentedTransfer* transfer;
+	volatile LONG position;			// next byte this segment writes
+	volatile LONG end;				// one past the last byte this segment is responsible for
+	volatile LONG lastProgress;		// tick count when data last arrived
+	volatile LONG finished;
+	HINTERNET volatile request;		// whoever swaps this out closes it
+	HANDLE thread;
+} Segment;
+
+typedef struct SegmentedTransfer {
+	HINTERNET connection;
+	const wchar_t* urlPath;
+	const wchar_t* validator;
+	HANDLE localFile;
+	volatile LONG* cancelled;
+	volatile LONG failed;
+	int count;
+	Segment segments[MAX_SEGMENTS];
+} SegmentedTransfer;
+
+void CloseSegmentRequest( Segment* segment ) {
+	HINTERNET request;
+
+	if( (request = (HINTERNET)InterlockedExchangePointer((PVOID volatile*)&segment->request, NULL)) ) {
+		// this also knocks the worker out of a blocking read.
+		WinHttpCloseHandle(request);
+	}
+}
+
+unsigned __stdcall SegmentThread( void* argument ) {
+	Segment* segment = (Segment*)argument;
+	SegmentedTransfer* transfer = segment->transfer;
+	HINTERNET request = NULL;
+	wchar_t* headers = NULL;
+	wchar_t contentRange[128];
+	void* buffer = NULL;
+	DWORD statusCode = 0;
+	DWORD tmpValue;
+	DWORD bytesRead;
+	LONG position;
+	LONG length;
+	int rangeStart, rangeEnd, rangeTotal;
+	HANDLE writeEvent = NULL;
+
+	__try {
+		segment->lastProgress = GetTickCount();
+		headers = Sprintf(L"Range: bytes=%d-%d\r\nIf-Range: %s\r\n", segment->position, segment->end-1, transfer->validator);
+
+		if( !headers || !(request = WinHttpOpenRequest( transfer->connection, L"GET", transfer->urlPath, NULL, WINHTTP_NO_REFERER, WINHTTP_DEFAULT_ACCEPT_TYPES, 0)) ) {
+			__leave;
+		}
+		segment->request = request;
+
+		if( !WinHttpSendRequest( request, headers, (DWORD)-1L, WINHTTP_NO_REQUEST_DATA, 0, 0, 0) || !WinHttpReceiveResponse( request, NULL) ) {
+			__leave;
+		}
+		CountHttpResponse(request);
+
+		tmpValue = sizeof(DWORD);
+		WinHttpQueryHeaders( request, WINHTTP_QUERY_STATUS_CODE| WINHTTP_QUERY_FLAG_NUMBER, NULL, &statusCode, &tmpValue, NULL );
+		tmpValue = sizeof(contentRange);
+		if( statusCode != HTTP_STATUS_PARTIAL_CONTENT ||
+			!WinHttpQueryHeaders( request, WINHTTP_QUERY_CONTENT_RANGE, WINHTTP_HEADER_NAME_BY_INDEX, contentRange, &tmpValue, WINHTTP_NO_HEADER_INDEX) ||
+			swscanf_s(contentRange, L"bytes %d-%d/%d", &rangeStart, &rangeEnd, &rangeTotal) != 3 || rangeStart != segment->position ) {
+			// the file changed underneath us (or the server doesn't really do ranges); none of the pieces can be trusted.
+			TraceError(L"Segment at %d got status %d [%s]", segment->position, statusCode, contentRange);
+			InterlockedExchange(&transfer->failed, TRUE);
+			__leave;
+		}
+
+		// the file is opened for overlapped I/O, so each write needs something to wait on.
+		if( !(buffer = malloc(SEGMENT_BUFFER_SIZE)) || !(writeEvent = CreateEvent(NULL, TRUE, FALSE, NULL)) ) {
+			__leave;
+		}
+
+		while( (position = segment->position) < segment->end ) {
+			if( transfer->failed || IsShuttingDown || (transfer->cancelled && *transfer->cancelled) ) {
+				__leave;
+			}
+
+			if( !WinHttpReadData( request, buffer, SEGMENT_BUFFER_SIZE, &bytesRead) || !bytesRead ) {
+				__leave;
+			}
+
+			// the end can be pulled in if the rest of the range was given to someone else.
+			length = segment->end - position;
+			if( length <= 0 ) {
+				break;
+			}
+			if( (LONG)bytesRead < length ) {
+				length = bytesRead;
+			}
+
+			if( !WriteFileAt( transfer->localFile, buffer, (DWORD)length, position, writeEvent ) ) {
+				InterlockedExchange(&transfer->failed, TRUE);
+				__leave;
+			}
+
+			InterlockedExchangeAdd(&segment->position, length);
+			segment->lastProgress = GetTickCount();
+		}
+	} __finally {
+		if( buffer ) {
+			free(buffer);
+		}
+		if( writeEvent ) {
+			CloseHandle(writeEvent);
+		}
+		DeleteString(&headers);
+		CloseSegmentRequest(segment);
+		InterlockedExchange(&segment->finished, TRUE);
+		ReleaseThreadTraceRing();
+		DestroyThreadArena();
+	}
+	return 0;
+}
+
+BOOL StartSegment( SegmentedTransfer* transfer, LONG start, LONG end ) {
+	Segment* segment;
+
+	if( transfer->count >= MAX_SEGMENTS ) {
+		return FALSE;
+	}
+
+	segment = &transfer->segments[transfer->count];
+	ZeroMemory(segment, sizeof(Segment));
+	segment->transfer = transfer;
+	segment->position = start;
+	segment->end = end;
+	segment->lastProgress = GetTickCount();
+
+	if( !(segment->thread = (HANDLE)_beginthreadex(NULL, 0, &SegmentThread, segment, 0, NULL)) ) {
+		return FALSE;
+	}
+	transfer->count++;
+	return TRUE;
+}
+
+///
+/// <summary>
+///		downloads a file over several connections, into localFile (which gets resized to fit).
+///		the first request (that found out the server supports ranges) is expected to be closed already.
+///		returns the file size on success, or a DOWNLOAD_FAIL_ code.
+/// </summary>
+int SegmentedDownload( HINTERNET connection, const wchar_t* urlPath, const wchar_t* validator, HANDLE localFile, LONG size, volatile LONG* cancelled ) {
+	SegmentedTransfer* transfer;
+	Segment* segment;
+	HANDLE handles[MAX_SEGMENTS];
+	LARGE_INTEGER fileSize;
+	LONG chunk;
+	LONG end;
+	int running;
+	int result = DOWNLOAD_SUCCESS;
+	int i;
+
+	// all of it gets written by position, so make the whole file up front.
+	fileSize.QuadPart = size;
+	if( !SetFilePointerEx(localFile, fileSize, NULL, FILE_BEGIN) || !SetEndOfFile(localFile) ) {
+		return DOWNLOAD_FAIL_CREATING_FILE;
+	}
+
+	if( !(transfer = (SegmentedTransfer*)malloc(sizeof(SegmentedTransfer))) ) {
+		return DOWNLOAD_FAIL_ALLOCATION_FAILURE;
+	}
+	ZeroMemory(transfer, sizeof(SegmentedTransfer));
+	transfer->connection = connection;
+	transfer->urlPath = urlPath;
+	transfer->validator = validator;
+	transfer->localFile = localFile;
+	transfer->cancelled = cancelled;
+
+	TraceInfo(L"Segmented download of %d bytes over %d connections", size, SEGMENT_CONNECTIONS);
+
+	chunk = size / SEGMENT_CONNECTIONS;
+	for( i=0; i< SEGMENT_CONNECTIONS; i++ ) {
+		if( !StartSegment(transfer, i*chunk, i == SEGMENT_CONNECTIONS-1 ? size : (i+1)*chunk) ) {
+			InterlockedExchange(&transfer->failed, TRUE);
+		}
+	}
+
+	do {
+		running = 0;
+		for( i=0; i< transfer->count && !transfer->failed; i++ ) {
+			segment = &transfer->segments[i];
+			if( segment->position >= segment->end ) {
+				continue;
+			}
+
+			// died or stalled with some of its range left? give the rest to a new connection.
+			if( segment->finished || GetTickCount() - (DWORD)segment->lastProgress > SEGMENT_STALL_MILLISECONDS ) {
+				TraceVerbose(L"Reassigning segment %d-%d", segment->position, segment->end);
+				end = segment->end;
+				segment->end = segment->position;
+				CloseSegmentRequest(segment);
+				if( !StartSegment(transfer, segment->position, end) ) {
+					InterlockedExchange(&transfer->failed, TRUE);
+				}
+				continue;
+			}
+			handles[running++] = segment->thread;
+		}
+
+		if( running && !transfer->failed ) {
+			WaitForMultipleObjects(running, handles, FALSE, 1000);
+		}
+
+		if( IsShuttingDown || (cancelled && *cancelled) ) {
+			result = DOWNLOAD_FAIL_CANCELLED;
+			InterlockedExchange(&transfer->failed, TRUE);
+		}
+	} while( running && !transfer->failed );
+
+	// wind down whatever's left, and wait for them, since they're using our file handle.
+	for( i=0; i< transfer->count; i++ ) {
+		if( transfer->failed ) {
+			CloseSegmentRequest(&transfer->segments[i]);
+		}
+		handles[i] = transfer->segments[i].thread;
+	}
+	WaitForMultipleObjects(transfer->count, handles, TRUE, INFINITE);
+
+	if( result == DOWNLOAD_SUCCESS ) {
+		result = transfer->failed ? DOWNLOAD_FAIL_INCOMPLETE : (int)size;
+	}
+
+	for( i=0; i< transfer->count; i++ ) {
+		CloseHandle(transfer->segments[i].thread);
+	}
+	free(transfer);
+	return result;
+}
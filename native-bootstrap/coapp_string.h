@@ -1,92 +1,277 @@
-#pragma once
-
-void TerminateApplicationWithError(int errorLevel , wchar_t* defaultString );
-
-size_t SafeStringLengthInCharacters(const wchar_t* text ) {
-	size_t stringLength;
-
-	if( SUCCEEDED( StringCchLengthW(text, BUFSIZE, &stringLength )) ) {
-		return stringLength;
-	}
-	return -1;
-}
-
-BOOL IsNullOrEmpty(const wchar_t* text) {
-	return !( text && *text );
-}
-
-wchar_t* NewString() {
-	wchar_t* result = (wchar_t*) malloc(BUFSIZE*sizeof(wchar_t));
-	ZeroMemory(result, BUFSIZE*sizeof(wchar_t));
-	return result;
-}
-
-void DeleteString(wchar_t** stringPointer ) {
-	if( stringPointer )  {
-		if( *stringPointer ) {
-			free( *stringPointer );
-		}
-		*stringPointer = NULL;
-	}
-}
-
-wchar_t* DuplicateString( const wchar_t* text ) {
-	size_t size;
-	wchar_t* result = NULL;
-	
-	if( IsNullOrEmpty(text ) ) {
-		return NewString();
-	}
-	
-	size = SafeStringLengthInCharacters(text);
-	
-	result = NewString();
-	wcsncpy_s(result , BUFSIZE, text, size );
-
-	return result;
-}
-
-
-wchar_t* Sprintf(const wchar_t* format, ... ) {
-	wchar_t* result = NewString();
-	va_list args;
-	
-	if( IsNullOrEmpty(format) ) {
-		return NewString(); 
-	}
-
-	va_start(args, format);
-	
-	if( SUCCEEDED(StringCbVPrintf(result,BUFSIZE,format, args) ) ) {
-		va_end(args);
-		return result;	
-	}
-	return NULL;
-}
-
-
-void _DebugPrintf(const wchar_t* format, ...) {
-    // Had to remove underscore in valist & vastart for formatting
-	wchar_t* result = NewString();
-	va_list args;
-	
-	va_start(args, format);
-	
-	if( SUCCEEDED(StringCbVPrintf(result,BUFSIZE,format, args) ) ) {
-		va_end(args);
-		OutputDebugString(result); 
-	}
-}
-
-#define DebugPrintf(format, ... ) _DebugPrintf(L" [%s] = [%d] %s", __WFUNCTION__, __LINE__ , Sprintf( format, __VA_ARGS__ ) );
-
-
-const wchar_t* GetString( UINT resourceId, const wchar_t* defaultString ) {
-	wchar_t* result = NewString();
-	LoadString(resourceModule, resourceId , result , BUFSIZE); 
-	if( IsNullOrEmpty(result) ) {
-		DeleteString(&result);
-		return defaultString;
-	}
-	return result;
-}
\ No newline at end of file
+#pragma once
+
+void TerminateApplicationWithError(int errorLevel , wchar_t* defaultString );
+
+size_t SafeStringLengthInCharacters(const wchar_t* text ) {
+	size_t stringLength;
+
+	if( SUCCEEDED( StringCchLengthW(text, BUFSIZE, &stringLength )) ) {
+		return stringLength;
+	}
+	return -1;
+}
+
+BOOL IsNullOrEmpty(const wchar_t* text) {
+	return !( text && *text );
+}
+
+///
+/// <summary> 
+///		allocates an uninitialized string with room for the given number of characters (plus the terminator)
+///		from the thread's string arena.
+/// </summary>
+wchar_t* NewStringOfLength(size_t length) {
+	wchar_t* result = (wchar_t*) ArenaAllocate((length+1)*sizeof(wchar_t));
+	if( result ) {
+		*result = 0;
+	}
+	return result;
+}
+
+///
+/// <summary> 
+///		allocates a BUFSIZE scratch string, for calls that fill in a buffer.
+///		call TrimString() afterwards to give back the unused space.
+/// </summary>
+wchar_t* NewString() {
+	return NewStringOfLength(BUFSIZE-1);
+}
+
+// gives the unused tail of the most recently allocated string back to the arena.
+wchar_t* TrimString(wchar_t* text) {
+	if( text ) {
+		ArenaShrink(text, (wcslen(text)+1)*sizeof(wchar_t));
+	}
+	return text;
+}
+
+void DeleteString(wchar_t** stringPointer ) {
+	if( stringPointer )  {
+		if( *stringPointer ) {
+			ArenaRelease( *stringPointer );
+		}
+		*stringPointer = NULL;
+	}
+}
+
+wchar_t* DuplicateString( const wchar_t* text ) {
+	size_t size;
+	wchar_t* result = NULL;
+	
+	if( IsNullOrEmpty(text ) ) {
+		return NewStringOfLength(0);
+	}
+	
+	// not SafeStringLengthInCharacters: that gives up at BUFSIZE, and the arena doesn't have to.
+	size = wcslen(text);
+	
+	if( (result = NewStringOfLength(size)) ) {
+		memcpy(result, text, size*sizeof(wchar_t));
+		result[size] = 0;
+	}
+
+	return result;
+}
+
+
+#define SPRINTF_STACK_LENGTH	256
+
+wchar_t* Sprintf(const wchar_t* format, ... ) {
+	wchar_t scratch[SPRINTF_STACK_LENGTH];
+	wchar_t* result = NULL;
+	size_t length;
+	va_list args;
+	
+	if( IsNullOrEmpty(format) ) {
+		return NewStringOfLength(0); 
+	}
+
+	// nearly everything fits on the stack, and then takes exactly as much of the arena as it needs.
+	va_start(args, format);
+	if( SUCCEEDED(StringCchVPrintf(scratch, SPRINTF_STACK_LENGTH, format, args)) ) {
+		va_end(args);
+		length = wcslen(scratch);
+		if( (result = NewStringOfLength(length)) ) {
+			memcpy(result, scratch, (length+1)*sizeof(wchar_t));
+		}
+		return result;
+	}
+	va_end(args);
+
+	// anything longer is formatted straight into a BUFSIZE scratch string, and what isn't used goes back.
+	result = NewString();
+	va_start(args, format);
+	
+	if( result && SUCCEEDED(StringCchVPrintf(result,BUFSIZE,format, args) ) ) {
+		va_end(args);
+		return TrimString(result);	
+	}
+	va_end(args);
+	DeleteString(&result);
+	return NULL;
+}
+
+#ifdef _WIN32
+
+// The string table from the resources dll, read once: every non-empty string, terminated,
+// packed end to end in one allocation, with an index sorted by id. Nothing in it ever moves 
+// or goes away, so what GetString hands back is good for the life of the process.
+
+typedef struct InternedString {
+	UINT id;
+	const wchar_t* text;
+} InternedString;
+
+typedef struct StringTable {
+	int count;
+	InternedString* strings;
+} StringTable;
+
+typedef struct StringBlocks {
+	int count;
+	int capacity;
+	WORD* ids;
+} StringBlocks;
+
+StringTable* volatile LoadedStrings = NULL;
+
+BOOL CALLBACK CollectStringBlock( HMODULE module, LPCWSTR type, LPWSTR name, LONG_PTR parameter ) {
+	StringBlocks* blocks = (StringBlocks*)parameter;
+	WORD* grown;
+
+	if( !IS_INTRESOURCE(name) ) {
+		return TRUE;
+	}
+	if( blocks->count == blocks->capacity ) {
+		if( !(grown = (WORD*)realloc(blocks->ids, (blocks->capacity + 16) * sizeof(WORD))) ) {
+			return FALSE;
+		}
+		blocks->ids = grown;
+		blocks->capacity += 16;
+	}
+	blocks->ids[blocks->count++] = (WORD)(ULONG_PTR)name;
+	return TRUE;
+}
+
+// a block holds 16 strings, each a length followed by that many (unterminated) characters.
+// the language is picked the same way LoadString picks it.
+const WCHAR* LockStringBlock( HMODULE module, WORD block, const WCHAR** end ) {
+	HRSRC resource;
+	HGLOBAL loaded;
+	const WCHAR* data;
+
+	if( !(resource = FindResource(module, MAKEINTRESOURCE(block), RT_STRING)) || 
+		!(loaded = LoadResource(module, resource)) || !(data = (const WCHAR*)LockResource(loaded)) ) {
+		return NULL;
+	}
+	*end = data + SizeofResource(module, resource) / sizeof(WCHAR);
+	return data;
+}
+
+// reads every string in the module into a new StringTable. pass 0 counts, pass 1 copies.
+StringTable* LoadStringTable( HMODULE module ) {
+	StringBlocks blocks;
+	StringTable* table = NULL;
+	InternedString entry;
+	const WCHAR* data;
+	const WCHAR* end;
+	wchar_t* pool = NULL;
+	size_t characters = 0;
+	int count = 0;
+	int pass, block, i, j;
+	WORD length;
+
+	ZeroMemory(&blocks, sizeof(blocks));
+	EnumResourceNames(module, RT_STRING, CollectStringBlock, (LONG_PTR)&blocks);
+
+	for( pass = 0; pass < 2; pass++ ) {
+		for( block = 0; block < blocks.count; block++ ) {
+			if( !(data = LockStringBlock(module, blocks.ids[block], &end)) ) {
+				continue;
+			}
+			for( i=0; i< 16 && data < end; i++ ) {
+				length = *data++;
+				if( length > end - data ) {
+					break;
+				}
+				if( length ) {
+					if( pass == 0 ) {
+						count++;
+						characters += length + 1;
+					} else {
+						memcpy(pool, data, length * sizeof(wchar_t));
+						pool[length] = 0;
+						table->strings[table->count].id = (blocks.ids[block] - 1) * 16 + i;
+						table->strings[table->count].text = pool;
+						table->count++;
+						pool += length + 1;
+					}
+				}
+				data += length;
+			}
+		}
+
+		if( pass == 0 ) {
+			if( !(table = (StringTable*)malloc(sizeof(StringTable) + count * sizeof(InternedString) + characters * sizeof(wchar_t))) ) {
+				break;
+			}
+			table->count = 0;
+			table->strings = (InternedString*)(table + 1);
+			pool = (wchar_t*)(table->strings + count);
+		}
+	}
+	free(blocks.ids);
+
+	if( table ) {
+		// blocks usually come back in order already; this is just to be sure.
+		for( i=1; i< table->count; i++ ) {
+			entry = table->strings[i];
+			for( j = i; j > 0 && table->strings[j-1].id > entry.id; j-- ) {
+				table->strings[j] = table->strings[j-1];
+			}
+			table->strings[j] = entry;
+		}
+	}
+	return table;
+}
+
+///
+/// <summary>
+///		looks up a string in the resources dll. doesn't allocate (after the first time); 
+///		the result is good for the life of the process. defaultString if it isn't there, 
+///		or the resources aren't loaded yet.
+/// </summary>
+const wchar_t* GetString( UINT resourceId, const wchar_t* defaultString ) {
+	StringTable* table = LoadedStrings;
+	int low, high, middle;
+
+	if( !table ) {
+		if( !resourceModule || !(table = LoadStringTable(resourceModule)) ) {
+			return defaultString;
+		}
+		if( InterlockedCompareExchangePointer((PVOID volatile*)&LoadedStrings, table, NULL) != NULL ) {
+			// someone else got there first.
+			free(table);
+			table = LoadedStrings;
+		}
+	}
+
+	for( low = 0, high = table->count - 1; low <= high; ) {
+		middle = (low + high) / 2;
+		if( table->strings[middle].id == resourceId ) {
+			return table->strings[middle].text;
+		}
+		if( table->strings[middle].id < resourceId ) {
+			low = middle + 1;
+		} else {
+			high = middle - 1;
+		}
+	}
+	return defaultString;
+}
+
+void ReportArenaStatistics() {
+	TraceInfo(L"String arena: %d allocations, %d bytes allocated, peak %d bytes in use, peak %d bytes reserved", ArenaAllocations, ArenaBytesAllocated, ArenaPeakBytesInUse, ArenaPeakBytesReserved );
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,191 @@
+//-----------------------------------------------------------------------
+// <copyright company="CoApp Project">
+//     Copyright (c) 2011 Garrett Serack . All rights reserved.
+// </copyright>
+// <license>
+//     The software is licensed under the Apache 2.0 License (the "License")
+//     You may not use the software except in compliance with the License.
+// </license>
+//-----------------------------------------------------------------------
+
+#pragma once
+
+// The tables the bootstrapper keeps (the cache index, mirrors.txt, misses.txt, and the network
+// trace) are all the same shape: UTF-16 with a byte order mark, a header line that names the
+// format, then one record a line, with the fields separated by tabs.
+
+typedef struct TableReader {
+	wchar_t* text;
+	wchar_t* next;
+} TableReader;
+
+typedef struct TableWriter {
+	HANDLE file;
+	const wchar_t* filename;
+	wchar_t* tempFilename;		// NULL when it's being added to
+	BOOL ok;
+} TableWriter;
+
+// splits the next field off a record.
+wchar_t* SplitIndexField( wchar_t** cursor ) {
+	wchar_t* result = *cursor;
+	wchar_t* position = result;
+
+	while( *position && *position != L'\t' ) {
+		position++;
+	}
+	if( *position ) {
+		*position++ = 0;
+	}
+	*cursor = position;
+	return result;
+}
+
+///
+/// <summary>
+///		the next line of a table, ready to be taken apart with SplitIndexField; NULL at the end.
+/// </summary>
+wchar_t* NextTableLine( TableReader* reader ) {
+	wchar_t* line = reader->next;
+	wchar_t* end;
+
+	if( line == NULL || *line == 0 ) {
+		return NULL;
+	}
+	for( end = line; *end && *end != L'\n'; end++ ) {
+	}
+	reader->next = *end ? end+1 : end;
+	*end = 0;
+	if( end > line && end[-1] == L'\r' ) {
+		end[-1] = 0;
+	}
+	return line;
+}
+
+void CloseTableReader( TableReader* reader ) {
+	free(reader->text);
+	ZeroMemory(reader, sizeof(TableReader));
+}
+
+///
+/// <summary>
+///		reads in a table (of no more than maximumSize bytes) and checks its header.
+///		returns FALSE if it isn't there, is too big, or isn't in the format we know.
+/// </summary>
+BOOL OpenTableReader( TableReader* reader, const wchar_t* filename, const wchar_t* header, DWORD maximumSize ) {
+	HANDLE file;
+	wchar_t* line;
+	DWORD size;
+	DWORD bytesRead = 0;
+
+	ZeroMemory(reader, sizeof(TableReader));
+	if( IsNullOrEmpty(filename) || INVALID_HANDLE_VALUE == (file = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL)) ) {
+		return FALSE;
+	}
+
+	size = GetFileSize(file, NULL);
+	if( size != INVALID_FILE_SIZE && size <= maximumSize && (reader->text = (wchar_t*)malloc(size + sizeof(wchar_t))) ) {
+		if( !ReadFile(file, reader->text, size, &bytesRead, NULL) ) {
+			bytesRead = 0;
+		}
+		reader->text[bytesRead/sizeof(wchar_t)] = 0;
+	}
+	CloseHandle(file);
+	reader->next = reader->text;
+
+	if( (line = NextTableLine(reader)) && *line == 0xFEFF ) {
+		line++;
+	}
+	if( line == NULL || lstrcmp(line, header) ) {
+		CloseTableReader(reader);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+///
+/// <summary>
+///		formats a record and writes it out as a line of the table. once a write fails, the rest
+///		don't happen, and CloseTableWriter says so.
+/// </summary>
+void WriteTableLine( TableWriter* writer, const wchar_t* format, ... ) {
+	wchar_t* line;
+	DWORD length;
+	DWORD bytesWritten;
+	va_list args;
+
+	if( !writer->ok ) {
+		return;
+	}
+
+	line = NewString();
+	va_start(args, format);
+	writer->ok = line && SUCCEEDED(StringCchVPrintf(line, BUFSIZE-2, format, args)) && SUCCEEDED(StringCchCat(line, BUFSIZE, L"\r\n"));
+	va_end(args);
+
+	if( writer->ok ) {
+		length = (DWORD)(wcslen(line)*sizeof(wchar_t));
+		writer->ok = WriteFile(writer->file, line, length, &bytesWritten, NULL) && bytesWritten == length;
+	}
+	DeleteString(&line);
+}
+
+///
+/// <summary>
+///		starts writing a table out from scratch. it goes to <filename>.new until CloseTableWriter.
+/// </summary>
+BOOL CreateTableWriter( TableWriter* writer, const wchar_t* filename, const wchar_t* header ) {
+	ZeroMemory(writer, sizeof(TableWriter));
+	writer->file = INVALID_HANDLE_VALUE;
+
+	if( IsNullOrEmpty(filename) || !(writer->tempFilename = Sprintf(L"%s.new", filename)) ) {
+		return FALSE;
+	}
+	if( INVALID_HANDLE_VALUE == (writer->file = CreateFile(writer->tempFilename, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL)) ) {
+		DeleteString(&writer->tempFilename);
+		return FALSE;
+	}
+	writer->filename = filename;
+	writer->ok = TRUE;
+	WriteTableLine(writer, L"%c%s", 0xFEFF, header);
+	return TRUE;
+}
+
+///
+/// <summary>
+///		opens a table that's already there, to add lines to the end of it.
+/// </summary>
+BOOL AppendTableWriter( TableWriter* writer, const wchar_t* filename ) {
+	ZeroMemory(writer, sizeof(TableWriter));
+	if( IsNullOrEmpty(filename) || INVALID_HANDLE_VALUE == (writer->file = CreateFile(filename, FILE_APPEND_DATA, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL)) ) {
+		writer->file = INVALID_HANDLE_VALUE;
+		return FALSE;
+	}
+	writer->filename = filename;
+	writer->ok = TRUE;
+	return TRUE;
+}
+
+///
+/// <summary>
+///		finishes writing a table. a new one is swapped in whole, so a crash can't leave half of
+///		one behind (and if any of it didn't get written, it's thrown away).
+///		returns FALSE if anything went wrong.
+/// </summary>
+BOOL CloseTableWriter( TableWriter* writer ) {
+	BOOL result = writer->ok;
+
+	if( writer->file != INVALID_HANDLE_VALUE ) {
+		CloseHandle(writer->file);
+	}
+	if( writer->tempFilename ) {
+		if( !result || !MoveFileEx(writer->tempFilename, writer->filename, MOVEFILE_REPLACE_EXISTING) ) {
+			DeleteFile(writer->tempFilename);
+			result = FALSE;
+		}
+		DeleteString(&writer->tempFilename);
+	}
+	ZeroMemory(writer, sizeof(TableWriter));
+	writer->file = INVALID_HANDLE_VALUE;
+	return result;
+}
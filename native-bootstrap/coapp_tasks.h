@@ -0,0 +1,190 @@
+//-----------------------------------------------------------------------
+// <copyright company="CoApp Project">
+//     Copyright (c) 2011 Garrett Serack . All rights reserved.
+// </copyright>
+// <license>
+//     The software is licensed under the Apache 2.0 License (the "License")
+//     You may not use the software except in compliance with the License.
+// </license>
+//-----------------------------------------------------------------------
+
+#pragma once
+
+// Startup tasks: the things that have to happen before (and while) the window is up,
+// with the dependencies between them spelled out.
+//
+// Each task gets its own thread, which waits on the events of the tasks it depends on
+// and then runs. A task with no function is one that's finished from somewhere else
+// (with CompleteTask). A task runs once everything it depends on is done, whether that
+// worked or not; it's up to the task to look (TaskSucceeded) and decide what that means.
+//
+// When each task started and finished is kept, relative to when the process started.
+
+#define MAX_STARTUP_TASKS		8
+#define TASK_BIT(id)			(1 << (id))
+
+typedef BOOL (*TaskFunction)();
+
+typedef struct StartupTask {
+	const wchar_t* name;
+	TaskFunction run;
+	DWORD dependencies;			// TASK_BITs of the tasks that have to be done first
+	HANDLE done;				// manual reset; set when it's finished, either way
+	volatile LONG succeeded;
+	LARGE_INTEGER started;
+	LARGE_INTEGER finished;
+} StartupTask;
+
+StartupTask StartupTasks[MAX_STARTUP_TASKS];
+int StartupTaskCount = 0;
+BOOL TasksStarted = FALSE;
+LARGE_INTEGER ProcessStartedAt;
+
+// microseconds between two QueryPerformanceCounter readings
+__int64 ElapsedMicroseconds( LARGE_INTEGER* start, LARGE_INTEGER* end ) {
+	LARGE_INTEGER frequency;
+
+	if( !QueryPerformanceFrequency(&frequency) || !frequency.QuadPart ) {
+		return 0;
+	}
+	return (end->QuadPart - start->QuadPart) * 1000000 / frequency.QuadPart;
+}
+
+__int64 MicrosecondsSinceStart() {
+	LARGE_INTEGER now;
+
+	QueryPerformanceCounter(&now);
+	return ElapsedMicroseconds(&ProcessStartedAt, &now);
+}
+
+///
+/// <summary>
+///		adds a task. run may be NULL for a task that's completed from outside.
+///		tasks can only depend on ones defined before them.
+/// </summary>
+BOOL DefineTask( int id, const wchar_t* name, TaskFunction run, DWORD dependencies ) {
+	StartupTask* task;
+
+	if( id < 0 || id >= MAX_STARTUP_TASKS || id != StartupTaskCount || (dependencies & ~(TASK_BIT(id)-1)) ) {
+		return FALSE;
+	}
+	task = &StartupTasks[id];
+	ZeroMemory(task, sizeof(StartupTask));
+	task->name = name;
+	task->run = run;
+	task->dependencies = dependencies;
+	if( !(task->done = CreateEvent(NULL, TRUE, FALSE, NULL)) ) {
+		return FALSE;
+	}
+	StartupTaskCount++;
+	return TRUE;
+}
+
+void CompleteTask( int id, BOOL succeeded ) {
+	StartupTask* task = &StartupTasks[id];
+
+	QueryPerformanceCounter(&task->finished);
+	if( !task->started.QuadPart ) {
+		task->started = task->finished;
+	}
+	InterlockedExchange(&task->succeeded, succeeded);
+	SetEvent(task->done);
+}
+
+BOOL TaskSucceeded( int id ) {
+	return StartupTasks[id].succeeded;
+}
+
+// TRUE if the task has finished (either way), without waiting for it.
+BOOL TaskFinished( int id ) {
+	return WaitForSingleObject(StartupTasks[id].done, 0) == WAIT_OBJECT_0;
+}
+
+unsigned __stdcall TaskThread( void* parameter ) {
+	StartupTask* task = (StartupTask*)parameter;
+	HANDLE dependencies[MAX_STARTUP_TASKS];
+	DWORD count = 0;
+	int i;
+
+	for( i=0; i< StartupTaskCount; i++ ) {
+		if( task->dependencies & TASK_BIT(i) ) {
+			dependencies[count++] = StartupTasks[i].done;
+		}
+	}
+	if( count ) {
+		WaitForMultipleObjects(count, dependencies, TRUE, INFINITE);
+	}
+
+	QueryPerformanceCounter(&task->started);
+	CompleteTask((int)(task - StartupTasks), task->run());
+
+	ReleaseThreadTraceRing();
+	DestroyThreadArena();
+	return 0;
+}
+
+///
+/// <summary>
+///		starts a thread for every task that has something to run.
+/// </summary>
+void StartTasks() {
+	HANDLE thread;
+	int i;
+
+	TasksStarted = TRUE;
+	for( i=0; i< StartupTaskCount; i++ ) {
+		if( StartupTasks[i].run ) {
+			if( !(thread = (HANDLE)_beginthreadex(NULL, 0, &TaskThread, &StartupTasks[i], 0, NULL)) ) {
+				// nothing that depends on it would ever run.
+				CompleteTask(i, FALSE);
+				continue;
+			}
+			CloseHandle(thread);
+		}
+	}
+}
+
+///
+/// <summary>
+///		waits for a task to finish; returns whether it worked.
+/// </summary>
+BOOL WaitForTask( int id ) {
+	WaitForSingleObject(StartupTasks[id].done, INFINITE);
+	return TaskSucceeded(id);
+}
+
+///
+/// <summary>
+///		same thing, for the UI thread: messages keep getting handled while it waits.
+/// </summary>
+BOOL WaitForTaskWithMessages( int id ) {
+	MSG message;
+
+	while( MsgWaitForMultipleObjects(1, &StartupTasks[id].done, FALSE, INFINITE, QS_ALLINPUT) == WAIT_OBJECT_0 + 1 ) {
+		while( PeekMessage(&message, NULL, 0, 0, PM_REMOVE) ) {
+			if( message.message == WM_QUIT ) {
+				// not ours to eat.
+				PostQuitMessage((int)message.wParam);
+				return FALSE;
+			}
+			TranslateMessage(&message);
+			DispatchMessage(&message);
+		}
+	}
+	return TaskSucceeded(id);
+}
+
+void ReportTaskTimings() {
+	StartupTask* task;
+	int i;
+
+	for( i=0; i< StartupTaskCount; i++ ) {
+		task = &StartupTasks[i];
+		if( WaitForSingleObject(task->done, 0) == WAIT_OBJECT_0 ) {
+			TraceInfo(L"Task %s: %s, %I64d us to %I64d us", task->name, task->succeeded ? L"succeeded" : L"failed",
+				ElapsedMicroseconds(&ProcessStartedAt, &task->started), ElapsedMicroseconds(&ProcessStartedAt, &task->finished));
+		} else {
+			TraceInfo(L"Task %s: not finished", task->name);
+		}
+	}
+}
@@ -0,0 +1,331 @@
+//-----------------------------------------------------------------------
+// <copyright company="CoApp Project">
+//     Copyright (c) 2011 Garrett Serack . All rights reserved.
+// </copyright>
+// <license>
+//     The software is licensed under the Apache 2.0 License (the "License")
+//     You may not use the software except in compliance with the License.
+// </license>
+//-----------------------------------------------------------------------
+
+#pragma once
+
+// Tracing.
+//
+// TraceError/TraceInfo/TraceVerbose take a printf-style format (which has to be a literal --
+// its address is what identifies the event) and record a fixed-size binary event: the format,
+// a timestamp and the arguments. Nothing is formatted and nothing is allocated (past the first
+// event on a thread, and only then if there's no ring going spare). String arguments are copied
+// into the event; there's room for a long url and a path, and anything past that is cut short.
+//
+// Each thread writes to its own ring of the last TRACE_RING_SIZE events, so there's no locking;
+// DumpTrace() merges them all by time, formats them, and sends them to OutputDebugString. A
+// thread hands its ring back when it's done (ReleaseThreadTraceRing), and the next thread to 
+// start tracing carries on in it, so there are only ever as many rings as there were threads
+// tracing at the same time -- and what the finished threads recorded stays until it's overwritten.
+//
+// Anything above TRACE_LEVEL compiles to nothing at all.
+
+#include <stdlib.h>
+
+#define TRACE_LEVEL_NONE		0
+#define TRACE_LEVEL_ERROR		1
+#define TRACE_LEVEL_INFO		2
+#define TRACE_LEVEL_VERBOSE		3
+
+#ifndef TRACE_LEVEL
+#ifdef _DEBUG
+#define TRACE_LEVEL				TRACE_LEVEL_VERBOSE
+#else
+#define TRACE_LEVEL				TRACE_LEVEL_INFO
+#endif
+#endif
+
+#define TRACE_RING_SIZE			128		// has to be a power of two
+#define TRACE_MAX_ARGUMENTS		6
+#define TRACE_TEXT_LENGTH		400		// characters, shared by all the string arguments of an event
+
+typedef struct TraceEvent {
+	volatile LONG sequence;		// which event this is (+1); 0 while it's being written
+	DWORD threadId;
+	int level;
+	LARGE_INTEGER time;
+	const wchar_t* format;
+	const wchar_t* function;
+	int line;
+	int argumentCount;
+	__int64 arguments[TRACE_MAX_ARGUMENTS];		// numbers, or for strings, where they are in text (-1 if they didn't fit)
+	wchar_t text[TRACE_TEXT_LENGTH];
+} TraceEvent;
+
+typedef struct TraceRing {
+	struct TraceRing* next;
+	DWORD threadId;				// of the thread that has it now
+	volatile LONG inUse;
+	volatile LONG written;		// how many events have ever been recorded in it (by any thread)
+	TraceEvent events[TRACE_RING_SIZE];
+} TraceRing;
+
+THREAD_LOCAL TraceRing* ThreadTraceRing = NULL;
+TraceRing* volatile TraceRings = NULL;		// every ring there is, in use or not
+
+// skips to the conversion character of the format spec starting after a '%'; *wide is set for 64-bit integers.
+const wchar_t* TraceFormatConversion( const wchar_t* p, BOOL* wide ) {
+	while( *p && wcschr(L"-+ #0123456789.", *p) ) {
+		p++;
+	}
+	*wide = FALSE;
+	if( p[0] == L'I' && p[1] == L'6' && p[2] == L'4' ) {
+		*wide = TRUE;
+		p += 3;
+	} else if( p[0] == L'l' && p[1] == L'l' ) {
+		*wide = TRUE;
+		p += 2;
+	} else if( *p == L'l' || *p == L'h' ) {
+		p++;
+	}
+	return p;
+}
+
+TraceRing* GetThreadTraceRing() {
+	TraceRing* ring = ThreadTraceRing;
+
+	if( ring ) {
+		return ring;
+	}
+
+	// one a finished thread gave back, if there is one (rings are never taken off the list, so this is safe to walk).
+	for( ring = TraceRings; ring; ring = ring->next ) {
+		if( !ring->inUse && InterlockedCompareExchange(&ring->inUse, TRUE, FALSE) == FALSE ) {
+			break;
+		}
+	}
+	if( !ring ) {
+		if( !(ring = (TraceRing*)calloc(1, sizeof(TraceRing))) ) {
+			return NULL;
+		}
+		ring->inUse = TRUE;
+		do {
+			ring->next = TraceRings;
+		} while( InterlockedCompareExchangePointer((PVOID volatile*)&TraceRings, ring, ring->next) != ring->next );
+	}
+	ring->threadId = GetCurrentThreadId();
+	ThreadTraceRing = ring;
+	return ring;
+}
+
+///
+/// <summary>
+///		gives this thread's ring back for the next thread to use; call it on the way out of a thread
+///		(next to DestroyThreadArena). what's in it stays until the next thread writes over it.
+/// </summary>
+void ReleaseThreadTraceRing() {
+	TraceRing* ring = ThreadTraceRing;
+
+	if( ring ) {
+		ThreadTraceRing = NULL;
+		InterlockedExchange(&ring->inUse, FALSE);
+	}
+}
+
+void RecordTraceEvent( int level, const wchar_t* function, int line, const wchar_t* format, ... ) {
+	TraceRing* ring;
+	TraceEvent* event;
+	const wchar_t* p;
+	const wchar_t* text;
+	size_t used = 0;
+	size_t length;
+	BOOL wide;
+	LONG index;
+	va_list args;
+
+	if( !(ring = GetThreadTraceRing()) ) {
+		return;
+	}
+
+	index = ring->written;
+	event = &ring->events[index & (TRACE_RING_SIZE-1)];
+	InterlockedExchange(&event->sequence, 0);
+
+	event->threadId = ring->threadId;
+	event->level = level;
+	QueryPerformanceCounter(&event->time);
+	event->format = format;
+	event->function = function;
+	event->line = line;
+	event->argumentCount = 0;
+
+	va_start(args, format);
+	for( p = format; *p && event->argumentCount < TRACE_MAX_ARGUMENTS; p++ ) {
+		if( *p != L'%' ) {
+			continue;
+		}
+		if( !*++p ) {
+			break;
+		}
+		if( *p == L'%' ) {
+			continue;
+		}
+		if( !*(p = TraceFormatConversion(p, &wide)) ) {
+			break;
+		}
+
+		switch( *p ) {
+			case L's':
+				if( !(text = va_arg(args, const wchar_t*)) ) {
+					text = L"(null)";
+				}
+				if( used < TRACE_TEXT_LENGTH ) {
+					length = wcslen(text);
+					if( length > TRACE_TEXT_LENGTH - used - 1 ) {
+						length = TRACE_TEXT_LENGTH - used - 1;
+					}
+					memcpy(event->text + used, text, length * sizeof(wchar_t));
+					event->text[used + length] = 0;
+					event->arguments[event->argumentCount++] = used;
+					used += length + 1;
+				} else {
+					event->arguments[event->argumentCount++] = -1;
+				}
+				break;
+
+			case L'p':
+				event->arguments[event->argumentCount++] = (__int64)(INT_PTR)va_arg(args, void*);
+				break;
+
+			default:
+				event->arguments[event->argumentCount++] = wide ? va_arg(args, __int64) : va_arg(args, int);
+				break;
+		}
+	}
+	va_end(args);
+
+	// it's whole now.
+	InterlockedExchange(&event->sequence, index + 1);
+	ring->written = index + 1;
+}
+
+// turns an event back into text.
+void FormatTraceEvent( const TraceEvent* event, wchar_t* buffer, size_t size ) {
+	wchar_t spec[16];
+	const wchar_t* p;
+	const wchar_t* start;
+	wchar_t* out = buffer;
+	size_t remaining = size;
+	__int64 argument;
+	BOOL wide;
+	int next = 0;
+
+	*buffer = 0;
+	for( p = event->format; *p && remaining > 1; p++ ) {
+		if( *p != L'%' || p[1] == L'%' ) {
+			*out++ = *p;
+			*out = 0;
+			remaining--;
+			if( *p == L'%' ) {
+				p++;
+			}
+			continue;
+		}
+
+		start = p;
+		if( !*(p = TraceFormatConversion(p+1, &wide)) || next == event->argumentCount || (size_t)(p - start + 1) >= sizeof(spec)/sizeof(wchar_t) ) {
+			break;
+		}
+		memcpy(spec, start, (p - start + 1) * sizeof(wchar_t));
+		spec[p - start + 1] = 0;
+		argument = event->arguments[next++];
+
+		switch( *p ) {
+			case L's':
+				StringCchPrintfEx(out, remaining, &out, &remaining, 0, spec, argument >= 0 ? event->text + argument : L"");
+				break;
+			case L'p':
+				StringCchPrintfEx(out, remaining, &out, &remaining, 0, spec, (void*)(INT_PTR)argument);
+				break;
+			default:
+				if( wide ) {
+					StringCchPrintfEx(out, remaining, &out, &remaining, 0, spec, argument);
+				} else {
+					StringCchPrintfEx(out, remaining, &out, &remaining, 0, spec, (int)argument);
+				}
+				break;
+		}
+	}
+}
+
+int CompareTraceEvents( const void* a, const void* b ) {
+	LONGLONG difference = ((const TraceEvent*)a)->time.QuadPart - ((const TraceEvent*)b)->time.QuadPart;
+
+	return difference < 0 ? -1 : difference > 0 ? 1 : 0;
+}
+
+///
+/// <summary>
+///		formats everything that's in the rings (oldest first, all threads together) and sends it
+///		to the debugger. threads can keep tracing while this runs; events that get overwritten
+///		while they're being copied are skipped.
+/// </summary>
+void DumpTrace() {
+	wchar_t message[1024];
+	wchar_t line[1200];
+	TraceEvent* events;
+	TraceRing* ring;
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER first;
+	LONG written;
+	LONG index;
+	int capacity = 0;
+	int count = 0;
+	int i;
+
+	for( ring = TraceRings; ring; ring = ring->next ) {
+		capacity += TRACE_RING_SIZE;
+	}
+	if( !capacity || !(events = (TraceEvent*)malloc(capacity * sizeof(TraceEvent))) ) {
+		return;
+	}
+
+	for( ring = TraceRings; ring && count < capacity; ring = ring->next ) {
+		written = ring->written;
+		for( index = written > TRACE_RING_SIZE ? written - TRACE_RING_SIZE : 0; index < written && count < capacity; index++ ) {
+			events[count] = ring->events[index & (TRACE_RING_SIZE-1)];
+			// only keep it if it was all there before and after copying.
+			if( events[count].sequence == index + 1 && ring->events[index & (TRACE_RING_SIZE-1)].sequence == index + 1 ) {
+				count++;
+			}
+		}
+	}
+
+	qsort(events, count, sizeof(TraceEvent), CompareTraceEvents);
+	QueryPerformanceFrequency(&frequency);
+	first.QuadPart = count ? events[0].time.QuadPart : 0;
+
+	for( i=0; i< count; i++ ) {
+		FormatTraceEvent(&events[i], message, sizeof(message)/sizeof(wchar_t));
+		if( SUCCEEDED(StringCchPrintf(line, sizeof(line)/sizeof(wchar_t), L" [%5d] [+%I64d us] [%s] \x00bb [%d] %s", events[i].threadId,
+			frequency.QuadPart ? (events[i].time.QuadPart - first.QuadPart) * 1000000 / frequency.QuadPart : 0,
+			events[i].function, events[i].line, message)) ) {
+			OutputDebugString(line);
+		}
+	}
+	free(events);
+}
+
+#if TRACE_LEVEL >= TRACE_LEVEL_ERROR
+#define TraceError(format, ... )	RecordTraceEvent(TRACE_LEVEL_ERROR, __WFUNCTION__, __LINE__, format, __VA_ARGS__)
+#else
+#define TraceError(format, ... )	((void)0)
+#endif
+
+#if TRACE_LEVEL >= TRACE_LEVEL_INFO
+#define TraceInfo(format, ... )		RecordTraceEvent(TRACE_LEVEL_INFO, __WFUNCTION__, __LINE__, format, __VA_ARGS__)
+#else
+#define TraceInfo(format, ... )		((void)0)
+#endif
+
+#if TRACE_LEVEL >= TRACE_LEVEL_VERBOSE
+#define TraceVerbose(format, ... )	RecordTraceEvent(TRACE_LEVEL_VERBOSE, __WFUNCTION__, __LINE__, format, __VA_ARGS__)
+#else
+#define TraceVerbose(format, ... )	((void)0)
+#endif
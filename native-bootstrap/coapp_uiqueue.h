@@ -0,0 +1,225 @@
+//-----------------------------------------------------------------------
+// <copyright company="CoApp Project">
+//     Copyright (c) 2011 Garrett Serack . All rights reserved.
+// </copyright>
+// <license>
+//     The software is licensed under the Apache 2.0 License (the "License")
+//     You may not use the software except in compliance with the License.
+// </license>
+//-----------------------------------------------------------------------
+
+#pragma once
+
+// Getting things onto the screen from other threads.
+//
+// Only the UI thread (the one that ran wWinMain) touches windows. Everybody else drops
+// commands on a lock-free list (an SList), and pokes a message-only window that belongs to
+// the UI thread -- once, however many commands pile up before it gets around to them.
+//
+// Status and error commands are carried out in the order they were sent. Progress isn't
+// queued at all: there's just the latest value, and the progress bar is moved to it no more
+// often than the display refreshes.
+
+#define UI_COMMANDS_PENDING		(WM_USER+3)
+#define UI_PAINT_TIMER			1
+
+#define UI_COMMAND_STATUS		1
+#define UI_COMMAND_ERROR		2
+#define UI_COMMAND_IMAGES		3
+
+void ShowDecodedImages( BOOL decoded );
+
+typedef struct UiCommand {
+	SLIST_ENTRY entry;		// has to be first
+	int command;
+	int value;
+	wchar_t* text;
+} UiCommand;
+
+SLIST_HEADER UiCommands;
+HWND UiCommandWindow = NULL;
+DWORD UiThreadId = 0;
+volatile LONG UiWakePending = 0;
+volatile LONG UiProgress = -1;		// the latest value anyone asked for
+int UiProgressShown = -1;
+DWORD UiLastPaint = 0;
+DWORD UiFrameInterval = 16;
+BOOL UiPaintScheduled = FALSE;
+
+// statistics
+volatile LONG UiProgressRequests = 0;
+int UiProgressPaints = 0;
+int UiWakeups = 0;
+
+void WakeUiThread() {
+	// only the first one since the UI thread last looked needs to post anything.
+	if( UiCommandWindow && InterlockedExchange(&UiWakePending, TRUE) == FALSE ) {
+		PostMessage(UiCommandWindow, UI_COMMANDS_PENDING, 0, 0);
+	}
+}
+
+///
+/// <summary>
+///		queues a command for the UI thread. text is copied.
+/// </summary>
+void PostUiCommand( int command, int value, const wchar_t* text ) {
+	UiCommand* item;
+
+	if( !(item = (UiCommand*)_aligned_malloc(sizeof(UiCommand), MEMORY_ALLOCATION_ALIGNMENT)) ) {
+		return;
+	}
+	item->command = command;
+	item->value = value;
+	item->text = text ? _wcsdup(text) : NULL;
+
+	InterlockedPushEntrySList(&UiCommands, &item->entry);
+	WakeUiThread();
+}
+
+///
+/// <summary>
+///		asks for the progress bar to be moved. only the most recent value counts.
+/// </summary>
+void PostUiProgress( int value ) {
+	InterlockedIncrement(&UiProgressRequests);
+	InterlockedExchange(&UiProgress, value);
+	WakeUiThread();
+}
+
+///
+/// <summary>
+///		changes the big message on the status dialog (from any thread).
+/// </summary>
+void SetStatusText( const wchar_t* text ) {
+	PostUiCommand(UI_COMMAND_STATUS, 0, text);
+}
+
+// UI thread only.
+void ApplyUiProgress() {
+	LONG value = UiProgress;
+	DWORD now = GetTickCount();
+
+	if( value < 0 || value == UiProgressShown || StatusDialog == NULL || UiPaintScheduled ) {
+		return;
+	}
+
+	if( now - UiLastPaint < UiFrameInterval ) {
+		// painted too recently; come back when the next frame is due.
+		UiPaintScheduled = SetTimer(UiCommandWindow, UI_PAINT_TIMER, UiFrameInterval - (now - UiLastPaint), NULL) != 0;
+		return;
+	}
+
+	SendMessage(StatusDialog, SETPROGRESS, (WPARAM)value, 0);
+	UiProgressShown = value;
+	UiLastPaint = now;
+	UiProgressPaints++;
+}
+
+// UI thread only.
+void RunUiCommand( UiCommand* item ) {
+	switch( item->command ) {
+		case UI_COMMAND_STATUS:
+			if( StatusDialog != NULL ) {
+				SetWindowText(GetDlgItem(StatusDialog, IDC_STATICTEXT3), item->text);
+			}
+			break;
+
+		case UI_COMMAND_ERROR:
+			// doesn't come back.
+			TerminateApplicationWithError(item->value, item->text);
+			break;
+
+		case UI_COMMAND_IMAGES:
+			ShowDecodedImages(item->value);
+			break;
+	}
+}
+
+// UI thread only: carries out everything that's been queued, oldest first.
+void DrainUiCommands() {
+	PSLIST_ENTRY entry;
+	PSLIST_ENTRY next;
+	PSLIST_ENTRY ordered = NULL;
+	UiCommand* item;
+
+	// anything pushed after this point posts a fresh wakeup.
+	InterlockedExchange(&UiWakePending, FALSE);
+	UiWakeups++;
+
+	// the list comes off newest first; turn it around.
+	for( entry = InterlockedFlushSList(&UiCommands); entry; entry = next ) {
+		next = entry->Next;
+		entry->Next = ordered;
+		ordered = entry;
+	}
+
+	for( entry = ordered; entry; entry = next ) {
+		next = entry->Next;
+		item = (UiCommand*)entry;
+		RunUiCommand(item);
+		free(item->text);
+		_aligned_free(item);
+	}
+
+	ApplyUiProgress();
+}
+
+LRESULT CALLBACK UiCommandWindowProc( HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam ) {
+	switch( message ) {
+		case UI_COMMANDS_PENDING:
+			DrainUiCommands();
+			return 0;
+
+		case WM_TIMER:
+			if( wParam == UI_PAINT_TIMER ) {
+				KillTimer(hwnd, UI_PAINT_TIMER);
+				UiPaintScheduled = FALSE;
+				ApplyUiProgress();
+				return 0;
+			}
+			break;
+	}
+	return DefWindowProc(hwnd, message, wParam, lParam);
+}
+
+///
+/// <summary>
+///		sets up the queue. has to be called on the UI thread, before any other threads start.
+/// </summary>
+void InitializeUiQueue() {
+	WNDCLASS windowClass;
+	HDC screen;
+	int refreshRate = 0;
+
+	InitializeSListHead(&UiCommands);
+	UiThreadId = GetCurrentThreadId();
+
+	ZeroMemory(&windowClass, sizeof(windowClass));
+	windowClass.lpfnWndProc = UiCommandWindowProc;
+	windowClass.hInstance = (HINSTANCE)ApplicationInstance;
+	windowClass.lpszClassName = L"CoAppBootstrapUiQueue";
+	RegisterClass(&windowClass);
+
+	UiCommandWindow = CreateWindowEx(0, windowClass.lpszClassName, NULL, 0, 0, 0, 0, 0, HWND_MESSAGE, NULL, (HINSTANCE)ApplicationInstance, NULL);
+
+	// 0 or 1 means "the hardware default", which we can't know; stick with 60Hz.
+	if( (screen = GetDC(NULL)) ) {
+		refreshRate = GetDeviceCaps(screen, VREFRESH);
+		ReleaseDC(NULL, screen);
+	}
+	if( refreshRate > 1 ) {
+		UiFrameInterval = 1000 / refreshRate;
+	}
+}
+
+///
+/// <summary>
+///		is this the thread that owns the windows?
+/// </summary>
+BOOL IsUiThread() {
+	return UiThreadId == 0 || GetCurrentThreadId() == UiThreadId;
+}
+
+void ReportUiStatistics() {
+	TraceInfo(L"UI: %d progress requests, %d repaints, %d wakeups", UiProgressRequests, UiProgressPaints, UiWakeups);
+}
@@ -0,0 +1,227 @@
+//-----------------------------------------------------------------------
+// <copyright company="CoApp Project">
+//     Copyright (c) 2011 Garrett Serack . All rights reserved.
+// </copyright>
+// <license>
+//     The software is licensed under the Apache 2.0 License (the "License")
+//     You may not use the software except in compliance with the License.
+// </license>
+//-----------------------------------------------------------------------
+
+#pragma once
+
+// Deciding whether a file can be trusted.
+//
+// If the bootstrapper has an ARTIFACT_MANIFEST_ID resource (RCDATA, see coapp_manifest.h)
+// then any file listed there is trusted if and only if its size and SHA-256 match. Since the
+// resource lives inside our own signed executable, that's as good as checking the file's
+// signature, and when the hash was worked out while the file was downloading it doesn't
+// cost another pass over the file.
+//
+// Anything not listed falls back to WinVerifyTrust. That answer is remembered for the life of
+// the process, keyed on the file's SHA-256 (which WinVerifyTrust costs a lot more than): not on
+// its path, size and last write time, which anyone who can write the file can put back.
+//
+// The file is held open, readers only, while it's hashed and checked, so it can't be changed
+// half way through.
+
+#define MAX_VERIFIED_FILES		64
+
+typedef struct VerifiedFile {
+	wchar_t hash[SHA256_STRING_LENGTH+1];
+	__int64 size;
+	BOOL trusted;
+} VerifiedFile;
+
+// the GUI and worker threads both verify files (and so do the download threads)
+CRITICAL_SECTION VerifyLock;
+volatile LONG ManifestLoaded = FALSE;
+ArtifactManifest Manifest;
+VerifiedFile VerifiedFiles[MAX_VERIFIED_FILES];
+int VerifiedFileCount = 0;
+int NextVerifiedFile = 0;
+
+void InitializeVerification() {
+	InitializeCriticalSection(&VerifyLock);
+}
+
+// loads the manifest out of our own resources, the first time it's needed.
+void LoadManifest() {
+	HRSRC resource;
+	HGLOBAL loaded;
+	const char* text;
+
+	if( ManifestLoaded ) {
+		return;
+	}
+
+	EnterCriticalSection(&VerifyLock);
+	__try {
+		if( ManifestLoaded ) {
+			__leave;
+		}
+		ZeroMemory(&Manifest, sizeof(Manifest));
+
+		if( (resource = FindResource(NULL, MAKEINTRESOURCE(ARTIFACT_MANIFEST_ID), RT_RCDATA)) &&
+			(loaded = LoadResource(NULL, resource)) && (text = (const char*)LockResource(loaded)) ) {
+			if( ParseArtifactManifest(text, SizeofResource(NULL, resource), &Manifest) < 0 ) {
+				TraceError(L"Ignoring the artifact manifest, it isn't valid");
+			} else {
+				TraceInfo(L"Loaded %d artifacts from the manifest", Manifest.count);
+			}
+		}
+		// nothing changes it after this, so it can be read without the lock.
+		InterlockedExchange(&ManifestLoaded, TRUE);
+	} __finally {
+		LeaveCriticalSection(&VerifyLock);
+	}
+}
+
+///
+/// <summary>
+///		finds what the manifest says about a file, by the name it's published under.
+///		returns NULL if it isn't listed (or there's no manifest).
+/// </summary>
+const ManifestArtifact* GetManifestArtifact( const wchar_t* publishedName ) {
+	LoadManifest();
+	return IsNullOrEmpty(publishedName) ? NULL : FindManifestArtifact(&Manifest, publishedName);
+}
+
+///
+/// <summary>
+///		is this language variant worth looking for? 
+///		only if the manifest lists it, or doesn't know about the file at all.
+/// </summary>
+BOOL IsVariantAvailable( const wchar_t* filename, LCID lcid ) {
+	LoadManifest();
+	return ManifestVariantAvailable(&Manifest, filename, lcid);
+}
+
+// the whole manifest (empty, if there isn't one).
+const ArtifactManifest* GetArtifactManifest() {
+	LoadManifest();
+	return &Manifest;
+}
+
+// called with VerifyLock held.
+int FindVerifiedFile( const wchar_t* hash, __int64 size ) {
+	int i;
+
+	for( i=0; i< VerifiedFileCount; i++ ) {
+		if( VerifiedFiles[i].size == size && lstrcmpi(VerifiedFiles[i].hash, hash) == 0 ) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+void RememberVerification( const wchar_t* hash, __int64 size, BOOL trusted ) {
+	VerifiedFile* entry;
+	int index;
+
+	EnterCriticalSection(&VerifyLock);
+	__try {
+		if( (index = FindVerifiedFile(hash, size)) < 0 ) {
+			if( VerifiedFileCount < MAX_VERIFIED_FILES ) {
+				index = VerifiedFileCount++;
+			} else {
+				// full; just go round and replace the oldest.
+				index = NextVerifiedFile;
+				NextVerifiedFile = (NextVerifiedFile + 1) % MAX_VERIFIED_FILES;
+			}
+		}
+		entry = &VerifiedFiles[index];
+		wcscpy_s(entry->hash, SHA256_STRING_LENGTH+1, hash);
+		entry->size = size;
+		entry->trusted = trusted;
+	} __finally {
+		LeaveCriticalSection(&VerifyLock);
+	}
+}
+
+///
+/// <summary>
+///		checks that a file is what it should be.
+///		artifactName is the name the file is published under (the path may be a temp file);
+///		if NULL, the name in the path is used.
+///		knownHash is the SHA-256 of the file if the caller already has it (say, from downloading it), or NULL.
+///		it's only taken on trust for a file the manifest lists; for WinVerifyTrust, the file is hashed
+///		as it's found, since that's what the answer is remembered by.
+///		if trustedHash isn't NULL (it holds SHA256_STRING_LENGTH+1 characters, and can be knownHash),
+///		it gets the hash the file was trusted with, so that nobody has to work it out again.
+/// </summary>
+BOOL IsTrustedFileEx( const wchar_t* path, const wchar_t* artifactName, const wchar_t* knownHash, wchar_t* trustedHash ) {
+	wchar_t hash[SHA256_STRING_LENGTH+1];
+	const ManifestArtifact* artifact = NULL;
+	HashContext context;
+	HANDLE file;
+	LARGE_INTEGER size;
+	LARGE_INTEGER started;
+	BOOL remembered = FALSE;
+	BOOL trusted = FALSE;
+	int index;
+
+	if( IsNullOrEmpty(path) ) {
+		return FALSE;
+	}
+	if( INVALID_HANDLE_VALUE == (file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL)) ) {
+		return FALSE;
+	}
+
+	size.QuadPart = 0;
+	QueryPerformanceCounter(&started);
+	__try {
+		if( !GetFileSizeEx(file, &size) ) {
+			__leave;
+		}
+
+		if( (artifact = GetManifestArtifact(artifactName ? artifactName : GetFilenameFromPath(path))) ) {
+			// the wrong size can't be right, and that doesn't need reading.
+			if( artifact->size == size.QuadPart ) {
+				if( IsNullOrEmpty(knownHash) ) {
+					knownHash = BeginHash(&context) && UpdateHashFromHandle(&context, file, -1) && FinishHash(&context, hash) ? hash : NULL;
+					AbandonHash(&context);
+				}
+				trusted = knownHash && lstrcmpi(knownHash, artifact->sha256) == 0;
+			}
+			if( !trusted ) {
+				TraceError(L"%s doesn't match the manifest", path);
+			}
+			__leave;
+		}
+
+		if( !BeginHash(&context) || !UpdateHashFromHandle(&context, file, -1) || !FinishHash(&context, hash) ) {
+			AbandonHash(&context);
+			__leave;
+		}
+
+		EnterCriticalSection(&VerifyLock);
+		__try {
+			if( (index = FindVerifiedFile(hash, size.QuadPart)) >= 0 ) {
+				// seen this already.
+				trusted = VerifiedFiles[index].trusted;
+				remembered = TRUE;
+			}
+		} __finally {
+			LeaveCriticalSection(&VerifyLock);
+		}
+		if( remembered ) {
+			__leave;
+		}
+
+		SetFilePointer(file, 0, NULL, FILE_BEGIN);
+		trusted = IsEmbeddedSignatureValid(path, file);
+		RememberVerification(hash, size.QuadPart, trusted);
+	} __finally {
+		if( trusted && trustedHash ) {
+			wcscpy_s(trustedHash, SHA256_STRING_LENGTH+1, artifact ? artifact->sha256 : hash);
+		}
+		CloseHandle(file);
+		EndPhase(PHASE_VERIFY, &started, size.QuadPart);
+	}
+	return trusted;
+}
+
+BOOL IsTrustedFile( const wchar_t* path, const wchar_t* artifactName, const wchar_t* knownHash ) {
+	return IsTrustedFileEx(path, artifactName, knownHash, NULL);
+}
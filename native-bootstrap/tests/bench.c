@@ -0,0 +1,240 @@
+//-----------------------------------------------------------------------
+// <copyright company="CoApp Project">
+//     Copyright (c) 2011 Garrett Serack . All rights reserved.
+// </copyright>
+// <license>
+//     The software is licensed under the Apache 2.0 License (the "License")
+//     You may not use the software except in compliance with the License.
+// </license>
+//-----------------------------------------------------------------------
+
+// timings for the portable parts of the bootstrapper (see coapp_platform.h): the arena strings,
+// the path and url building, and working out where to look for a file, the way AcquireFile
+// does, minus the file system and the network.
+//
+//		bench [iterations]
+
+#define BUFSIZE 8192
+
+#include "../coapp_platform.h"
+#include "../coapp_arena.h"
+#include "../coapp_string.h"
+#include "../coapp_path.h"
+#include "../coapp_manifest.h"
+#include "../coapp_candidates.h"
+#include <time.h>
+
+#define LANGUAGES		4
+#define FILES			40
+
+const unsigned long Languages[LANGUAGES] = { 1031, 1033, 1036, 1041 };
+
+// stands in for mirrors.txt: how long each server has been taking, in microseconds.
+typedef struct ServerHealth {
+	const wchar_t* server;
+	__int64 expected;
+} ServerHealth;
+
+ServerHealth Servers[] = {
+	{ L"http://additional.example.com/files", 900000 },
+	{ L"http://bootstrap.example.com/resources", 250000 },
+	{ L"http://coapp.org/resources", 400000 },
+	{ L"http://mirror-one.example.net/coapp/", 120000 },
+	{ L"http://mirror-two.example.net/", 3000000 },
+};
+
+const wchar_t* Folders[] = {
+	L"c:\\Users\\someone\\Downloads\\",
+	L"c:\\ProgramData\\.cache\\bootstrap",
+	L"c:\\Windows\\Temp",
+};
+
+ArtifactManifest Manifest;
+
+double Now() {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+void Report( const char* name, int iterations, double started ) {
+	printf("%-52s %10d %10.1f ns/op\n", name, iterations, (Now() - started) / iterations);
+}
+
+// what Sprintf used to be: a BUFSIZE buffer off the heap, formatted the same way.
+wchar_t* HeapSprintf( const wchar_t* format, ... ) {
+	wchar_t* result;
+	va_list args;
+
+	if( !(result = (wchar_t*)malloc(BUFSIZE * sizeof(wchar_t))) ) {
+		return NULL;
+	}
+	va_start(args, format);
+	StringCchVPrintf(result, BUFSIZE, format, args);
+	va_end(args);
+	return result;
+}
+
+// what ExpectedCompletionMicroseconds does with the table it keeps.
+__int64 SimulatedExpected( const wchar_t* server ) {
+	size_t i;
+
+	for( i=0; i< sizeof(Servers)/sizeof(Servers[0]); i++ ) {
+		if( ManifestNameEquals(Servers[i].server, server) ) {
+			return Servers[i].expected;
+		}
+	}
+	return 0;
+}
+
+// every file in the neutral language, most of them in the others too, some with mirrors.
+void BuildManifest() {
+	char* text = (char*)malloc(FILES * (LANGUAGES+1) * 256 + 64);
+	char* end = text;
+	int file;
+	int language;
+
+	end += sprintf(end, "%s\n", MANIFEST_HEADER);
+	for( file = 0; file < FILES; file++ ) {
+		for( language = -1; language < LANGUAGES; language++ ) {
+			if( language >= 0 && (file + language) % 3 == 0 ) {
+				continue;
+			}
+			end += sprintf(end, "file%02d.resources.dll\t%lu\t%d\t%064d%s\n", file, language < 0 ? 0 : Languages[language],
+				1000 * (file+1), file, file % 2 ? "\thttp://mirror-one.example.net/coapp/\thttp://mirror-two.example.net/" : "");
+		}
+	}
+	if( ParseArtifactManifest(text, (size_t)(end - text), &Manifest) < 0 ) {
+		printf("bench: the manifest didn't parse\n");
+		exit(1);
+	}
+	free(text);
+}
+
+///
+/// <summary>
+///		everything AcquireFile works out before it touches a disk or a server: the localized name,
+///		the paths it probes, which variants the manifest lists, and the ranked remote candidates
+///		with their urls. the candidate list comes from the same ListRemoteCandidates AcquireFile
+///		calls; only the mirror health behind the ranking is simulated. returns how many candidates there were.
+/// </summary>
+int Resolve( const wchar_t* filename, unsigned long lcid ) {
+	RemoteCandidate candidates[MAX_REMOTE_CANDIDATES];
+	__int64 expected[MAX_REMOTE_CANDIDATES];
+	CandidateServers servers;
+	const ManifestArtifact* artifact;
+	wchar_t* localizedFilename;
+	wchar_t* path;
+	BOOL tryLocalized;
+	BOOL tryNeutral;
+	int count;
+	size_t i;
+	int j;
+
+	localizedFilename = LocalizedFilename(filename, lcid);
+	tryLocalized = ManifestVariantAvailable(&Manifest, filename, lcid);
+	tryNeutral = ManifestVariantAvailable(&Manifest, filename, 0);
+
+	for( i=0; i< sizeof(Folders)/sizeof(Folders[0]); i++ ) {
+		if( tryLocalized ) {
+			path = UrlOrPathCombine(Folders[i], localizedFilename, L'\\');
+			DeleteString(&path);
+		}
+		if( tryNeutral ) {
+			path = UrlOrPathCombine(Folders[i], filename, L'\\');
+			DeleteString(&path);
+		}
+	}
+
+	servers.additional = Servers[0].server;
+	servers.bootstrap = Servers[1].server;
+	servers.coapp = Servers[2].server;
+	count = ListRemoteCandidates(candidates, &Manifest, &servers, filename, localizedFilename, lcid, tryLocalized, tryNeutral);
+
+	for( j=0; j< count; j++ ) {
+		artifact = FindManifestArtifact(&Manifest, candidates[j].filename);
+		expected[j] = SimulatedExpected(candidates[j].server) + (artifact ? artifact->size : 0);
+	}
+	SortRemoteCandidates(candidates, expected, count);
+
+	for( j=0; j< count; j++ ) {
+		path = UrlOrPathCombine(candidates[j].server, candidates[j].filename, L'/');
+		DeleteString(&path);
+	}
+	DeleteString(&localizedFilename);
+	return count;
+}
+
+int main( int argc, char** argv ) {
+	wchar_t filenames[FILES][32];
+	ArenaMark mark;
+	wchar_t* text;
+	double started;
+	int iterations = argc > 1 ? atoi(argv[1]) : 200000;
+	int candidates = 0;
+	int i;
+
+	if( iterations <= 0 ) {
+		printf("usage: bench [iterations]\n");
+		return 1;
+	}
+	BuildManifest();
+	for( i=0; i< FILES; i++ ) {
+		swprintf(filenames[i], 32, L"file%02d.resources.dll", i);
+	}
+	mark = ArenaGetMark();
+
+	started = Now();
+	for( i=0; i< iterations; i++ ) {
+		text = Sprintf(L"%s.%d.%s", L"coapp.resources", 1033, L"dll");
+		DeleteString(&text);
+	}
+	Report("Sprintf (arena)", iterations, started);
+
+	// the same formatting, into a BUFSIZE buffer off the heap: the difference is all allocation.
+	started = Now();
+	for( i=0; i< iterations; i++ ) {
+		text = HeapSprintf(L"%s.%d.%s", L"coapp.resources", 1033, L"dll");
+		free(text);
+	}
+	Report("Sprintf into malloc(BUFSIZE), for comparison", iterations, started);
+
+	started = Now();
+	for( i=0; i< iterations; i++ ) {
+		text = UrlOrPathCombine(L"http://coapp.org/resources", L"coapp.resources.1033.dll", L'/');
+		DeleteString(&text);
+	}
+	Report("UrlOrPathCombine", iterations, started);
+
+	started = Now();
+	for( i=0; i< iterations; i++ ) {
+		text = DuplicateString(L"c:\\ProgramData\\.cache\\bootstrap\\coapp.resources.dll");
+		DeleteString(&text);
+	}
+	Report("DuplicateString", iterations, started);
+
+	// strings that pile up until the caller's mark is reset, like a probe loop's.
+	started = Now();
+	for( i=0; i< iterations; i++ ) {
+		Sprintf(L"%s\\%s", Folders[i % 3], filenames[i % FILES]);
+		if( i % 64 == 63 ) {
+			ArenaReset(mark);
+		}
+	}
+	ArenaReset(mark);
+	Report("Sprintf, reset every 64", iterations, started);
+
+	started = Now();
+	for( i=0; i< iterations; i++ ) {
+		candidates += Resolve(filenames[i % FILES], Languages[i % LANGUAGES]);
+		ArenaReset(mark);
+	}
+	Report("AcquireFile resolution (no file system or network)", iterations, started);
+
+	printf("%.1f candidates per file, peak arena %ld bytes in use\n", (double)candidates / iterations, (long)ArenaPeakBytesInUse);
+
+	DestroyThreadArena();
+	FreeArtifactManifest(&Manifest);
+	return 0;
+}
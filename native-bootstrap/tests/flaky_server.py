@@ -0,0 +1,245 @@
+#!/usr/bin/env python3
+#-----------------------------------------------------------------------
+# <copyright company="CoApp Project">
+#     Copyright (c) 2011 Garrett Serack . All rights reserved.
+# </copyright>
+# <license>
+#     The software is licensed under the Apache 2.0 License (the "License")
+#     You may not use the software except in compliance with the License.
+# </license>
+#-----------------------------------------------------------------------
+
+# A download server that drops connections, for trying out resuming and revalidation
+# (DownloadFileEx and the download cache, see coapp_file.h and coapp_cache.h).
+#
+#     flaky_server.py <folder> [--port 8080] [--drop-after 65536] [--drops 2] [--no-ranges] [--weak-etags]
+#
+# Serves the files in the folder with an ETag and a Last-Modified, and honours Range/If-Range,
+# If-None-Match and If-Modified-Since. The first --drops responses for each file are cut off
+# after --drop-after bytes (of that response), so a client has to pick up where it left off
+# to get the whole thing. Touching a file changes its ETag, so a resume across a change gets
+# the whole file again, as it should. Point BootstrapServer (under HKLM\Software\CoApp) at it.
+#
+#     flaky_server.py --self-test
+#
+# serves a made-up file, and checks a client that resumes the way DownloadAttempt does gets
+# it all, in the expected number of requests.
+
+import argparse
+import email.utils
+import hashlib
+import http.client
+import os
+import re
+import sys
+import tempfile
+import threading
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+
+class FlakyServer(ThreadingHTTPServer):
+    daemon_threads = True
+
+    def __init__(self, address, folder, drop_after, drops, ranges=True, weak_etags=False, verbose=True):
+        ThreadingHTTPServer.__init__(self, address, FlakyHandler)
+        self.folder = folder
+        self.drop_after = drop_after
+        self.drops = drops
+        self.ranges = ranges
+        self.weak_etags = weak_etags
+        self.verbose = verbose
+        self.lock = threading.Lock()
+        self.dropped = {}           # how many times each file has been cut off
+        self.requests = []          # (path, status, Range) for each request
+
+    def should_drop(self, name):
+        with self.lock:
+            if self.dropped.get(name, 0) < self.drops:
+                self.dropped[name] = self.dropped.get(name, 0) + 1
+                return True
+            return False
+
+
+class FlakyHandler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def log_message(self, format, *args):
+        if self.server.verbose:
+            BaseHTTPRequestHandler.log_message(self, format, *args)
+
+    def answer(self, status, headers=(), body=b"", drop=False):
+        self.server.requests.append((self.path, status, self.headers.get("Range")))
+        self.send_response(status)
+        for name, value in headers:
+            self.send_header(name, value)
+        if drop:
+            self.send_header("Connection", "close")
+            self.close_connection = True
+        self.end_headers()
+        if body:
+            self.wfile.write(body[:self.server.drop_after] if drop else body)
+
+    def do_GET(self):
+        name = os.path.basename(self.path.split("?", 1)[0])
+        path = os.path.join(self.server.folder, name)
+        if not name or not os.path.isfile(path):
+            self.answer(404, [("Content-Length", "0")])
+            return
+
+        with open(path, "rb") as f:
+            content = f.read()
+        stat = os.stat(path)
+        etag = '%s"%x-%x"' % ("W/" if self.server.weak_etags else "", stat.st_mtime_ns, stat.st_size)
+        last_modified = email.utils.formatdate(stat.st_mtime, usegmt=True)
+        validators = [("ETag", etag), ("Last-Modified", last_modified)]
+        if self.server.ranges:
+            validators.append(("Accept-Ranges", "bytes"))
+
+        # the copy they've got is current
+        if_none_match = self.headers.get("If-None-Match")
+        if_modified_since = self.headers.get("If-Modified-Since")
+        if (if_none_match and if_none_match == etag) or (not if_none_match and if_modified_since == last_modified):
+            self.answer(304, validators)
+            return
+
+        # the rest of it, as long as it hasn't changed
+        start = 0
+        match = re.match(r"bytes=(\d+)-$", self.headers.get("Range", ""))
+        if_range = self.headers.get("If-Range")
+        if self.server.ranges and match and (if_range is None or (if_range in (etag, last_modified) and not if_range.startswith("W/"))):
+            start = int(match.group(1))
+            if start >= len(content):
+                self.answer(416, [("Content-Range", "bytes */%d" % len(content)), ("Content-Length", "0")])
+                return
+
+        body = content[start:]
+        headers = validators + [("Content-Length", str(len(body)))]
+        drop = len(body) > self.server.drop_after and self.server.should_drop(name)
+        if start:
+            self.answer(206, headers + [("Content-Range", "bytes %d-%d/%d" % (start, len(content) - 1, len(content)))], body, drop)
+        else:
+            self.answer(200, headers, body, drop)
+
+
+def download(port, name, part, etag=None):
+    """fetches a file the way DownloadAttempt does: resuming with Range/If-Range while there's a part file."""
+    requests = 0
+    validator = None
+    while requests < 10:
+        headers = {}
+        if validator and os.path.exists(part):
+            headers = {"Range": "bytes=%d-" % os.path.getsize(part), "If-Range": validator}
+        elif etag:
+            headers = {"If-None-Match": etag}
+        connection = http.client.HTTPConnection("localhost", port, timeout=5)
+        connection.request("GET", "/" + name, headers=headers)
+        response = connection.getresponse()
+        requests += 1
+        if response.status == 304:
+            connection.close()
+            return response.status, requests
+        if response.status not in (200, 206):
+            connection.close()
+            return response.status, requests
+
+        validator = response.getheader("ETag")
+        with open(part, "ab" if response.status == 206 else "wb") as f:
+            try:
+                f.write(response.read())
+                connection.close()
+                return response.status, requests
+            except http.client.IncompleteRead as partial:
+                f.write(partial.partial)
+        connection.close()
+    return None, requests
+
+
+def self_test():
+    content = os.urandom(200000)
+    failures = []
+
+    with tempfile.TemporaryDirectory() as folder:
+        served = os.path.join(folder, "served")
+        os.mkdir(served)
+        with open(os.path.join(served, "coapp.resources.dll"), "wb") as f:
+            f.write(content)
+        part = os.path.join(folder, "coapp.resources.dll.part")
+
+        server = FlakyServer(("localhost", 0), served, 65536, 2, verbose=False)
+        threading.Thread(target=server.serve_forever, daemon=True).start()
+        port = server.server_address[1]
+        try:
+            # cut off twice, picked up twice.
+            status, requests = download(port, "coapp.resources.dll", part)
+            with open(part, "rb") as f:
+                received = f.read()
+            if requests != 3 or hashlib.sha256(received).digest() != hashlib.sha256(content).digest():
+                failures.append("resuming took %d requests and got %d of %d bytes" % (requests, len(received), len(content)))
+            if [status for path, status, range in server.requests] != [200, 206, 206]:
+                failures.append("the responses were %s, not 200 206 206" % [status for path, status, range in server.requests])
+
+            # it's current.
+            connection = http.client.HTTPConnection("localhost", port, timeout=5)
+            connection.request("GET", "/coapp.resources.dll")
+            response = connection.getresponse()
+            response.read()
+            etag = response.getheader("ETag")
+            connection.close()
+            status, requests = download(port, "coapp.resources.dll", part, etag)
+            if status != 304:
+                failures.append("revalidating a current copy got a %s" % status)
+
+            # a resume across a change gets the whole new file.
+            os.remove(part)
+            server.dropped.clear()
+            server.drops = 1
+            del server.requests[:]
+            connection = http.client.HTTPConnection("localhost", port, timeout=5)
+            connection.request("GET", "/coapp.resources.dll")
+            response = connection.getresponse()
+            stale = response.getheader("ETag")
+            try:
+                response.read()
+            except http.client.IncompleteRead:
+                pass
+            connection.close()
+            os.utime(os.path.join(served, "coapp.resources.dll"), ns=(0, 1000000000))
+            connection = http.client.HTTPConnection("localhost", port, timeout=5)
+            connection.request("GET", "/coapp.resources.dll", headers={"Range": "bytes=65536-", "If-Range": stale})
+            response = connection.getresponse()
+            if response.status != 200 or len(response.read()) != len(content):
+                failures.append("a resume across a change got a %d" % response.status)
+            connection.close()
+
+            # nothing there.
+            status, requests = download(port, "coapp.resources.1031.dll", part)
+            if status != 404:
+                failures.append("a missing file got a %s" % status)
+        finally:
+            server.shutdown()
+            server.server_close()
+
+    for failure in failures:
+        print("FAIL: %s" % failure)
+    print("flaky_server: %s" % ("failed" if failures else "ok"))
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Serves files, and drops connections partway through.")
+    parser.add_argument("folder", nargs="?")
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--drop-after", type=int, default=65536, help="bytes of a response to send before cutting it off")
+    parser.add_argument("--drops", type=int, default=2, help="how many responses for each file get cut off")
+    parser.add_argument("--no-ranges", action="store_true", help="ignore Range (and don't offer it)")
+    parser.add_argument("--weak-etags", action="store_true", help="hand out W/ ETags, which can't be used with If-Range")
+    parser.add_argument("--self-test", action="store_true")
+    arguments = parser.parse_args()
+
+    if arguments.self_test:
+        sys.exit(self_test())
+    if not arguments.folder:
+        parser.error("which folder?")
+    server = FlakyServer(("", arguments.port), arguments.folder, arguments.drop_after, arguments.drops, not arguments.no_ranges, arguments.weak_etags)
+    print("Serving %s on port %d" % (arguments.folder, server.server_address[1]))
+    server.serve_forever()
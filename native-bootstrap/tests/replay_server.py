@@ -0,0 +1,254 @@
+#!/usr/bin/env python3
+#-----------------------------------------------------------------------
+# <copyright company="CoApp Project">
+#     Copyright (c) 2011 Garrett Serack . All rights reserved.
+# </copyright>
+# <license>
+#     The software is licensed under the Apache 2.0 License (the "License")
+#     You may not use the software except in compliance with the License.
+# </license>
+#-----------------------------------------------------------------------
+
+# Plays a network trace (see coapp_replay.h) back over real HTTP.
+#
+# The in-process replay (BootstrapNetworkReplay) stands in for WinHTTP; this stands in for the
+# servers instead, so the whole download path -- the connection pool, the race, the pipeline,
+# segmented downloads -- runs against what was recorded. Start it, and point
+# BootstrapNetworkRedirect (under HKLM\Software\CoApp) at it:
+#
+#     replay_server.py <trace> [--port 8080] [--speed 100]
+#
+# The bootstrapper then sends every request here with the original host and path as the path
+# (/coapp.org/resources/coapp.resources.dll), whichever server it was for. Requests are matched
+# to the recorded exchanges by that host and path, in the order they were recorded; each
+# exchange is used once. An exchange that never got a response, or a url with nothing (more)
+# recorded for it, gets the connection closed on it.
+# Data goes out in the same pieces, at the same times, and a transfer that was cut off is cut
+# off at the same place.
+#
+#     replay_server.py --self-test
+#
+# makes up a trace, plays it, and checks what comes back.
+
+import argparse
+import http.client
+import os
+import sys
+import tempfile
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+TRACE_HEADER = "CoApp network trace 1"
+
+
+class Exchange:
+    def __init__(self, index, result, status, headers_us, content_length, etag, last_modified, url):
+        self.index = index
+        self.result = result
+        self.status = status
+        self.headers_us = headers_us
+        self.content_length = content_length
+        self.etag = etag
+        self.last_modified = last_modified
+        self.url = url
+        self.samples = []       # (microseconds after the request, bytes)
+
+    @property
+    def key(self):
+        return request_key(self.url.split("://", 1)[-1])
+
+
+def request_key(host_and_path):
+    # what a request is matched on: the host and the path, without the query, whichever case they're in.
+    return host_and_path.split("?", 1)[0].lstrip("/").lower()
+
+
+def read_trace(filename):
+    with open(filename, "rb") as f:
+        lines = f.read().decode("utf-16").lstrip("\ufeff").splitlines()
+    if not lines or lines[0] != TRACE_HEADER:
+        raise ValueError("%s isn't a network trace" % filename)
+
+    exchanges = []
+    for line in lines[1:]:
+        fields = line.split("\t")
+        if fields[0] == "request" and len(fields) >= 9:
+            exchanges.append(Exchange(int(fields[1]), int(fields[2]), int(fields[3]), int(fields[4]),
+                                      int(fields[5]), fields[6], fields[7], fields[8]))
+        elif fields[0] == "data" and exchanges:
+            exchanges[-1].samples.append((int(fields[1]), int(fields[2])))
+    return exchanges
+
+
+def write_trace(filename, exchanges, bodies):
+    lines = [TRACE_HEADER]
+    for exchange in exchanges:
+        lines.append("request\t%d\t%d\t%d\t%d\t%d\t%s\t%s\t%s" % (exchange.index, exchange.result, exchange.status, exchange.headers_us,
+                                                                   exchange.content_length, exchange.etag, exchange.last_modified, exchange.url))
+        lines.extend("data\t%d\t%d" % sample for sample in exchange.samples)
+        with open("%s.%d.body" % (filename, exchange.index), "wb") as f:
+            f.write(bodies.get(exchange.index, b""))
+    with open(filename, "wb") as f:
+        f.write(("\ufeff" + "\r\n".join(lines) + "\r\n").encode("utf-16-le"))
+
+
+class ReplayServer(ThreadingHTTPServer):
+    daemon_threads = True
+
+    def __init__(self, address, trace, speed, verbose):
+        ThreadingHTTPServer.__init__(self, address, ReplayHandler)
+        self.trace = trace
+        self.verbose = verbose
+        self.speed = speed
+        self.lock = threading.Lock()
+        self.pending = {}
+        for exchange in read_trace(trace):
+            self.pending.setdefault(exchange.key, []).append(exchange)
+
+    def claim(self, path):
+        with self.lock:
+            queue = self.pending.get(request_key(path))
+            return queue.pop(0) if queue else None
+
+    def wait_until(self, started, microseconds):
+        if self.speed:
+            delay = started + microseconds / 1000000.0 * 100 / self.speed - time.monotonic()
+            if delay > 0:
+                time.sleep(delay)
+
+
+class ReplayHandler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def log_message(self, format, *args):
+        if self.server.verbose:
+            BaseHTTPRequestHandler.log_message(self, format, *args)
+
+    def do_GET(self):
+        started = time.monotonic()
+        exchange = self.server.claim(self.path)
+        if exchange is None or exchange.status == 0:
+            if exchange:
+                self.server.wait_until(started, exchange.headers_us)
+            self.close_connection = True
+            return
+
+        self.server.wait_until(started, exchange.headers_us)
+        self.send_response(exchange.status)
+        complete = exchange.result >= 0
+        if exchange.status == 200 and exchange.content_length >= 0:
+            self.send_header("Content-Length", str(exchange.content_length))
+        elif exchange.status != 200:
+            self.send_header("Content-Length", "0")
+        if exchange.etag:
+            self.send_header("ETag", exchange.etag)
+        if exchange.last_modified:
+            self.send_header("Last-Modified", exchange.last_modified)
+        if not complete or exchange.content_length < 0:
+            self.send_header("Connection", "close")
+            self.close_connection = True
+        self.end_headers()
+        if exchange.status != 200:
+            return
+
+        with open("%s.%d.body" % (self.server.trace, exchange.index), "rb") as body:
+            for offset, count in exchange.samples:
+                self.server.wait_until(started, offset)
+                data = body.read(count)
+                if not data:
+                    break
+                self.wfile.write(data)
+                self.wfile.flush()
+        if not complete:
+            # cut off (or stalled) when it was recorded; it's cut off here too.
+            self.close_connection = True
+
+
+def serve(trace, port, speed, verbose=True):
+    return ReplayServer(("", port), trace, speed, verbose)
+
+
+def self_test():
+    content = os.urandom(300000)
+    first = Exchange(0, len(content), 200, 50000, len(content), '"v1"', "", "http://coapp.org/resources/coapp.resources.dll")
+    first.samples = [(60000, 100000), (90000, 100000), (120000, 100000)]
+    missing = Exchange(1, -23, 404, 10000, 0, "", "", "http://coapp.org/resources/coapp.resources.1031.dll")
+    dropped = Exchange(2, -9, 0, 20000, -1, "", "", "http://mirror.example/resources/CoApp.Client.Bootstrap.exe")
+    truncated = Exchange(3, -29, 200, 10000, len(content), '"v1"', "", "http://coapp.org/resources/dotNetFx40_Full_setup.exe")
+    truncated.samples = [(20000, 1000)]
+
+    with tempfile.TemporaryDirectory() as folder:
+        trace = os.path.join(folder, "trace.txt")
+        write_trace(trace, [first, missing, dropped, truncated], {0: content, 3: content[:1000]})
+
+        server = serve(trace, 0, 100, verbose=False)
+        thread = threading.Thread(target=server.serve_forever, daemon=True)
+        thread.start()
+        port = server.server_address[1]
+        failures = []
+
+        def get(path):
+            connection = http.client.HTTPConnection("localhost", port, timeout=5)
+            connection.request("GET", path)
+            return connection, connection.getresponse()
+
+        try:
+            started = time.monotonic()
+            connection, response = get("/coapp.org/resources/coapp.resources.dll")
+            body = response.read()
+            elapsed = time.monotonic() - started
+            if response.status != 200 or body != content or response.getheader("ETag") != '"v1"':
+                failures.append("the recorded download didn't come back as it was")
+            if elapsed < 0.12:
+                failures.append("the recorded download came back in %.3fs, faster than it was recorded" % elapsed)
+            connection.close()
+
+            connection, response = get("/coapp.org/resources/coapp.resources.1031.dll")
+            if response.status != 404:
+                failures.append("the recorded 404 came back as %d" % response.status)
+            connection.close()
+
+            for path, what in (("/mirror.example/resources/CoApp.Client.Bootstrap.exe", "the dropped connection"),
+                               ("/coapp.org/resources/coapp.resources.dll", "an exchange that was used up"),
+                               ("/mirror.example/resources/dotNetFx40_Full_setup.exe", "the same file off a different host")):
+                try:
+                    connection, response = get(path)
+                    failures.append("%s got a %d" % (what, response.status))
+                except (http.client.HTTPException, ConnectionError):
+                    pass
+                connection.close()
+
+            connection, response = get("/COAPP.ORG/resources/dotNetFx40_Full_setup.exe")
+            try:
+                body = response.read()
+                failures.append("the cut off download came back whole (%d bytes)" % len(body))
+            except http.client.IncompleteRead as partial:
+                if len(partial.partial) != 1000:
+                    failures.append("the cut off download stopped at %d, not 1000" % len(partial.partial))
+            connection.close()
+        finally:
+            server.shutdown()
+            server.server_close()
+
+    for failure in failures:
+        print("FAIL: %s" % failure)
+    print("replay_server: %s" % ("failed" if failures else "ok"))
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Plays a CoApp network trace back over HTTP.")
+    parser.add_argument("trace", nargs="?")
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--speed", type=int, default=100, help="percent; 0 is no waiting at all")
+    parser.add_argument("--self-test", action="store_true")
+    arguments = parser.parse_args()
+
+    if arguments.self_test:
+        sys.exit(self_test())
+    if not arguments.trace:
+        parser.error("which trace?")
+    server = serve(arguments.trace, arguments.port, arguments.speed)
+    print("Replaying %s on port %d" % (arguments.trace, server.server_address[1]))
+    server.serve_forever()
@@ -0,0 +1,172 @@
+//-----------------------------------------------------------------------
+// <copyright company="CoApp Project">
+//     Copyright (c) 2011 Garrett Serack . All rights reserved.
+// </copyright>
+// <license>
+//     The software is licensed under the Apache 2.0 License (the "License")
+//     You may not use the software except in compliance with the License.
+// </license>
+//-----------------------------------------------------------------------
+
+// A stand-in for the .NET installer, for trying out MonitorChainedInstaller (CoAppBootstrap.c).
+//
+// It takes the same command line the bootstrapper gives the real one, opens the shared
+// MmioDataStructure named by /pipe, and then moves the download and install progress along
+// as fast as it's told to, signalling the chainer's event on every step -- far more often
+// than the progress bar can move, which is the point. It stops when it's done, or as soon as
+// the chainer sets an abort flag.
+//
+//		stub_chainee.exe /pipe <section> [/rate <signals a second>] [/seconds <n>] [/fail <hresult>] [/crash]
+//
+//	/rate		how often to signal (default 10000; 0 is as fast as it can)
+//	/seconds	how long the whole thing takes (default 5)
+//	/fail		what to finish with, instead of S_OK
+//	/crash		go away half way through without saying anything
+//
+// Windows only (unlike the rest of tests\): cl /W3 stub_chainee.c
+// To have the bootstrapper run it, sign it (with the certificate in test-certificate\, which
+// has to be trusted on the test box) and put it next to the bootstrapper as
+// dotNetFx40_Full_setup.exe, on a box without .NET 4.
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// has to match CoAppBootstrap.c (and the .NET chainer documentation)
+typedef struct MmioDataStructure {
+	char m_downloadFinished;
+	char m_installFinished;
+	char m_downloadAbort;
+	char m_installAbort;
+	HRESULT m_hrDownloadFinished;
+	HRESULT m_hrInstallFinished;
+	HRESULT m_hrInternalError;
+	WCHAR m_szCurrentItemStep[MAX_PATH];
+	unsigned char m_downloadProgressSoFar;
+	unsigned char m_installProgressSoFar;
+	WCHAR m_szEventName[MAX_PATH];
+} MmioDataStructure;
+
+#define PROGRESS_STEPS		(2*255)		// the download's 255, then the install's
+
+const wchar_t* Argument( int argc, wchar_t** argv, const wchar_t* name ) {
+	int i;
+
+	for( i=1; i< argc-1; i++ ) {
+		if( lstrcmpi(argv[i], name) == 0 ) {
+			return argv[i+1];
+		}
+	}
+	return NULL;
+}
+
+BOOL Switch( int argc, wchar_t** argv, const wchar_t* name ) {
+	int i;
+
+	for( i=1; i< argc; i++ ) {
+		if( lstrcmpi(argv[i], name) == 0 ) {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+void Finish( MmioDataStructure* mmio, HANDLE event, HRESULT result ) {
+	mmio->m_hrDownloadFinished = SUCCEEDED(result) ? S_OK : result;
+	mmio->m_hrInstallFinished = result;
+	mmio->m_downloadFinished = TRUE;
+	mmio->m_installFinished = TRUE;
+	SetEvent(event);
+}
+
+int wmain( int argc, wchar_t** argv ) {
+	const wchar_t* section = Argument(argc, argv, L"/pipe");
+	const wchar_t* value;
+	DWORD rate = 10000;
+	DWORD seconds = 5;
+	HRESULT outcome = S_OK;
+	BOOL crash = Switch(argc, argv, L"/crash");
+	HANDLE mapping;
+	HANDLE event;
+	MmioDataStructure* mmio;
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER started;
+	LARGE_INTEGER now;
+	__int64 elapsed;
+	__int64 signals = 0;
+	__int64 due;
+	HRESULT finished;
+	int step;
+
+	if( (value = Argument(argc, argv, L"/rate")) ) {
+		rate = wcstoul(value, NULL, 10);
+	}
+	if( (value = Argument(argc, argv, L"/seconds")) ) {
+		seconds = wcstoul(value, NULL, 10);
+	}
+	if( (value = Argument(argc, argv, L"/fail")) ) {
+		outcome = (HRESULT)wcstoul(value, NULL, 0);
+	}
+
+	if( !section ) {
+		fwprintf(stderr, L"usage: stub_chainee /pipe <section> [/rate <n>] [/seconds <n>] [/fail <hresult>] [/crash]\n");
+		return 1;
+	}
+	if( !(mapping = OpenFileMapping(FILE_MAP_WRITE, FALSE, section)) ||
+		!(mmio = (MmioDataStructure*)MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, sizeof(MmioDataStructure))) ) {
+		fwprintf(stderr, L"can't open %s: %d\n", section, GetLastError());
+		return 2;
+	}
+	if( !(event = OpenEvent(EVENT_MODIFY_STATE, FALSE, mmio->m_szEventName)) ) {
+		fwprintf(stderr, L"can't open %s: %d\n", mmio->m_szEventName, GetLastError());
+		return 3;
+	}
+
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&started);
+
+	for( ;; ) {
+		if( mmio->m_downloadAbort || mmio->m_installAbort ) {
+			Finish(mmio, event, E_ABORT);
+			break;
+		}
+
+		QueryPerformanceCounter(&now);
+		elapsed = (now.QuadPart - started.QuadPart) * 1000 / frequency.QuadPart;		// milliseconds
+		step = seconds ? (int)(elapsed * PROGRESS_STEPS / (seconds * 1000)) : PROGRESS_STEPS;
+		if( step >= PROGRESS_STEPS ) {
+			mmio->m_downloadProgressSoFar = 255;
+			mmio->m_installProgressSoFar = 255;
+			Finish(mmio, event, outcome);
+			break;
+		}
+		if( crash && step >= PROGRESS_STEPS/2 ) {
+			ExitProcess(0xdead);
+		}
+
+		mmio->m_downloadProgressSoFar = (unsigned char)(step < 255 ? step : 255);
+		mmio->m_installProgressSoFar = (unsigned char)(step < 255 ? 0 : step - 255);
+		SetEvent(event);
+		signals++;
+
+		// keep to the rate (sleeping when there's more than a millisecond to spare).
+		if( rate ) {
+			due = signals * 1000 / rate;
+			if( due > elapsed + 1 ) {
+				Sleep((DWORD)(due - elapsed - 1));
+			} else {
+				YieldProcessor();
+			}
+		}
+	}
+
+	QueryPerformanceCounter(&now);
+	finished = mmio->m_hrInstallFinished;
+	wprintf(L"%I64d signals in %I64d ms, finished with 0x%08x\n", signals, (now.QuadPart - started.QuadPart) * 1000 / frequency.QuadPart, finished);
+
+	UnmapViewOfFile(mmio);
+	CloseHandle(mapping);
+	CloseHandle(event);
+	return SUCCEEDED(finished) ? 0 : 4;
+}
@@ -0,0 +1,235 @@
+//-----------------------------------------------------------------------
+// <copyright company="CoApp Project">
+//     Copyright (c) 2011 Garrett Serack . All rights reserved.
+// </copyright>
+// <license>
+//     The software is licensed under the Apache 2.0 License (the "License")
+//     You may not use the software except in compliance with the License.
+// </license>
+//-----------------------------------------------------------------------
+
+// coapp_detect.h, off Windows: DetectFrameworks against a made-up registry.
+
+#include <stdio.h>
+#include "../coapp_detect.h"
+
+#define MAX_FAKE_VALUES		8
+#define MAX_FAKE_KEYS		4
+
+typedef struct FakeValue {
+	const wchar_t* name;
+	unsigned long value;
+	int isDword;
+} FakeValue;
+
+typedef struct FakeKey {
+	const wchar_t* path;
+	FakeValue values[MAX_FAKE_VALUES];
+	int opens;
+	int open;				// how many times it's open right now
+} FakeKey;
+
+typedef struct FakeRegistry {
+	FakeKey keys[MAX_FAKE_KEYS];
+	int lookups;			// openKey calls, whether the key was there or not
+	int queries;			// queryDword calls
+	int badHandles;			// calls with a key that isn't open
+} FakeRegistry;
+
+int Failures = 0;
+
+#define CHECK(condition) do { if( !(condition) ) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #condition); Failures++; } } while(0)
+
+void* FakeOpenKey( void* context, const wchar_t* path ) {
+	FakeRegistry* registry = (FakeRegistry*)context;
+	int i;
+
+	registry->lookups++;
+	for( i=0; i< MAX_FAKE_KEYS; i++ ) {
+		if( registry->keys[i].path && wcscmp(registry->keys[i].path, path) == 0 ) {
+			registry->keys[i].opens++;
+			registry->keys[i].open++;
+			return &registry->keys[i];
+		}
+	}
+	return NULL;
+}
+
+int FakeQueryDword( void* context, void* handle, const wchar_t* name, unsigned long* value ) {
+	FakeRegistry* registry = (FakeRegistry*)context;
+	FakeKey* key = (FakeKey*)handle;
+	int i;
+
+	registry->queries++;
+	if( key == NULL || key->open <= 0 ) {
+		registry->badHandles++;
+		return 0;
+	}
+	for( i=0; i< MAX_FAKE_VALUES && key->values[i].name; i++ ) {
+		if( wcscmp(key->values[i].name, name) == 0 ) {
+			if( !key->values[i].isDword ) {
+				return 0;
+			}
+			*value = key->values[i].value;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void FakeCloseKey( void* context, void* handle ) {
+	FakeRegistry* registry = (FakeRegistry*)context;
+	FakeKey* key = (FakeKey*)handle;
+
+	if( key == NULL || key->open <= 0 ) {
+		registry->badHandles++;
+		return;
+	}
+	key->open--;
+}
+
+// adds a key (full or client) with an Install value, and a Release value if release isn't 0.
+void AddKey( FakeRegistry* registry, int slot, const wchar_t* path, unsigned long install, unsigned long release ) {
+	FakeKey* key = &registry->keys[slot];
+
+	key->path = path;
+	key->values[0].name = L"Install";
+	key->values[0].value = install;
+	key->values[0].isDword = 1;
+	if( release ) {
+		key->values[1].name = L"Release";
+		key->values[1].value = release;
+		key->values[1].isDword = 1;
+	}
+}
+
+// runs detection, and checks every key that was opened was opened once and closed again.
+void Detect( FakeRegistry* registry, FrameworkSnapshot* snapshot ) {
+	DetectionBackend backend;
+	int i;
+
+	backend.context = registry;
+	backend.openKey = FakeOpenKey;
+	backend.queryDword = FakeQueryDword;
+	backend.closeKey = FakeCloseKey;
+
+	DetectFrameworks(&backend, snapshot);
+
+	CHECK(registry->lookups == 2);
+	CHECK(registry->badHandles == 0);
+	CHECK(snapshot->queries == registry->queries);
+	for( i=0; i< MAX_FAKE_KEYS; i++ ) {
+		CHECK(registry->keys[i].opens <= 1);
+		CHECK(registry->keys[i].open == 0);
+	}
+}
+
+void TestNothingInstalled() {
+	FakeRegistry registry;
+	FrameworkSnapshot snapshot;
+
+	memset(&registry, 0, sizeof(registry));
+	Detect(&registry, &snapshot);
+	CHECK(snapshot.version == FRAMEWORK_NONE && !snapshot.fullInstalled && !snapshot.clientInstalled);
+	CHECK(snapshot.queries == 0);
+}
+
+void TestPlain40() {
+	FakeRegistry registry;
+	FrameworkSnapshot snapshot;
+
+	memset(&registry, 0, sizeof(registry));
+	AddKey(&registry, 0, NDP_V4_FULL_KEY, 1, 0);
+	AddKey(&registry, 1, NDP_V4_CLIENT_KEY, 1, 0);
+	Detect(&registry, &snapshot);
+	CHECK(snapshot.fullInstalled && snapshot.clientInstalled && snapshot.release == 0);
+	CHECK(snapshot.version == FRAMEWORK_40);
+	CHECK(snapshot.queries == 3);
+}
+
+void TestClientOnly() {
+	FakeRegistry registry;
+	FrameworkSnapshot snapshot;
+
+	memset(&registry, 0, sizeof(registry));
+	AddKey(&registry, 0, NDP_V4_CLIENT_KEY, 1, 0);
+	Detect(&registry, &snapshot);
+	CHECK(!snapshot.fullInstalled && snapshot.clientInstalled && snapshot.version == FRAMEWORK_40);
+	CHECK(snapshot.queries == 1);
+}
+
+void TestNotInstalled() {
+	FakeRegistry registry;
+	FrameworkSnapshot snapshot;
+
+	// the keys are left behind, but Install isn't 1.
+	memset(&registry, 0, sizeof(registry));
+	AddKey(&registry, 0, NDP_V4_FULL_KEY, 0, 528040);
+	AddKey(&registry, 1, NDP_V4_CLIENT_KEY, 2, 0);
+	Detect(&registry, &snapshot);
+	CHECK(!snapshot.fullInstalled && !snapshot.clientInstalled && snapshot.version == FRAMEWORK_NONE);
+}
+
+void TestWrongType() {
+	FakeRegistry registry;
+	FrameworkSnapshot snapshot;
+
+	// a Release that isn't a DWORD doesn't count; Install as a string doesn't either.
+	memset(&registry, 0, sizeof(registry));
+	AddKey(&registry, 0, NDP_V4_FULL_KEY, 1, 528040);
+	registry.keys[0].values[1].isDword = 0;
+	AddKey(&registry, 1, NDP_V4_CLIENT_KEY, 1, 0);
+	registry.keys[1].values[0].isDword = 0;
+	Detect(&registry, &snapshot);
+	CHECK(snapshot.fullInstalled && !snapshot.clientInstalled && snapshot.release == 0 && snapshot.version == FRAMEWORK_40);
+}
+
+void TestReleases() {
+	static const struct {
+		unsigned long release;
+		FrameworkVersion version;
+		const wchar_t* name;
+	} cases[] = {
+		{ 1,      FRAMEWORK_40,  L"4.0" },
+		{ 378388, FRAMEWORK_40,  L"4.0" },
+		{ 378389, FRAMEWORK_45,  L"4.5" },
+		{ 378675, FRAMEWORK_451, L"4.5.1" },
+		{ 379893, FRAMEWORK_452, L"4.5.2" },
+		{ 393295, FRAMEWORK_46,  L"4.6" },
+		{ 394254, FRAMEWORK_461, L"4.6.1" },
+		{ 394802, FRAMEWORK_462, L"4.6.2" },
+		{ 460798, FRAMEWORK_47,  L"4.7" },
+		{ 461308, FRAMEWORK_471, L"4.7.1" },
+		{ 461807, FRAMEWORK_471, L"4.7.1" },
+		{ 461808, FRAMEWORK_472, L"4.7.2" },
+		{ 528040, FRAMEWORK_48,  L"4.8" },
+		{ 533325, FRAMEWORK_48,  L"4.8" },
+	};
+	FakeRegistry registry;
+	FrameworkSnapshot snapshot;
+	size_t i;
+
+	for( i=0; i< sizeof(cases)/sizeof(cases[0]); i++ ) {
+		memset(&registry, 0, sizeof(registry));
+		AddKey(&registry, 0, NDP_V4_FULL_KEY, 1, cases[i].release);
+		Detect(&registry, &snapshot);
+		if( snapshot.version != cases[i].version || wcscmp(FrameworkVersionName(snapshot.version), cases[i].name) ) {
+			printf("FAIL: release %lu came out as %ls\n", cases[i].release, FrameworkVersionName(snapshot.version));
+			Failures++;
+		}
+		CHECK(snapshot.release == cases[i].release && snapshot.queries == 2);
+	}
+	CHECK(wcscmp(FrameworkVersionName(FRAMEWORK_NONE), L"none") == 0);
+}
+
+int main() {
+	TestNothingInstalled();
+	TestPlain40();
+	TestClientOnly();
+	TestNotInstalled();
+	TestWrongType();
+	TestReleases();
+
+	printf("test_detect: %s\n", Failures ? "failed" : "ok");
+	return Failures ? 1 : 0;
+}
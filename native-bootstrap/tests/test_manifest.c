@@ -0,0 +1,122 @@
+//-----------------------------------------------------------------------
+// <copyright company="CoApp Project">
+//     Copyright (c) 2011 Garrett Serack . All rights reserved.
+// </copyright>
+// <license>
+//     The software is licensed under the Apache 2.0 License (the "License")
+//     You may not use the software except in compliance with the License.
+// </license>
+//-----------------------------------------------------------------------
+
+// coapp_manifest.h, off Windows: parsing, the published names, and the lookups.
+
+#include <stdio.h>
+#include "../coapp_manifest.h"
+
+#define HASH_A	"0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+#define HASH_B	"FEDCBA9876543210FEDCBA9876543210FEDCBA9876543210FEDCBA9876543210"
+
+int Failures = 0;
+
+#define CHECK(condition) do { if( !(condition) ) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #condition); Failures++; } } while(0)
+
+int Parse( const char* text, ArtifactManifest* manifest ) {
+	return ParseArtifactManifest(text, strlen(text), manifest);
+}
+
+// a manifest that mustn't parse
+void CheckRejected( const char* text ) {
+	ArtifactManifest manifest;
+
+	if( Parse(text, &manifest) != -1 ) {
+		printf("FAIL: accepted \"%s\"\n", text);
+		Failures++;
+		FreeArtifactManifest(&manifest);
+	}
+	CHECK(manifest.artifacts == NULL && manifest.count == 0);
+}
+
+void TestValid() {
+	ArtifactManifest manifest;
+	const ManifestArtifact* artifact;
+	const char* text =
+		"\xef\xbb\xbf" MANIFEST_HEADER "\r\n"
+		"# the resources\r\n"
+		"coapp.resources.dll\t0\t123456\t" HASH_A "\r\n"
+		"\r\n"
+		"coapp.resources.dll\t1031\t2048\t" HASH_B "\thttp://mirror.one/\thttp://mirror.two/files/\r\n"
+		"README\t1036\t1\t" HASH_A "\n"
+		"r\xc3\xa9sum\xc3\xa9.exe\t0\t0\t" HASH_A;
+
+	CHECK(Parse(text, &manifest) == 4);
+
+	artifact = FindManifestArtifact(&manifest, L"COAPP.RESOURCES.DLL");
+	CHECK(artifact != NULL && artifact->lcid == 0 && artifact->size == 123456 && artifact->mirrorCount == 0);
+	CHECK(artifact != NULL && wcscmp(artifact->sha256, L"" HASH_A) == 0);
+
+	artifact = FindManifestArtifact(&manifest, L"coapp.resources.1031.dll");
+	CHECK(artifact != NULL && artifact->lcid == 1031 && artifact->size == 2048);
+	CHECK(artifact != NULL && wcscmp(artifact->sha256, L"fedcba9876543210fedcba9876543210fedcba9876543210fedcba9876543210") == 0);
+	CHECK(artifact != NULL && artifact->mirrorCount == 2 && wcscmp(artifact->mirrors[1], L"http://mirror.two/files/") == 0);
+	CHECK(artifact == FindManifestVariant(&manifest, L"Coapp.Resources.dll", 1031));
+
+	CHECK(FindManifestArtifact(&manifest, L"README.1036") != NULL);
+	CHECK(FindManifestArtifact(&manifest, L"r\x00e9sum\x00e9.exe") != NULL);
+	CHECK(FindManifestVariant(&manifest, L"coapp.resources.dll", 1033) == NULL);
+	CHECK(FindManifestArtifact(&manifest, L"coapp.resources") == NULL);
+	CHECK(ManifestListsFile(&manifest, L"readme") && !ManifestListsFile(&manifest, L"other.dll"));
+
+	FreeArtifactManifest(&manifest);
+}
+
+void TestEmpty() {
+	ArtifactManifest manifest;
+
+	CHECK(Parse(MANIFEST_HEADER "\r\n", &manifest) == 0);
+	CHECK(FindManifestArtifact(&manifest, L"coapp.resources.dll") == NULL);
+	FreeArtifactManifest(&manifest);
+
+	CHECK(Parse(MANIFEST_HEADER, &manifest) == 0);
+	FreeArtifactManifest(&manifest);
+}
+
+void TestInvalid() {
+	CheckRejected("");
+	CheckRejected("CoAppBootstrapManifest 2\r\n");
+	CheckRejected("a.dll\t0\t1\t" HASH_A "\r\n");
+	CheckRejected(MANIFEST_HEADER "\r\na.dll\t0\t1\r\n");										// no hash
+	CheckRejected(MANIFEST_HEADER "\r\na.dll\t0\t1\t" HASH_A "0\r\n");							// hash too long
+	CheckRejected(MANIFEST_HEADER "\r\na.dll\t0\t1\t0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdeg\r\n");
+	CheckRejected(MANIFEST_HEADER "\r\na.dll\t-1\t1\t" HASH_A "\r\n");							// lcid
+	CheckRejected(MANIFEST_HEADER "\r\na.dll\t4294967296\t1\t" HASH_A "\r\n");
+	CheckRejected(MANIFEST_HEADER "\r\na.dll\t0\t1x\t" HASH_A "\r\n");							// size
+	CheckRejected(MANIFEST_HEADER "\r\na.dll\t0\t1234567890123456789\t" HASH_A "\r\n");
+	CheckRejected(MANIFEST_HEADER "\r\n\t0\t1\t" HASH_A "\r\n");									// no name
+	CheckRejected(MANIFEST_HEADER "\r\na.dll\t0\t1\t" HASH_A "\t\r\n");							// empty mirror
+	CheckRejected(MANIFEST_HEADER "\r\na.dll\t0\t1\t" HASH_A "\ta\tb\tc\td\te\r\n");				// too many mirrors
+	CheckRejected(MANIFEST_HEADER "\r\n\xc3\x28.dll\t0\t1\t" HASH_A "\r\n");						// bad UTF-8
+	CheckRejected(MANIFEST_HEADER "\r\n\xe2\x82.dll\t0\t1\t" HASH_A "\r\n");
+	CheckRejected(MANIFEST_HEADER "\r\n\xf4\x90\x80\x80.dll\t0\t1\t" HASH_A "\r\n");				// past U+10FFFF
+	CheckRejected(MANIFEST_HEADER "\r\nb.dll\t0\t1\t" HASH_A "\r\na.dll\t0\t1\r\n");				// one bad line spoils it
+}
+
+void TestPublishedNames() {
+	wchar_t* name;
+
+	CHECK((name = ManifestPublishedName(L"coapp.resources.dll", 0)) && wcscmp(name, L"coapp.resources.dll") == 0);
+	free(name);
+	CHECK((name = ManifestPublishedName(L"coapp.resources.dll", 1031)) && wcscmp(name, L"coapp.resources.1031.dll") == 0);
+	free(name);
+	CHECK((name = ManifestPublishedName(L"README", 4294967295UL)) && wcscmp(name, L"README.4294967295") == 0);
+	free(name);
+}
+
+int main() {
+	TestValid();
+	TestEmpty();
+	TestInvalid();
+	TestPublishedNames();
+
+	printf("test_manifest: %s\n", Failures ? "failed" : "ok");
+	return Failures ? 1 : 0;
+}
@@ -0,0 +1,146 @@
+//-----------------------------------------------------------------------
+// <copyright company="CoApp Project">
+//     Copyright (c) 2011 Garrett Serack . All rights reserved.
+// </copyright>
+// <license>
+//     The software is licensed under the Apache 2.0 License (the "License")
+//     You may not use the software except in compliance with the License.
+// </license>
+//-----------------------------------------------------------------------
+
+// the arena strings, paths and remote candidate list, off Windows (see coapp_platform.h).
+
+#define BUFSIZE 8192
+
+#include "../coapp_platform.h"
+#include "../coapp_arena.h"
+#include "../coapp_string.h"
+#include "../coapp_path.h"
+#include "../coapp_manifest.h"
+#include "../coapp_candidates.h"
+
+int Failures = 0;
+
+#define CHECK(condition) do { if( !(condition) ) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #condition); Failures++; } } while(0)
+
+#define CHECK_STRING(text, expected) do { const wchar_t* value = (text); if( !value || wcscmp(value, expected) ) { printf("FAIL %s:%d: %ls, not %ls\n", __FILE__, __LINE__, value ? value : L"(null)", expected); Failures++; } } while(0)
+
+HRESULT Format( wchar_t* buffer, size_t count, const wchar_t* format, ... ) {
+	HRESULT result;
+	va_list args;
+
+	va_start(args, format);
+	result = StringCchVPrintf(buffer, count, format, args);
+	va_end(args);
+	return result;
+}
+
+// the Windows formats, which the code is written against.
+void TestSprintf() {
+	wchar_t buffer[8];
+	wchar_t longer[400];
+	ArenaMark mark;
+	__int64 big = 1234567890123LL;
+	int i;
+
+	CHECK_STRING(Sprintf(L"%s.%d.%s", L"coapp", 1033, L"dll"), L"coapp.1033.dll");
+	CHECK_STRING(Sprintf(L"%s%c%s", L"c:\\temp", L'\\', L"file"), L"c:\\temp\\file");
+	CHECK_STRING(Sprintf(L"[%hs] [%S] [%ls]", "narrow", "narrow", L"wide"), L"[narrow] [narrow] [wide]");
+	CHECK_STRING(Sprintf(L"%I64d bytes, 100%%", big), L"1234567890123 bytes, 100%");
+	CHECK_STRING(Sprintf(L"%-4s|%5.1f|%08x", L"ab", 2.5, 255u), L"ab  |  2.5|000000ff");
+	CHECK_STRING(Sprintf(L""), L"");
+
+	// too long for the stack: formatted in the arena instead, and still only as long as it needs to be.
+	for( i=0; i< 399; i++ ) {
+		longer[i] = L'a' + i % 26;
+	}
+	longer[399] = 0;
+	CHECK_STRING(Sprintf(L"%s", longer), longer);
+	mark = ArenaGetMark();
+	Sprintf(L"%s", longer);
+	CHECK(CurrentArena()->bytesInUse - mark.bytesInUse <= 400*sizeof(wchar_t) + ARENA_ALIGNMENT);
+	ArenaReset(mark);
+
+	// too long: as much as fits, and a failure.
+	CHECK(!SUCCEEDED(Format(buffer, 8, L"%s", L"0123456789")));
+	CHECK(wcslen(buffer) < 8);
+}
+
+void TestPaths() {
+	CHECK_STRING(UrlOrPathCombine(L"http://coapp.org/resources", L"a.dll", L'/'), L"http://coapp.org/resources/a.dll");
+	CHECK_STRING(UrlOrPathCombine(L"http://coapp.org/resources/", L"a.dll", L'/'), L"http://coapp.org/resources/a.dll");
+	CHECK_STRING(UrlOrPathCombine(NULL, L"a.dll", L'\\'), L"a.dll");
+	CHECK_STRING(UrlOrPathCombine(L"c:\\", NULL, L'\\'), L"c:\\");
+	CHECK_STRING(UrlOrPathCombine(NULL, NULL, L'\\'), L"");
+
+	CHECK_STRING(GetFolderFromPath(L"c:\\program files\\coapp\\bootstrap.exe"), L"c:\\program files\\coapp\\");
+	CHECK_STRING(GetFolderFromPath(L"bootstrap.exe"), L"");
+	CHECK_STRING(GetFilenameFromPath(L"c:\\program files\\coapp\\bootstrap.exe"), L"bootstrap.exe");
+	CHECK_STRING(GetFilenameFromPath(L"bootstrap.exe"), L"bootstrap.exe");
+
+	CHECK_STRING(GetExtension(L"coapp.resources.dll"), L"dll");
+	CHECK(GetExtension(L"README") == NULL);
+	CHECK_STRING(GetFilenameWithoutExtension(L"coapp.resources.dll"), L"coapp.resources");
+	CHECK_STRING(LocalizedFilename(L"coapp.resources.dll", 1031), L"coapp.resources.1031.dll");
+}
+
+void TestCandidates() {
+	const char* text =
+		MANIFEST_HEADER "\n"
+		"a.dll\t0\t10\t0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef\thttp://m1/\thttp://m2/\n";
+	ArtifactManifest manifest;
+	RemoteCandidate candidates[MAX_REMOTE_CANDIDATES];
+	__int64 expected[MAX_REMOTE_CANDIDATES];
+	CandidateServers servers = { L"http://extra/", L"http://boot/", NULL };
+	int count = 0;
+
+	CHECK(ParseArtifactManifest(text, strlen(text), &manifest) == 1);
+
+	AddRemoteCandidate(candidates, &count, NULL, L"a.dll");		// no server: not added
+	AddRemoteCandidate(candidates, &count, L"http://extra/", L"a.dll");
+	AddRemoteCandidate(candidates, &count, L"http://boot/", L"a.1031.dll");
+	AddRemoteCandidate(candidates, &count, L"http://coapp/", L"a.1031.dll");
+	AddRemoteCandidate(candidates, &count, L"http://boot/", L"A.DLL");
+	AddManifestMirrors(candidates, &count, FindManifestVariant(&manifest, L"a.dll", 0));
+	CHECK(count == 6);
+	CHECK(candidates[5].server != NULL && wcscmp(candidates[5].server, L"http://m2/") == 0);
+
+	// runs are [0], [1 2], [3 4 5]: nothing moves between them.
+	expected[0] = 50; expected[1] = 30; expected[2] = 10; expected[3] = 20; expected[4] = 5; expected[5] = 20;
+	SortRemoteCandidates(candidates, expected, count);
+	CHECK(wcscmp(candidates[0].server, L"http://extra/") == 0);
+	CHECK(wcscmp(candidates[1].server, L"http://coapp/") == 0 && wcscmp(candidates[2].server, L"http://boot/") == 0);
+	CHECK(wcscmp(candidates[3].server, L"http://m1/") == 0 && wcscmp(candidates[4].server, L"http://boot/") == 0);
+	CHECK(wcscmp(candidates[5].server, L"http://m2/") == 0);
+	CHECK(expected[1] == 10 && expected[3] == 5 && expected[4] == 20);
+
+	// the manifest only lists the neutral a.dll, so there's no point asking for a.1031.dll.
+	CHECK(ManifestVariantAvailable(&manifest, L"a.dll", 0) && !ManifestVariantAvailable(&manifest, L"a.dll", 1031));
+	CHECK(ManifestVariantAvailable(&manifest, L"b.dll", 1031));
+	count = ListRemoteCandidates(candidates, &manifest, &servers, L"a.dll", L"a.1031.dll", 1031, 0, 1);
+	CHECK(count == 4);
+	CHECK(wcscmp(candidates[0].server, L"http://extra/") == 0 && wcscmp(candidates[1].server, L"http://boot/") == 0);
+	CHECK(wcscmp(candidates[2].server, L"http://m1/") == 0 && wcscmp(candidates[3].server, L"http://m2/") == 0);
+	count = ListRemoteCandidates(candidates, &manifest, &servers, L"b.dll", L"b.1031.dll", 1031, 1, 1);
+	CHECK(count == 3 && wcscmp(candidates[1].filename, L"b.1031.dll") == 0 && wcscmp(candidates[2].filename, L"b.dll") == 0);
+
+	FreeArtifactManifest(&manifest);
+}
+
+int main() {
+	ArenaMark mark = ArenaGetMark();
+
+	TestSprintf();
+	TestPaths();
+	TestCandidates();
+
+	ArenaReset(mark);
+	DestroyThreadArena();
+
+	if( Failures ) {
+		printf("test_strings: %d failures\n", Failures);
+		return 1;
+	}
+	printf("test_strings: ok\n");
+	return 0;
+}
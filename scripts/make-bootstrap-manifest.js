@@ -0,0 +1,91 @@
+// Include js.js
+with(new ActiveXObject("Scripting.FileSystemObject"))for(var x in p=(".;js;scripts;"+WScript.scriptfullname.replace(/(.*\\)(.*)/g,"$1")+";"+new ActiveXObject("WScript.Shell").Environment("PROCESS")("PATH")).split(";"))if(FileExists(j=BuildPath(p[x],"js.js"))){eval(OpenTextFile(j).ReadAll());break}
+
+/// Builds the artifact manifest that gets embedded in the native bootstrapper (see coapp_manifest.h).
+///
+///     cscript //nologo make-bootstrap-manifest.js <artifact list> <artifact folder> <manifest>
+///
+/// The artifact list has one file a line: <filename> <lcid> [<mirror> ...], tab-separated (lcid 0 is
+/// the language-neutral file). Each one that's in the artifact folder (under the name it's published
+/// as) goes into the manifest with its size and SHA-256. The ones that aren't are left out, and the
+/// bootstrapper falls back to checking their signatures.
+
+var HEADER = "CoAppBootstrapManifest 1";
+var args = [];
+var i;
+
+for (i = 0; i < WScript.Arguments.length; i++) {
+    args.push(WScript.Arguments(i));
+}
+if (args.length != 3) {
+    WScript.echo("usage: make-bootstrap-manifest.js <artifact list> <artifact folder> <manifest>");
+    WScript.Quit(1);
+}
+
+// <name>.<lcid>.<ext> for a localized file.
+function PublishedName(filename, lcid) {
+    if (lcid == 0) {
+        return filename;
+    }
+    var dot = filename.lastIndexOf(".");
+    return dot < 0 ? filename + "." + lcid : filename.substring(0, dot) + "." + lcid + filename.substring(dot);
+}
+
+function Sha256(filename) {
+    // certutil's the one thing on every box that does SHA-256 (older ones put spaces between the bytes).
+    var output = $$.RunCaptured('certutil -hashfile "{0}" SHA256', filename);
+    var lines = output.split("\r\n");
+    var hash = lines.length > 1 ? lines[1].replace(/\s/g, "").toLowerCase() : "";
+    if ($ERRORLEVEL != 0 || !/^[0-9a-f]{64}$/.test(hash)) {
+        Assert.Fail("Can't hash [{0}]", filename);
+    }
+    return hash;
+}
+
+var list = $$.fso.OpenTextFile(args[0], 1, false);
+var lines = [HEADER];
+var line, fields, published, path;
+
+while (!list.AtEndOfStream) {
+    line = list.ReadLine().Trim();
+    if (IsNullOrEmpty(line) || line.charAt(0) == "#") {
+        continue;
+    }
+    fields = line.split("\t");
+    if (fields.length < 2 || !/^[0-9]+$/.test(fields[1])) {
+        Assert.Fail("Bad line in [{0}]: {1}", args[0], line);
+    }
+    published = PublishedName(fields[0], parseInt(fields[1], 10));
+    path = $$.fso.BuildPath(args[1], published);
+
+    if (!$$.fso.FileExists(path)) {
+        WScript.echo("Not in the manifest (can't find it): " + path);
+        continue;
+    }
+    lines.push([fields[0], fields[1], $$.fso.GetFile(path).Size, Sha256(path)].concat(fields.slice(2)).join("\t"));
+}
+list.Close();
+
+// UTF-8, the way the bootstrapper reads it; only rewritten when it changes, so the .rc isn't rebuilt every time.
+var text = lines.join("\r\n") + "\r\n";
+var stream = new ActiveXObject("ADODB.Stream");
+
+if ($$.fso.FileExists(args[2])) {
+    stream.Type = 2;
+    stream.Charset = "utf-8";
+    stream.Open();
+    stream.LoadFromFile(args[2]);
+    var previous = stream.ReadText();
+    stream.Close();
+    if (previous == text) {
+        WScript.Quit(0);
+    }
+}
+
+stream.Type = 2;
+stream.Charset = "utf-8";
+stream.Open();
+stream.WriteText(text);
+stream.SaveToFile(args[2], 2);
+stream.Close();
+WScript.echo("Wrote " + (lines.length - 1) + " artifacts to " + args[2]);